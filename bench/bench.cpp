@@ -0,0 +1,403 @@
+#include "../include/z80e.h"
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+
+/*
+    Remu80 benchmarks
+    Runs built-in Z80 workloads unthrottled and reports the emulated clock speed
+    reached by the host (T-states per second of host time).
+    Usage: bench [name]    run every benchmark, or only the named one
+*/
+
+#define BENCH_REPEAT 5 // runs per measurement, the fastest one is reported
+#define BENCH_CORES 100 // cores created for the shared image benchmark
+
+struct Workload {
+    const char* name;
+    vector<uint8_t> code;
+};
+
+static const vector<Workload> workloads = {
+    // INC A / CP n / JR NZ counting loops, 3 levels deep
+    {"loop", {
+        0x26, 0x00,       // LD H, 0
+        0x2E, 0x00,       // LD L, 0
+        0x3E, 0x00,       // LD A, 0
+        0x3C,             // INC A
+        0xFE, 0xFF,       // CP 0xFF
+        0x20, 0xFB,       // JR NZ, -5
+        0x2C,             // INC L
+        0x7D,             // LD A, L
+        0xFE, 0x64,       // CP 100
+        0x20, 0xF3,       // JR NZ, -13
+        0x24,             // INC H
+        0x7C,             // LD A, H
+        0xFE, 0x08,       // CP 8
+        0x20, 0xEB,       // JR NZ, -21
+        0x76,             // HALT
+    }},
+    // Byte copy loop, 256 x 256 bytes
+    {"copy", {
+        0x06, 0x00,       // LD B, 0
+        0x21, 0x00, 0x10, // LD HL, 0x1000
+        0x11, 0x00, 0x20, // LD DE, 0x2000
+        0x7E,             // LD A, (HL)
+        0x12,             // LD (DE), A
+        0x23,             // INC HL
+        0x13,             // INC DE
+        0x7D,             // LD A, L
+        0xFE, 0x00,       // CP 0
+        0x20, 0xF7,       // JR NZ, -9
+        0x04,             // INC B
+        0x78,             // LD A, B
+        0xFE, 0x00,       // CP 0
+        0x20, 0xEB,       // JR NZ, -21
+        0x76,             // HALT
+    }},
+    // CALL / PUSH / POP / RET
+    {"call", {
+        0x31, 0x00, 0xF0, // LD SP, 0xF000
+        0x26, 0x00,       // LD H, 0
+        0x2E, 0x00,       // LD L, 0
+        0xCD, 0x20, 0x00, // CALL 0x0020
+        0x2C,             // INC L
+        0x7D,             // LD A, L
+        0xFE, 0x00,       // CP 0
+        0x20, 0xF7,       // JR NZ, -9
+        0x24,             // INC H
+        0x7C,             // LD A, H
+        0xFE, 0x40,       // CP 64
+        0x20, 0xEF,       // JR NZ, -17
+        0x76,             // HALT
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0xC5,             // 0x0020: PUSH BC
+        0xD5,             // PUSH DE
+        0xD1,             // POP DE
+        0xC1,             // POP BC
+        0xC9,             // RET
+    }},
+    // 8-bit ALU operations on registers
+    {"alu", {
+        0x26, 0x00,       // LD H, 0
+        0x2E, 0x00,       // LD L, 0
+        0x80,             // ADD A, B
+        0x91,             // SUB C
+        0xA2,             // AND D
+        0xB3,             // OR E
+        0xA8,             // XOR B
+        0x87,             // ADD A, A
+        0x2C,             // INC L
+        0x7D,             // LD A, L
+        0xFE, 0x00,       // CP 0
+        0x20, 0xF4,       // JR NZ, -12
+        0x24,             // INC H
+        0x7C,             // LD A, H
+        0xFE, 0x80,       // CP 128
+        0x20, 0xEC,       // JR NZ, -20
+        0x76,             // HALT
+    }},
+    // ADD/ADC/SUB/SBC/INC/DEC chains, the flags are only read by ADC/SBC and the loop tests
+    {"arith", {
+        0x26, 0x00,       // LD H, 0
+        0x2E, 0x00,       // LD L, 0
+        0x80,             // ADD A, B
+        0x89,             // ADC A, C
+        0x92,             // SUB D
+        0x9B,             // SBC A, E
+        0x0C,             // INC C
+        0x15,             // DEC D
+        0x87,             // ADD A, A
+        0xA9,             // XOR C
+        0xB0,             // OR B
+        0x1C,             // INC E
+        0x8A,             // ADC A, D
+        0x2C,             // INC L
+        0x7D,             // LD A, L
+        0xFE, 0x00,       // CP 0
+        0x20, 0xEF,       // JR NZ, -17
+        0x24,             // INC H
+        0x7C,             // LD A, H
+        0xFE, 0x00,       // CP 0
+        0x20, 0xE9,       // JR NZ, -23
+        0x76,             // HALT
+    }},
+    // (IX+d) loads and stores, 64 x 256 iterations
+    {"index", {
+        0xDD, 0x21, 0x00, 0x10, // LD IX, 0x1000
+        0x26, 0x00,       // LD H, 0
+        0x2E, 0x00,       // LD L, 0
+        0xDD, 0x7E, 0x00, // LD A, (IX+0)
+        0xDD, 0x86, 0x01, // ADD A, (IX+1)
+        0xDD, 0x77, 0x02, // LD (IX+2), A
+        0xDD, 0x23,       // INC IX
+        0x2C,             // INC L
+        0x7D,             // LD A, L
+        0xFE, 0x00,       // CP 0
+        0x20, 0xEF,       // JR NZ, -17
+        0x24,             // INC H
+        0x7C,             // LD A, H
+        0xFE, 0x40,       // CP 64
+        0x20, 0xE9,       // JR NZ, -23
+        0x76,             // HALT
+    }},
+    // LDIR, 256 x 1 KiB
+    {"block", {
+        0x3E, 0x00,       // LD A, 0
+        0x21, 0x00, 0x10, // LD HL, 0x1000
+        0x11, 0x00, 0x20, // LD DE, 0x2000
+        0x01, 0x00, 0x04, // LD BC, 0x0400
+        0xED, 0xB0,       // LDIR
+        0x3D,             // DEC A
+        0x20, 0xF2,       // JR NZ, -14
+        0x76,             // HALT
+    }},
+};
+
+// Runs the workload BENCH_REPEAT times, returns the best host time in seconds
+static double runWorkload(Z80_Core& z80, const Workload& workload, uint64_t& cycles) {
+    double best = 0;
+    for (int i = 0; i < BENCH_REPEAT; i++) {
+        vector<uint8_t> program = workload.code;
+        streambuf* out = cout.rdbuf(nullptr); // silence loadProgram()
+        z80.loadProgram(program);
+        cout.rdbuf(out);
+
+        auto start = chrono::steady_clock::now();
+        z80.run();
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+        cycles = z80.cycles;
+        if (i == 0 || elapsed.count() < best) best = elapsed.count();
+    }
+    return best;
+}
+
+// Same workloads through every dispatcher
+static void benchDispatch(Z80_Core& z80) {
+    const char* names[] = {"switch", "table", "threaded", "cached", "jit"};
+    const uint8_t modes[] = {DISPATCH_SWITCH, DISPATCH_TABLE, DISPATCH_THREADED, DISPATCH_CACHED, DISPATCH_JIT};
+    const int count = sizeof(modes) / sizeof(modes[0]);
+
+    cout << "Dispatch, emulated MHz (speedup over switch)" << endl;
+    cout << left << setw(10) << "workload";
+    for (const char* name : names) cout << setw(18) << name;
+    cout << endl;
+
+    for (const Workload& workload : workloads) {
+        cout << left << setw(10) << workload.name;
+        double baseline = 0;
+        uint64_t baselineCycles = 0;
+        for (int m = 0; m < count; m++) {
+            uint64_t cycles;
+            z80.dispatch = modes[m];
+            double seconds = runWorkload(z80, workload, cycles);
+            if (m == 0) {
+                baseline = seconds;
+                baselineCycles = cycles;
+            } else if (cycles != baselineCycles) {
+                cout << "(cycle mismatch: " << cycles << " vs " << baselineCycles << ") ";
+            }
+            ostringstream cell;
+            cell << fixed << setprecision(1) << cycles / seconds / 1e6 << " (" << setprecision(2) << baseline / seconds << "x)";
+            cout << setw(18) << cell.str();
+        }
+        cout << endl;
+    }
+    z80.dispatch = DISPATCH_CACHED;
+}
+
+// ALU-heavy workloads with F updated after every op and on demand
+static void benchFlags(Z80_Core& z80) {
+    const char* names[] = {"cached", "jit"};
+    const uint8_t modes[] = {DISPATCH_CACHED, DISPATCH_JIT};
+
+    cout << "Flags, emulated MHz eager / lazy (speedup)" << endl;
+    cout << left << setw(10) << "workload";
+    for (const char* name : names) cout << setw(26) << name;
+    cout << endl;
+
+    for (const Workload& workload : workloads) {
+        if (string(workload.name) != "alu" && string(workload.name) != "arith") continue;
+        cout << left << setw(10) << workload.name;
+        for (uint8_t mode : modes) {
+            uint64_t eagerCycles, lazyCycles;
+            z80.dispatch = mode;
+            z80.eagerFlags = true;
+            double eager = runWorkload(z80, workload, eagerCycles);
+            z80.eagerFlags = false;
+            double lazy = runWorkload(z80, workload, lazyCycles);
+            if (eagerCycles != lazyCycles) {
+                cout << "(cycle mismatch: " << lazyCycles << " vs " << eagerCycles << ") ";
+            }
+            ostringstream cell;
+            cell << fixed << setprecision(1) << eagerCycles / eager / 1e6 << " / " << lazyCycles / lazy / 1e6;
+            cell << " (" << setprecision(2) << eager / lazy << "x)";
+            cout << setw(26) << cell.str();
+        }
+        cout << endl;
+    }
+    z80.dispatch = DISPATCH_CACHED;
+}
+
+// Cached dispatch with and without superinstructions, the dispatch counts come from a profiled run
+static void benchFusion(Z80_Core& z80) {
+    cout << "Fusion, cached dispatch: dispatches per instruction and emulated MHz, plain / fused (speedup)" << endl;
+    cout << left << setw(10) << "workload" << setw(22) << "dispatches" << "MHz" << endl;
+
+    z80.dispatch = DISPATCH_CACHED;
+    for (const Workload& workload : workloads) {
+        uint64_t plainCycles, fusedCycles;
+        double ratio[2];
+        for (int fused = 0; fused < 2; fused++) {
+            vector<uint8_t> program = workload.code;
+            streambuf* out = cout.rdbuf(nullptr);
+            z80.fuse = fused;
+            z80.loadProgram(program);
+            cout.rdbuf(out);
+            z80.profilePairs = true;
+            z80.run();
+            z80.profilePairs = false;
+            ratio[fused] = z80.profileInstructions ? (double)z80.profileDispatches / z80.profileInstructions : 1;
+        }
+        z80.fuse = false;
+        double plain = runWorkload(z80, workload, plainCycles);
+        z80.fuse = true;
+        double fused = runWorkload(z80, workload, fusedCycles);
+        if (plainCycles != fusedCycles) {
+            cout << "(cycle mismatch: " << fusedCycles << " vs " << plainCycles << ") ";
+        }
+
+        ostringstream dispatches, speed;
+        dispatches << fixed << setprecision(2) << ratio[0] << " / " << ratio[1];
+        speed << fixed << setprecision(1) << plainCycles / plain / 1e6 << " / " << fusedCycles / fused / 1e6;
+        speed << " (" << setprecision(2) << plain / fused << "x)";
+        cout << left << setw(10) << workload.name << setw(22) << dispatches.str() << speed.str() << endl;
+    }
+}
+
+// Cores sharing one image: ROM read in place by all of them, a RAM page copied by the core that writes it
+static void benchShare() {
+    cout << "Shared image: host time to create a core, private pages after a run" << endl;
+    vector<uint8_t> code = {0x32, 0x00, 0x80}; // LD (0x8000), A, then the loop workload
+    code.insert(code.end(), workloads[0].code.begin(), workloads[0].code.end());
+    shared_ptr<Z80_Image> image = Z80_Image::copy(code.data(), code.size());
+
+    vector<Z80_Core*> cores(BENCH_CORES);
+    auto start = chrono::steady_clock::now();
+    for (Z80_Core*& core : cores) {
+        core = new Z80_Core();
+        core->memory.share(image, 0x4000);
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+    unsigned owned[2];
+    for (int n = 0; n < 2; n++) {
+        cores[n]->pacer.setClock(CLOCK_UNTHROTTLED);
+        cores[n]->disableWatchdog = true;
+        cores[n]->run();
+        owned[n] = cores[n]->memory.privatePages();
+    }
+    bool romShared = cores[0]->memory.readPointer(0) == image->data && cores[1]->memory.readPointer(0) == image->data;
+    bool ramPrivate = cores[0]->memory.readPointer(0x8000) != cores[1]->memory.readPointer(0x8000);
+    cores[0]->memory.revert();
+    if (!romShared || !ramPrivate || owned[0] != 1 || owned[1] != 1 || cores[0]->memory.privatePages() != 0) {
+        cout << "(sharing broken: " << owned[0] << " and " << owned[1] << " private pages, ROM " << (romShared ? "" : "not ") << "shared) ";
+    }
+    cout << fixed << setprecision(1) << elapsed.count() / BENCH_CORES * 1e6 << " us, " << owned[0] << " page" << (owned[0] == 1 ? "" : "s") << endl;
+
+    for (Z80_Core* core : cores) delete core;
+}
+
+// Every kind of store marks exactly the pages it wrote, flat and banked, in every dispatcher
+static void benchDirty() {
+    const char* names[] = {"switch", "table", "threaded", "cached", "jit"};
+    const uint8_t modes[] = {DISPATCH_SWITCH, DISPATCH_TABLE, DISPATCH_THREADED, DISPATCH_CACHED, DISPATCH_JIT};
+    vector<uint8_t> paging = {
+        0x3E, 0x20, 0xD3, 0x79, // LD A, 32 / OUT (0x79), A: window 1 shows RAM bank 32
+        0x3E, 0x21, 0xD3, 0x7A, // LD A, 33 / OUT (0x7A), A
+        0x3E, 0x22, 0xD3, 0x7B, // LD A, 34 / OUT (0x7B), A
+        0x3E, 0x01, 0xD3, 0x7C, // LD A, 1 / OUT (0x7C), A: paging on, window 0 stays in ROM bank 0
+    };
+    vector<uint8_t> stores = {
+        0x3E, 0x55,             // LD A, 0x55
+        0x32, 0x00, 0x40,       // LD (0x4000), A
+        0x32, 0x00, 0x80,       // LD (0x8000), A
+        0x21, 0x00, 0x90,       // LD HL, 0x9000
+        0x36, 0x12,             // LD (HL), 0x12
+        0x21, 0x00, 0xA0,       // LD HL, 0xA000
+        0xCB, 0xC6,             // SET 0, (HL)
+        0x21, 0x00, 0x01,       // LD HL, 0x0100
+        0x11, 0xF0, 0xB3,       // LD DE, 0xB3F0
+        0x01, 0x20, 0x00,       // LD BC, 0x20
+        0xED, 0xB0,             // LDIR, across the 0xB400 page boundary
+        0x32, 0x00, 0x02,       // LD (0x0200), A: ROM, marks nothing
+        0x31, 0x00, 0xC0,       // LD SP, 0xC000
+        0xC5,                   // PUSH BC
+        0x76,                   // HALT
+    };
+    const vector<unsigned> written = {16, 32, 36, 40, 44, 45, 47}; // CPU pages, the same in both layouts
+    // Backing pages: the CPU pages without banking, bank * 16 + page in the bank with it
+    const vector<unsigned> flatPages = written;
+    const vector<unsigned> bankedPages = {512, 528, 532, 536, 540, 541, 543};
+
+    cout << "Dirty pages: pages marked by a run of stores, flat / banked" << endl;
+    if (!MEMORY_DIRTY) {
+        cout << "tracking compiled out, every page counts as dirty" << endl;
+        return;
+    }
+    for (int m = 0; m < (int)(sizeof(modes) / sizeof(modes[0])); m++) {
+        ostringstream result;
+        for (int banked = 0; banked < 2; banked++) {
+            Z80_Core* core = new Z80_Core();
+            core->pacer.setClock(CLOCK_UNTHROTTLED);
+            core->disableWatchdog = true;
+            core->dispatch = modes[m];
+            if (banked) core->memory.setBanking(512 * 1024, 512 * 1024); // the program goes into ROM bank 0
+            else core->memory.setROM(0, MEMORY_PAGE_SIZE);
+            vector<uint8_t> program = banked ? paging : vector<uint8_t>();
+            program.insert(program.end(), stores.begin(), stores.end());
+            streambuf* out = cout.rdbuf(nullptr);
+            core->loadProgram(program);
+            cout.rdbuf(out);
+            core->memory.clearDirty(); // the load itself
+            core->run();
+
+            vector<unsigned> mapped, taken, remaining;
+            for (unsigned page = 0; page < MEMORY_PAGES; page++) {
+                if (core->memory.isDirty(page << MEMORY_PAGE_SHIFT)) mapped.push_back(page);
+            }
+            bool mapDirty = core->memory.isMapDirty();
+            core->memory.takeDirty([&](unsigned page) { taken.push_back(page); });
+            for (unsigned page = 0; page < MEMORY_PAGES; page++) {
+                if (core->memory.isDirty(page << MEMORY_PAGE_SHIFT)) remaining.push_back(page);
+            }
+            bool mapLeft = core->memory.isMapDirty();
+            delete core;
+
+            if (banked) result << " / ";
+            if (mapped != written || taken != (banked ? bankedPages : flatPages) || !remaining.empty() || mapDirty != (bool)banked || mapLeft) {
+                result << "(dirty tracking broken: " << mapped.size() << " pages mapped dirty, " << taken.size() << " taken, ";
+                result << remaining.size() << " left, map " << (mapDirty ? "" : "not ") << "dirty) ";
+            }
+            result << taken.size();
+        }
+        cout << left << setw(10) << names[m] << result.str() << " pages" << endl;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    Z80_Core* z80 = new Z80_Core();
+    z80->pacer.setClock(CLOCK_UNTHROTTLED);
+    z80->disableWatchdog = true;
+
+    string only = (argc > 1) ? argv[1] : "";
+    if (only.empty() || only == "dispatch") benchDispatch(*z80);
+    if (only.empty() || only == "flags") benchFlags(*z80);
+    if (only.empty() || only == "fusion") benchFusion(*z80);
+    if (only.empty() || only == "share") benchShare();
+    if (only.empty() || only == "dirty") benchDirty();
+
+    delete z80;
+    return 0;
+}
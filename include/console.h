@@ -0,0 +1,68 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <termios.h>
+#include <time.h>
+
+#define CONSOLE_BUFFER_SIZE 4096 // must be a power of two
+#define CONSOLE_OUTPUT_SIZE 4096
+#define CONSOLE_FLUSH_INTERVAL_US 20000 // default age of buffered output before it's forced out
+
+using namespace std;
+
+/*
+    Host console.
+    The terminal is put in raw mode once, SIGINT, SIGTERM, SIGQUIT and SIGHUP
+    restore it before they end the process. A reader thread moves stdin into a
+    single producer / single consumer lock-free ring buffer. The emulation thread
+    only pops bytes from the ring, it never makes a syscall to poll for input.
+    When it has nothing to do but wait for input (HALT) it sleeps in wait(), the
+    reader thread wakes it up through a pipe.
+
+    Output is collected in a buffer and written with a single write() on newline,
+    when the buffer is full, when the program waits for input, on HALT or once
+    the oldest buffered byte is older than the flush interval.
+*/
+class Z80_Console {
+    public:
+        Z80_Console();
+        ~Z80_Console();
+        void start(); // enter raw mode and spawn the reader thread
+        void stop(); // join the reader thread and restore the terminal
+        bool available(); // true if at least one byte is queued
+        bool read(uint8_t& ch); // pop one byte, false if the queue is empty
+        bool wait(int timeoutMs); // sleep until input is queued, false on timeout or once input is closed
+        bool closed(); // true once the input ended and everything queued was read
+
+        void write(uint8_t ch); // queue one byte of output
+        void flush(); // write out everything buffered
+        void flushIfDue(); // flush if the buffered output is older than the flush interval
+        void setUnbuffered(bool enable); // write every byte immediately (interactive mode)
+        void setFlushInterval(uint32_t us);
+
+    private:
+        void readerLoop();
+        void wake(); // signal wait() from the reader thread
+
+        uint8_t buffer[CONSOLE_BUFFER_SIZE];
+        atomic<uint32_t> head; // written by the reader thread
+        atomic<uint32_t> tail; // written by the emulation thread
+        thread reader;
+        int stopPipe[2]; // wakes the reader thread up on stop()
+        int wakePipe[2]; // wakes the emulation thread up in wait() when input comes in or ends
+        atomic<bool> inputClosed; // the reader thread is done, EOF or error
+        bool running;
+        bool rawMode;
+        struct termios oldt;
+
+        uint8_t outBuffer[CONSOLE_OUTPUT_SIZE];
+        uint32_t outLength;
+        bool unbuffered;
+        int64_t flushInterval; // ns
+        struct timespec outSince; // when the oldest buffered byte was written
+};
+
+#endif
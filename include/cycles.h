@@ -0,0 +1,121 @@
+#ifndef CYCLES_H
+#define CYCLES_H
+
+#include <cstdint>
+
+/*
+    Z80 instruction timings in T-states.
+    Every executed opcode costs one lookup in these tables, instructions with a
+    data dependent length add the CYCLES_*_TAKEN / CYCLES_BLOCK_REPEAT extra.
+*/
+
+#define CYCLES_JR_TAKEN 5 // JR cc, e: 7 -> 12
+#define CYCLES_DJNZ_TAKEN 5 // DJNZ e: 8 -> 13
+#define CYCLES_RET_TAKEN 6 // RET cc: 5 -> 11
+#define CYCLES_CALL_TAKEN 7 // CALL cc, nn: 10 -> 17
+#define CYCLES_BLOCK_REPEAT 5 // LDIR, CPIR, INIR, OTIR...: 16 -> 21 while repeating
+#define CYCLES_IRQ_IM0 13 // interrupt acknowledge + the RST on the bus
+#define CYCLES_IRQ_IM1 13 // interrupt acknowledge + RST 38H
+#define CYCLES_IRQ_IM2 19 // interrupt acknowledge + vector fetch + call
+
+// Unprefixed opcodes, conditional CALL/RET/JR/DJNZ list the not-taken time. Prefix bytes are 0, their cost is in the prefixed table
+constexpr uint8_t cyclesMain[256] = {
+     4,10, 7, 6, 4, 4, 7, 4, 4,11, 7, 6, 4, 4, 7, 4, // 00
+     8,10, 7, 6, 4, 4, 7, 4,12,11, 7, 6, 4, 4, 7, 4, // 10
+     7,10,16, 6, 4, 4, 7, 4, 7,11,16, 6, 4, 4, 7, 4, // 20
+     7,10,13, 6,11,11,10, 4, 7,11,13, 6, 4, 4, 7, 4, // 30
+     4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4, // 40
+     4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4, // 50
+     4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4, // 60
+     7, 7, 7, 7, 7, 7, 4, 7, 4, 4, 4, 4, 4, 4, 7, 4, // 70
+     4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4, // 80
+     4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4, // 90
+     4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4, // A0
+     4, 4, 4, 4, 4, 4, 7, 4, 4, 4, 4, 4, 4, 4, 7, 4, // B0
+     5,10,10,10,10,11, 7,11, 5,10,10, 0,10,17, 7,11, // C0
+     5,10,10,11,10,11, 7,11, 5, 4,10,11,10, 0, 7,11, // D0
+     5,10,10,19,10,11, 7,11, 5, 4,10, 4,10, 0, 7,11, // E0
+     5,10,10, 4,10,11, 7,11, 5, 6,10, 4,10, 0, 7,11, // F0
+};
+
+// CB prefix, includes the prefix fetch
+constexpr uint8_t cyclesCB[256] = {
+     8, 8, 8, 8, 8, 8,15, 8, 8, 8, 8, 8, 8, 8,15, 8, // 00
+     8, 8, 8, 8, 8, 8,15, 8, 8, 8, 8, 8, 8, 8,15, 8, // 10
+     8, 8, 8, 8, 8, 8,15, 8, 8, 8, 8, 8, 8, 8,15, 8, // 20
+     8, 8, 8, 8, 8, 8,15, 8, 8, 8, 8, 8, 8, 8,15, 8, // 30
+     8, 8, 8, 8, 8, 8,12, 8, 8, 8, 8, 8, 8, 8,12, 8, // 40
+     8, 8, 8, 8, 8, 8,12, 8, 8, 8, 8, 8, 8, 8,12, 8, // 50
+     8, 8, 8, 8, 8, 8,12, 8, 8, 8, 8, 8, 8, 8,12, 8, // 60
+     8, 8, 8, 8, 8, 8,12, 8, 8, 8, 8, 8, 8, 8,12, 8, // 70
+     8, 8, 8, 8, 8, 8,15, 8, 8, 8, 8, 8, 8, 8,15, 8, // 80
+     8, 8, 8, 8, 8, 8,15, 8, 8, 8, 8, 8, 8, 8,15, 8, // 90
+     8, 8, 8, 8, 8, 8,15, 8, 8, 8, 8, 8, 8, 8,15, 8, // A0
+     8, 8, 8, 8, 8, 8,15, 8, 8, 8, 8, 8, 8, 8,15, 8, // B0
+     8, 8, 8, 8, 8, 8,15, 8, 8, 8, 8, 8, 8, 8,15, 8, // C0
+     8, 8, 8, 8, 8, 8,15, 8, 8, 8, 8, 8, 8, 8,15, 8, // D0
+     8, 8, 8, 8, 8, 8,15, 8, 8, 8, 8, 8, 8, 8,15, 8, // E0
+     8, 8, 8, 8, 8, 8,15, 8, 8, 8, 8, 8, 8, 8,15, 8, // F0
+};
+
+// ED prefix, includes the prefix fetch. Repeating block instructions list the final iteration, undefined opcodes act as two NOPs
+constexpr uint8_t cyclesED[256] = {
+     8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, // 00
+     8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, // 10
+     8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, // 20
+     8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, // 30
+    12,12,15,20, 8,14, 8, 9,12,12,15,20, 8,14, 8, 9, // 40
+    12,12,15,20, 8,14, 8, 9,12,12,15,20, 8,14, 8, 9, // 50
+    12,12,15,20, 8,14, 8,18,12,12,15,20, 8,14, 8,18, // 60
+    12,12,15,20, 8,14, 8, 8,12,12,15,20, 8,14, 8, 8, // 70
+     8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, // 80
+     8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, // 90
+    16,16,16,16, 8, 8, 8, 8,16,16,16,16, 8, 8, 8, 8, // A0
+    16,16,16,16, 8, 8, 8, 8,16,16,16,16, 8, 8, 8, 8, // B0
+     8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, // C0
+     8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, // D0
+     8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, // E0
+     8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, // F0
+};
+
+// DD/FD prefix, includes the prefix fetch. Opcodes not affected by the prefix take their base time + 4
+constexpr uint8_t cyclesDD[256] = {
+     8,14,11,10, 8, 8,11, 8, 8,15,11,10, 8, 8,11, 8, // 00
+    12,14,11,10, 8, 8,11, 8,16,15,11,10, 8, 8,11, 8, // 10
+    11,14,20,10, 8, 8,11, 8,11,15,20,10, 8, 8,11, 8, // 20
+    11,14,17,10,23,23,19, 8,11,15,17,10, 8, 8,11, 8, // 30
+     8, 8, 8, 8, 8, 8,19, 8, 8, 8, 8, 8, 8, 8,19, 8, // 40
+     8, 8, 8, 8, 8, 8,19, 8, 8, 8, 8, 8, 8, 8,19, 8, // 50
+     8, 8, 8, 8, 8, 8,19, 8, 8, 8, 8, 8, 8, 8,19, 8, // 60
+    19,19,19,19,19,19, 8,19, 8, 8, 8, 8, 8, 8,19, 8, // 70
+     8, 8, 8, 8, 8, 8,19, 8, 8, 8, 8, 8, 8, 8,19, 8, // 80
+     8, 8, 8, 8, 8, 8,19, 8, 8, 8, 8, 8, 8, 8,19, 8, // 90
+     8, 8, 8, 8, 8, 8,19, 8, 8, 8, 8, 8, 8, 8,19, 8, // A0
+     8, 8, 8, 8, 8, 8,19, 8, 8, 8, 8, 8, 8, 8,19, 8, // B0
+     9,14,14,14,14,15,11,15, 9,14,14, 0,14,21,11,15, // C0
+     9,14,14,15,14,15,11,15, 9, 8,14,15,14, 4,11,15, // D0
+     9,14,14,23,14,15,11,15, 9, 8,14, 8,14, 4,11,15, // E0
+     9,14,14, 8,14,15,11,15, 9,10,14, 8,14, 4,11,15, // F0
+};
+
+// DDCB/FDCB prefix, includes both prefix bytes and the displacement
+constexpr uint8_t cyclesDDCB[256] = {
+    23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23, // 00
+    23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23, // 10
+    23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23, // 20
+    23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23, // 30
+    20,20,20,20,20,20,20,20,20,20,20,20,20,20,20,20, // 40
+    20,20,20,20,20,20,20,20,20,20,20,20,20,20,20,20, // 50
+    20,20,20,20,20,20,20,20,20,20,20,20,20,20,20,20, // 60
+    20,20,20,20,20,20,20,20,20,20,20,20,20,20,20,20, // 70
+    23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23, // 80
+    23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23, // 90
+    23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23, // A0
+    23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23, // B0
+    23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23, // C0
+    23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23, // D0
+    23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23, // E0
+    23,23,23,23,23,23,23,23,23,23,23,23,23,23,23,23, // F0
+};
+
+#endif
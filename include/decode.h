@@ -0,0 +1,80 @@
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <cstdint>
+
+/*
+    Z80 instruction layout, used to pre-decode straight-line code.
+    Low bits are the number of immediate/displacement bytes after the opcode,
+    the flags mark instructions that never fall through, prefix bytes and I/O.
+*/
+
+#define DECODE_OPERANDS 0x03 // mask: operand bytes after the opcode
+#define DECODE_JUMP 0x04 // JP, JR, CALL, RET, RST, HALT...: never continues at the next instruction
+#define DECODE_PREFIX 0x08 // CB, DD, ED, FD: the next byte is the opcode
+#define DECODE_IO 0x10 // IN/OUT forms, they end a block so the JIT leaves them to the interpreter
+#define DECODE_INDEXED 0x20 // DD/FD: (HL) becomes (IX+d)/(IY+d), the displacement is the first operand
+#define DECODE_INDEX_HL 0x40 // DD/FD: HL, H and L become IX, IXH and IXL (IY, IYH, IYL)
+
+// Unprefixed opcodes
+constexpr uint8_t decodeMain[256] = {
+     0, 2, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, // 00
+     1, 2, 0, 0, 0, 0, 1, 0, 5, 0, 0, 0, 0, 0, 1, 0, // 10
+     1, 2, 2, 0, 0, 0, 1, 0, 1, 0, 2, 0, 0, 0, 1, 0, // 20
+     1, 2, 2, 0, 0, 0, 1, 0, 1, 0, 2, 0, 0, 0, 1, 0, // 30
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 40
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 50
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 60
+     0, 0, 0, 0, 0, 0, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 70
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 80
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 90
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // A0
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // B0
+     0, 0, 2, 6, 2, 0, 1, 4, 0, 4, 2, 8, 2, 6, 1, 4, // C0
+     0, 0, 2,17, 2, 0, 1, 4, 0, 0, 2,17, 2, 8, 1, 4, // D0
+     0, 0, 2, 0, 2, 0, 1, 4, 0, 4, 2, 0, 2, 8, 1, 4, // E0
+     0, 0, 2, 0, 2, 0, 1, 4, 0, 0, 2, 0, 2, 8, 1, 4, // F0
+};
+
+// ED prefix, operand bytes follow the second opcode byte
+constexpr uint8_t decodeED[256] = {
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 00
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 10
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 20
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 30
+    16,16, 0, 2, 0, 4, 0, 0,16,16, 0, 2, 0, 4, 0, 0, // 40
+    16,16, 0, 2, 0, 4, 0, 0,16,16, 0, 2, 0, 4, 0, 0, // 50
+    16,16, 0, 2, 0, 4, 0, 0,16,16, 0, 2, 0, 4, 0, 0, // 60
+    16,16, 0, 2, 0, 4, 0, 0,16,16, 0, 2, 0, 4, 0, 0, // 70
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 80
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 90
+     0, 0,16,16, 0, 0, 0, 0, 0, 0,16,16, 0, 0, 0, 0, // A0
+     0, 0,16,16, 0, 0, 0, 0, 0, 0,16,16, 0, 0, 0, 0, // B0
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // C0
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // D0
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // E0
+     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // F0
+};
+
+// DD/FD prefix by the second opcode byte, operand bytes include the displacement
+// DD/ED/FD after the prefix start a new instruction, CB has the displacement and the opcode
+constexpr uint8_t decodeDD[256] = {
+     0, 2, 0, 0, 0, 0, 1, 0, 0,64, 0, 0, 0, 0, 1, 0, // 00
+     1, 2, 0, 0, 0, 0, 1, 0, 5,64, 0, 0, 0, 0, 1, 0, // 10
+     1,66,66,64,64,64,65, 0, 1,64,66,64,64,64,65, 0, // 20
+     1, 2, 2, 0,33,33,34, 0, 1,64, 2, 0, 0, 0, 1, 0, // 30
+     0, 0, 0, 0,64,64,33, 0, 0, 0, 0, 0,64,64,33, 0, // 40
+     0, 0, 0, 0,64,64,33, 0, 0, 0, 0, 0,64,64,33, 0, // 50
+    64,64,64,64,64,64,33,64,64,64,64,64,64,64,33,64, // 60
+    33,33,33,33,33,33, 4,33, 0, 0, 0, 0,64,64,33, 0, // 70
+     0, 0, 0, 0,64,64,33, 0, 0, 0, 0, 0,64,64,33, 0, // 80
+     0, 0, 0, 0,64,64,33, 0, 0, 0, 0, 0,64,64,33, 0, // 90
+     0, 0, 0, 0,64,64,33, 0, 0, 0, 0, 0,64,64,33, 0, // A0
+     0, 0, 0, 0,64,64,33, 0, 0, 0, 0, 0,64,64,33, 0, // B0
+     0, 0, 2, 6, 2, 0, 1, 4, 0, 4, 2,42, 2, 6, 1, 4, // C0
+     0, 0, 2,17, 2, 0, 1, 4, 0, 0, 2,17, 2, 8, 1, 4, // D0
+     0,64, 2,64, 2,64, 1, 4, 0,68, 2, 0, 2, 8, 1, 4, // E0
+     0, 0, 2, 0, 2, 0, 1, 4, 0,64, 2, 0, 2, 8, 1, 4, // F0
+};
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef FLAGS_H
+#define FLAGS_H
+
+#include <cstdint>
+
+/*
+    Z80 flag register and the flag tables used by the ALU.
+    Everything is computed at compile time, an 8-bit ALU op gets its flags from
+    one or two table loads instead of testing the result bit by bit.
+*/
+
+#define FLAG_C 0x01
+#define FLAG_N 0x02
+#define FLAG_P 0x04 // parity for logic ops and rotates, overflow for arithmetic
+#define FLAG_3 0x08 // undocumented, copy of bit 3 of the result
+#define FLAG_H 0x10
+#define FLAG_5 0x20 // undocumented, copy of bit 5 of the result
+#define FLAG_Z 0x40
+#define FLAG_S 0x80
+
+// Index into the half carry and overflow tables: bits 3 and 7 of both operands and the result
+constexpr uint8_t flagIndex(uint8_t op1, uint8_t op2, uint8_t result) {
+    return ((op1 & 0x88) >> 3) | ((op2 & 0x88) >> 2) | ((result & 0x88) >> 1);
+}
+
+// ADD/ADC and SUB/SBC/CP, half carry by (flagIndex & 7), overflow by (flagIndex >> 4)
+constexpr uint8_t halfcarryAdd[8] = {0, FLAG_H, FLAG_H, FLAG_H, 0, 0, 0, FLAG_H};
+constexpr uint8_t halfcarrySub[8] = {0, 0, FLAG_H, 0, FLAG_H, 0, FLAG_H, FLAG_H};
+constexpr uint8_t overflowAdd[8] = {0, 0, 0, FLAG_P, FLAG_P, 0, 0, 0};
+constexpr uint8_t overflowSub[8] = {0, FLAG_P, 0, 0, 0, 0, FLAG_P, 0};
+
+struct Z80_FlagTables {
+    uint8_t sz[256]; // S, Z, 5 and 3 of a result
+    uint8_t szp[256]; // same with even parity in P/V, logic ops, rotates and shifts
+    uint8_t inc[256]; // INC r, by result, C is left alone
+    uint8_t dec[256]; // DEC r, by result, C is left alone
+    uint16_t daa[2048]; // A << 8 | F after DAA, by A | C << 8 | H << 9 | N << 10
+};
+
+constexpr Z80_FlagTables makeFlagTables() {
+    Z80_FlagTables t = {};
+    for (int v = 0; v < 256; v++) {
+        uint8_t sz = (v & (FLAG_S | FLAG_5 | FLAG_3)) | (v == 0 ? FLAG_Z : 0);
+        int bits = 0;
+        for (int i = 0; i < 8; i++) bits += (v >> i) & 1;
+        t.sz[v] = sz;
+        t.szp[v] = sz | ((bits & 1) ? 0 : FLAG_P);
+        t.inc[v] = sz | ((v & 0x0F) == 0x00 ? FLAG_H : 0) | (v == 0x80 ? FLAG_P : 0);
+        t.dec[v] = sz | FLAG_N | ((v & 0x0F) == 0x0F ? FLAG_H : 0) | (v == 0x7F ? FLAG_P : 0);
+    }
+    for (int i = 0; i < 2048; i++) {
+        int a = i & 0xFF;
+        bool carry = i & 0x100, half = i & 0x200, subtract = i & 0x400;
+        int diff = 0;
+        if (half || (a & 0x0F) > 9) diff |= 0x06;
+        if (carry || a > 0x99) {
+            diff |= 0x60;
+            carry = true;
+        }
+        int result = (subtract ? a - diff : a + diff) & 0xFF;
+        bool h = subtract ? (half && (a & 0x0F) < 6) : ((a & 0x0F) > 9);
+        uint8_t f = t.szp[result] | (h ? FLAG_H : 0) | (subtract ? FLAG_N : 0) | (carry ? FLAG_C : 0);
+        t.daa[i] = (result << 8) | f;
+    }
+    return t;
+}
+
+constexpr Z80_FlagTables flagTables = makeFlagTables();
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef FUSION_H
+#define FUSION_H
+
+/*
+    Superinstructions: instruction pairs the pre-decoder merges into one handler
+    (DISPATCH_CACHED), so a hot loop needs fewer dispatches per iteration.
+    Instructions are keyed prefix << 8 | opcode, unprefixed ones by their opcode.
+    The list is fixed at compile time. It holds the pairs leading the profiles
+    of hello.hex and the bench workloads: -f prints a program's profile and
+    marks the pairs that are fused, -F prints its hottest pairs that can be
+    fused in the format below, ready to be merged into the list.
+    The first instruction of a pair never jumps, the second one may.
+*/
+
+#define FUSE_NONE 0xFFFF // Z80_Decoded::fusedKey of an instruction that isn't a pair
+
+#define Z80_FUSED_PAIRS(X) \
+    X(0x007E, 0x0023) /* LD A, (HL) / INC HL */ \
+    X(0x0077, 0x0023) /* LD (HL), A / INC HL */ \
+    X(0x007E, 0x0012) /* LD A, (HL) / LD (DE), A */ \
+    X(0x007E, 0x00FE) /* LD A, (HL) / CP n */ \
+    X(0x0023, 0x0018) /* INC HL / JR e */ \
+    X(0x0023, 0x0003) /* INC HL / INC BC */ \
+    X(0x0003, 0x0018) /* INC BC / JR e */ \
+    X(0x0023, 0x0013) /* INC HL / INC DE */ \
+    X(0x0005, 0x0020) /* DEC B / JR NZ, e */ \
+    X(0x000D, 0x0020) /* DEC C / JR NZ, e */ \
+    X(0x0015, 0x0020) /* DEC D / JR NZ, e */ \
+    X(0x001D, 0x0020) /* DEC E / JR NZ, e */ \
+    X(0x003D, 0x0020) /* DEC A / JR NZ, e */ \
+    X(0x000B, 0x0078) /* DEC BC / LD A, B */ \
+    X(0x0078, 0x00B1) /* LD A, B / OR C */ \
+    X(0x00B1, 0x0020) /* OR C / JR NZ, e */ \
+    X(0x00FE, 0x0020) /* CP n / JR NZ, e */ \
+    X(0x00FE, 0x0028) /* CP n / JR Z, e */ \
+    X(0x00FE, 0x0030) /* CP n / JR NC, e */ \
+    X(0x00FE, 0x0038) /* CP n / JR C, e */ \
+    X(0x00FE, 0x00C2) /* CP n / JP NZ, nn */ \
+    X(0x00FE, 0x00CA) /* CP n / JP Z, nn */ \
+    X(0x00B7, 0x0028) /* OR A / JR Z, e */ \
+    X(0x00A7, 0x0028) /* AND A / JR Z, e */ \
+    X(0x002C, 0x007D) /* INC L / LD A, L */ \
+    X(0x0024, 0x007C) /* INC H / LD A, H */ \
+    X(0x007D, 0x00FE) /* LD A, L / CP n */ \
+    X(0x007C, 0x00FE) /* LD A, H / CP n */ \
+    X(0x0078, 0x00FE) /* LD A, B / CP n */ \
+    X(0x00D5, 0x00D1) /* PUSH DE / POP DE */ \
+    X(0x00C5, 0x00D5) /* PUSH BC / PUSH DE */ \
+    X(0x00D1, 0x00C1) /* POP DE / POP BC */ \
+    X(0x00C1, 0x00C9) /* POP BC / RET */ \
+    X(0x0080, 0x0091) /* ADD A, B / SUB C */ \
+    X(0x00A2, 0x00B3) /* AND D / OR E */ \
+    X(0x00A8, 0x0087) /* XOR B / ADD A, A */ \
+    X(0x0080, 0x0089) /* ADD A, B / ADC A, C */ \
+    X(0x0092, 0x009B) /* SUB D / SBC A, E */ \
+    X(0x000C, 0x0015) /* INC C / DEC D */ \
+    X(0x0087, 0x00A9) /* ADD A, A / XOR C */ \
+    X(0x00B0, 0x001C) /* OR B / INC E */ \
+    X(0xDD6E, 0xDD66) /* LD L, (IX+d) / LD H, (IX+d) */ \
+    X(0xDD5E, 0xDD56) /* LD E, (IX+d) / LD D, (IX+d) */ \
+    X(0xDD7E, 0xDD86) /* LD A, (IX+d) / ADD A, (IX+d) */ \
+    X(0xDD86, 0xDD77) /* ADD A, (IX+d) / LD (IX+d), A */ \
+    X(0xDD77, 0xDD23) /* LD (IX+d), A / INC IX */ \
+    X(0xFD6E, 0xFD66) /* LD L, (IY+d) / LD H, (IY+d) */ \
+    X(0xFD5E, 0xFD56) /* LD E, (IY+d) / LD D, (IY+d) */
+
+#endif
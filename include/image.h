@@ -0,0 +1,34 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define IMAGE_ALIGN 1024 // data can be read up to its size rounded up to this, zeros past the end
+
+using namespace std;
+
+/*
+    Read-only memory image that any number of cores can share, see
+    Z80_Memory::share(). A file is mapped straight from the page cache, so
+    every process running the same firmware shares one copy of it too.
+*/
+class Z80_Image {
+    public:
+        static shared_ptr<Z80_Image> map(const string& path); // nullptr if it can't be mapped
+        static shared_ptr<Z80_Image> copy(const uint8_t* bytes, size_t length);
+        ~Z80_Image();
+
+        const uint8_t* data;
+        size_t size;
+
+    private:
+        Z80_Image();
+        void* mapped; // mmap of the file, nullptr for a copy
+        vector<uint8_t> storage; // the copy
+};
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <cstdint>
+#include <cstddef>
+
+#define JIT_CACHE_SIZE (8 << 20) // native code bytes, the whole cache is flushed when it fills up
+#define JIT_BLOCK_MAX 16384 // worst case native size of one block
+#define JIT_THRESHOLD 16 // interpreted runs of a block before it gets compiled
+
+using namespace std;
+
+/*
+    Code cache of the x86-64 recompiler (DISPATCH_JIT).
+    One read/write/execute mapping, blocks are appended to it and only dropped
+    all at once. Compiled code runs with the core pointer in rbx, it's entered
+    through a small trampoline and every exit jumps back to its other half.
+    The translation itself is done by Z80_Core in src/jit.cpp.
+*/
+class Z80_Jit {
+    public:
+        Z80_Jit();
+        ~Z80_Jit();
+        bool start(); // map the cache on first use, false if this host can't run the JIT
+        uint8_t* reserve(); // room for one block, nullptr when the cache is full
+        void commit(uint8_t* end); // the block being compiled ends here
+        void reset(); // drop all compiled code
+        void enter(void* core, const uint8_t* code); // run compiled code until it leaves
+
+        uint8_t* leaveCode; // every exit of compiled code jumps here
+        uint8_t* linkSite; // set when compiled code left through a direct jump that isn't chained yet
+
+    private:
+        uint8_t* cache;
+        size_t used;
+        size_t trampolines; // bytes at the start of the cache used by enter/leave
+        bool failed;
+};
+
+#endif
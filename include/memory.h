@@ -0,0 +1,175 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "image.h"
+
+#define MEMORY_SIZE 0x10000
+#define MEMORY_PAGE_SHIFT 10 // 1 KiB pages
+#define MEMORY_PAGE_SIZE (1u << MEMORY_PAGE_SHIFT)
+#define MEMORY_PAGE_MASK (MEMORY_PAGE_SIZE - 1)
+#define MEMORY_PAGES (MEMORY_SIZE >> MEMORY_PAGE_SHIFT)
+
+#ifndef MEMORY_DIRTY
+#define MEMORY_DIRTY 1 // track written pages, build with -DMEMORY_DIRTY=0 to leave it out
+#endif
+
+#define PAGE_RAM 0
+#define PAGE_ROM 1 // writes are ignored
+#define PAGE_UNMAPPED 2 // reads 0xFF, writes are ignored
+#define PAGE_MMIO 3 // reads and writes go to a device
+#define PAGE_COW 4 // RAM still read from a shared image or not allocated yet, the first write gives it a copy of its own
+
+// Bank switching, as on the RC2014 512K ROM / 512K RAM card
+#define BANK_SHIFT 14 // 16 KiB windows
+#define BANK_SIZE (1u << BANK_SHIFT)
+#define BANK_WINDOWS (MEMORY_SIZE >> BANK_SHIFT)
+#define BANK_PORT_SELECT 0x78 // OUT to 0x78-0x7B selects the bank of window 0-3
+#define BANK_PORT_ENABLE 0x7C // bit 0 turns paging on, while it's off every window shows bank 0
+
+using namespace std;
+
+/*
+    Paged 64 KiB address space.
+    Every page has a host pointer for reads and one for writes, so plain RAM is
+    a table load and an indexed access. ROM writes land in a scratch page and
+    unmapped reads come from a page of 0xFF, neither needs a check. Only pages
+    of memory-mapped devices have no pointers, finding nullptr sends the access
+    down the slow path to the device.
+    The contents live in one flat 64 KiB array, a page points at the part with
+    its own address. It's allocated by the first store or load, until then the
+    pages read zeros the same way copy-on-write pages read a shared image. With banking set up they live in the banks instead: ROM
+    banks first, then RAM, and each 16 KiB window points its pages into the
+    bank selected for it, so a switch is 16 pointer pairs and no copying.
+    Changing a mapping calls remapped so code decoded from that range can be
+    dropped.
+    Stores into RAM also set a byte in dirty for the page backing them, the
+    CPU page without banking and the page of its bank with it, so snapshots,
+    resets and caches can ask which contents changed since they last cleared
+    them. ROM and unmapped writes change nothing and aren't counted, a bank
+    switch changes no contents but sets mapDirty.
+    Cores running the same firmware can share() one image instead of the flat
+    array: its ROM pages are read in place and its RAM pages are copy on
+    write, they have no write pointer until the first store allocates a
+    private copy. A core then only owns the pages it has written.
+*/
+class Z80_Memory {
+    public:
+        Z80_Memory();
+
+        uint8_t read(uint16_t address) {
+            const uint8_t* page = readPage[address >> MEMORY_PAGE_SHIFT];
+            if (page) return page[address & MEMORY_PAGE_MASK];
+            return readDevice(address);
+        }
+        void write(uint16_t address, uint8_t value) {
+            uint8_t* page = writePage[address >> MEMORY_PAGE_SHIFT];
+            if (page) {
+                page[address & MEMORY_PAGE_MASK] = value;
+#if MEMORY_DIRTY
+                *dirtyMark[address >> MEMORY_PAGE_SHIFT] = 1;
+#endif
+            } else {
+                writeSlow(address, value);
+            }
+        }
+        // Host address of a byte for bulk access, valid up to the end of its page, nullptr on a device
+        const uint8_t* readPointer(uint16_t address) {
+            const uint8_t* page = readPage[address >> MEMORY_PAGE_SHIFT];
+            return page ? page + (address & MEMORY_PAGE_MASK) : nullptr;
+        }
+        uint8_t* writePointer(uint16_t address) {
+            uint8_t* page = writePage[address >> MEMORY_PAGE_SHIFT];
+            if (page == nullptr && attribute[address >> MEMORY_PAGE_SHIFT] == PAGE_COW) page = privatize(address >> MEMORY_PAGE_SHIFT);
+            return page ? page + (address & MEMORY_PAGE_MASK) : nullptr;
+        }
+        uint8_t attributes(uint16_t address) { return attribute[address >> MEMORY_PAGE_SHIFT]; } // PAGE_*
+        uint8_t peek(uint16_t address); // no side effects, devices read as 0xFF
+        void load(uint16_t address, const uint8_t* data, size_t length); // into what's mapped there, ROM included
+        void reset(); // paging off
+
+        // Dirty pages are backing pages: the 64 CPU pages, or with banking the pages of the
+        // banks, ROM first. All of them count as dirty when tracking is compiled out.
+        void markDirty(uint16_t address, unsigned length); // after a bulk store through writePointer()
+        bool isDirty(uint16_t address); // the page mapped there
+        bool isMapDirty() { return !MEMORY_DIRTY || mapDirty; } // banks switched
+        void clearDirty() { fill(dirty.begin(), dirty.end(), 0); mapDirty = false; }
+        unsigned backingPages() { return dirty.size(); } // a multiple of 8
+        const uint8_t* backingData(unsigned page); // MEMORY_PAGE_SIZE bytes of a backing page
+        template<typename Visit> void takeDirty(Visit visit) { // visit(page) for every dirty backing page, then clear them
+            for (unsigned page = 0; page < dirty.size(); page += 8) {
+                uint64_t eight;
+                memcpy(&eight, dirty.data() + page, 8);
+                if (eight == 0 && MEMORY_DIRTY) continue;
+                for (unsigned n = page; n < page + 8; n++) {
+                    if (!MEMORY_DIRTY || dirty[n]) visit(n);
+                }
+            }
+            clearDirty();
+        }
+
+        // Ranges are rounded out to whole pages
+        void setRAM(uint16_t address, unsigned length);
+        void setROM(uint16_t address, unsigned length);
+        void unmap(uint16_t address, unsigned length);
+        void mapDevice(uint16_t address, unsigned length, function<uint8_t(uint16_t)> read, function<void(uint16_t, uint8_t)> write);
+        function<void(uint16_t, unsigned)> remapped; // a mapping in [address, address + length) changed
+
+        // Banked memory, the window pages take the type of their bank, device pages stay mapped
+        void setBanking(size_t romSize, size_t ramSize); // multiples of BANK_SIZE, 0 and 0 back to flat 64 KiB
+        bool banked() { return !banks.empty(); }
+        void loadBank(unsigned bank, const uint8_t* data, size_t length); // may continue into the following banks
+        void selectBank(unsigned window, uint8_t bank);
+        void setPaging(bool enable);
+        bool bankPort(uint8_t port, uint8_t value); // an OUT, false if it isn't for the banking registers
+
+        // Shared images, flat 64 KiB layout only
+        void share(shared_ptr<const Z80_Image> boot, size_t romSize); // [0, romSize) is ROM, the rest copy-on-write RAM
+        void revert(); // drop the private copies, back to the image as shared
+        unsigned privatePages(); // pages with a copy of their own
+
+        // Page tables, compiled code indexes them too
+        const uint8_t* readPage[MEMORY_PAGES];
+        uint8_t* writePage[MEMORY_PAGES];
+
+    private:
+        struct Device {
+            function<uint8_t(uint16_t)> read;
+            function<void(uint16_t, uint8_t)> write;
+        };
+        uint8_t attribute[MEMORY_PAGES];
+        vector<uint8_t> dirty; // a byte per backing page, so marking one is a single store
+        uint8_t* dirtyMark[MEMORY_PAGES]; // dirty byte of what a RAM page maps, ignored for the other kinds
+        uint8_t ignored;
+        bool mapDirty;
+        uint16_t device[MEMORY_PAGES]; // index into devices of a PAGE_MMIO page
+        vector<Device> devices;
+        vector<uint8_t> contents; // flat 64 KiB, empty until the first store and while sharing an image
+        shared_ptr<const Z80_Image> image;
+        unique_ptr<uint8_t[]> own[MEMORY_PAGES]; // private copies of shared pages
+        uint8_t openBus[MEMORY_PAGE_SIZE]; // read by unmapped pages
+        uint8_t discard[MEMORY_PAGE_SIZE]; // written by ROM and unmapped pages
+        vector<uint8_t> banks; // ROM banks, then RAM banks
+        unsigned romBanks;
+        uint8_t bank[BANK_WINDOWS]; // selected per window
+        bool paging;
+        uint8_t* backing(unsigned page); // writable contents of a page, nullptr past the last bank or still shared
+        unsigned backingPage(unsigned page); // index of its backing page in dirty, ~0u past the last bank
+        void touch(unsigned page); // its backing page changed, whatever kind it is
+        const uint8_t* shared(unsigned page); // its part of the image, zeros without one, nullptr when banked
+        uint8_t* privatize(unsigned page);
+        uint8_t bankKind(uint8_t number); // PAGE_ROM, PAGE_RAM or PAGE_UNMAPPED
+        void mapPage(unsigned page); // point it at its backing as its attribute says
+        void mapWindow(unsigned window);
+        void setPages(uint16_t address, unsigned length, uint8_t kind, unsigned index = 0);
+        uint8_t readDevice(uint16_t address);
+        void writeSlow(uint16_t address, uint8_t value); // device or first store into a shared page
+};
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef PACER_H
+#define PACER_H
+
+#include <cstdint>
+#include <time.h>
+
+#define CLOCK_UNTHROTTLED 0
+#define CLOCK_3_58MHZ 3579545
+#define CLOCK_7_37MHZ 7372800
+#define CLOCK_20MHZ 20000000
+
+#define PACER_QUANTUM_US 4000 // emulated time between two pacing checks
+#define PACER_MAX_LAG_US 100000 // host lag after which the timeline is rebased instead of caught up
+#define PACER_UNTHROTTLED_QUANTUM 65536 // T-states between sync() calls when unthrottled
+
+using namespace std;
+
+/*
+    Cycle-budgeted pacing governor.
+    The core counts T-states and only calls sync() once every quantum of emulated
+    time, the pacer then sleeps until the monotonic clock catches up with the
+    emulated clock. Deadlines are absolute so rounding errors don't accumulate.
+    When unthrottled sync() never sleeps, but is still called regularly so the
+    core can do its periodic housekeeping.
+*/
+class Z80_Pacer {
+    public:
+        Z80_Pacer();
+        void setClock(uint32_t hz); // target clock in Hz, CLOCK_UNTHROTTLED disables pacing
+        uint32_t getClock();
+        void start(uint64_t cycles); // (re)anchor the emulated timeline to the host clock
+        void sync(uint64_t cycles); // called when cycles >= nextSync
+
+        uint64_t nextSync; // cycle count at which sync() has to be called next
+
+    private:
+        uint32_t clock_hz;
+        uint64_t quantum; // T-states per quantum
+        uint64_t baseCycles; // cycle count at the anchor point
+        struct timespec baseTime; // host time at the anchor point
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <vector>
+
+#define EVENT_NEVER UINT64_MAX
+
+using namespace std;
+
+/*
+    Device event scheduler keyed on the emulated cycle count.
+    Devices register a callback once and schedule it for an absolute T-state,
+    the core only compares its cycle counter against next after every
+    instruction and calls run() when something is due. Events sit in a min-heap,
+    rescheduling or cancelling one leaves its old heap entry behind and the
+    generation count tells run() to skip it.
+*/
+class Z80_Scheduler {
+    public:
+        Z80_Scheduler();
+        unsigned add(function<void()> callback); // register an event, returns its id
+        void schedule(unsigned id, uint64_t cycle); // (re)schedule it at cycle, replaces the pending one
+        void cancel(unsigned id);
+        bool pending(unsigned id);
+        void reset(); // cancel everything, the events stay registered
+        void run(uint64_t cycles); // call everything due by cycles, in cycle order
+
+        uint64_t next; // cycle of the earliest event, EVENT_NEVER if none
+
+    private:
+        struct Event {
+            function<void()> callback;
+            uint32_t generation; // bumped on every schedule/cancel
+            bool scheduled;
+        };
+        struct Entry {
+            uint64_t cycle;
+            unsigned id;
+            uint32_t generation;
+            bool operator>(const Entry& other) const { return cycle > other.cycle; }
+        };
+        vector<Event> events;
+        priority_queue<Entry, vector<Entry>, greater<Entry>> heap;
+};
+
+#endif
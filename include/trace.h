@@ -0,0 +1,42 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdint>
+#include <vector>
+
+#define TRACE_SIZE 4096 // instructions kept, a power of two
+
+using namespace std;
+
+struct Z80_TraceEntry {
+    uint16_t pc;
+    uint8_t bytes[4]; // opcode and operands, as they were in memory when it ran
+    bool registers; // the registers below were recorded
+    uint16_t af, bc, de, hl, ix, iy, sp; // before the instruction
+};
+
+/*
+    Ring buffer of the last TRACE_SIZE instructions, for a post-mortem dump.
+    The core records into it only while tracing is on, nothing is allocated
+    before enable(), so an untraced run pays one predictable branch per
+    instruction and no memory.
+*/
+class Z80_Trace {
+    public:
+        Z80_Trace();
+        void enable(bool withRegisters = false); // registers: also keep AF..SP of every instruction
+        void disable(); // frees the ring
+        void reset(); // forget the recorded instructions
+        Z80_TraceEntry& record() { return entries[count++ & (TRACE_SIZE - 1)]; } // slot of the next one, overwrites the oldest
+        unsigned size(); // instructions in the ring
+        const Z80_TraceEntry& at(unsigned index); // 0 is the oldest one still in the ring
+
+        bool enabled;
+        bool registers;
+        uint64_t count; // recorded since reset
+
+    private:
+        vector<Z80_TraceEntry> entries;
+};
+
+#endif
@@ -12,16 +12,14 @@
 #include <fstream>
 #include <cstdint>
 #include <termios.h>
-
-#define MEMORY_SIZE 0xffff
-
-#define FLAG_C 0x01
-#define FLAG_N 0x02
-#define FLAG_P 0x04
-#define FLAG_H 0x20
-#define FLAG_Z 0x40
-#define FLAG_S 0x80
-
+#include "pacer.h"
+#include "scheduler.h"
+#include "trace.h"
+#include "memory.h"
+#include "console.h"
+#include "jit.h"
+#include "flags.h"
+#include "fusion.h"
 
 #define ALU_ADD8 0x00
 #define ALU_ADD16 0x01
@@ -70,8 +68,31 @@
 #define ALU_SET6 0x2B
 #define ALU_SET7 0x2C
 
-#define ALU_INC16 0x2D
-#define ALU_DEC16 0x2E
+#define LAZY_NONE 0 // f is up to date
+#define LAZY_ADD 1 // ADD, ADC
+#define LAZY_SUB 2 // SUB, SBC
+#define LAZY_CP 3 // CP, 5 and 3 come from the operand
+#define LAZY_AND 4
+#define LAZY_LOGIC 5 // OR, XOR
+#define LAZY_INC 6
+#define LAZY_DEC 7
+
+
+#define DISPATCH_SWITCH 0 // one switch over the unprefixed opcodes
+#define DISPATCH_TABLE 1 // 256-entry handler table per prefix
+#define DISPATCH_THREADED 2 // computed goto, falls back to DISPATCH_TABLE on non-GNU compilers
+#define DISPATCH_CACHED 3 // pre-decoded basic blocks
+#define DISPATCH_JIT 4 // hot blocks compiled to x86-64, DISPATCH_CACHED on other hosts
+
+#define BLOCK_MAX_OPS 32 // instructions per pre-decoded block
+#define BLOCK_PAGE_SHIFT 8 // blocks are listed per 256-byte page for invalidation
+#define BLOCK_PAGES (0x10000 >> BLOCK_PAGE_SHIFT)
+
+#define REPEAT_CHUNK 64 // LDIR, CPIR, INIR...: iterations per pass while an interrupt can come in
+
+#define POLL_STREAK 8 // empty device reads in a row from one IN before its loop is checked
+#define POLL_LOOP_MAX 8 // instructions in a busy-wait loop
+#define POLL_LOOP_BYTES 32 // distance of the branch back over the IN
 
 
 #define ACIA_RECIEVE 0x00
@@ -79,72 +100,251 @@
 #define ACIA_READ_STATUS 0x02
 #define ACIA_WRITE_CONTROL 0x03
 #define ACIA_READ_DATA 0x04
+#define ACIA_RX_CYCLES 640 // T-states per received character with RIE set, 115200 baud off the 7.3728 MHz clock
+#define IRQ_BUS_BYTE 0xFF // the ACIA doesn't drive the data bus in the acknowledge cycle, the pull-ups read 0xFF (RST 38H in IM 0)
+
+// 16-bit register pair with its high and low byte, laid out for the host byte order
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define REG_PAIR(pair, high, low) union { uint16_t pair; struct { uint8_t high, low; }; }
+#else
+#define REG_PAIR(pair, high, low) union { uint16_t pair; struct { uint8_t low, high; }; }
+#endif
 
 using namespace std;
 
+// Why run() or a slice returned
+enum Z80_Stop : uint8_t {
+    STOP_NONE, // still running
+    STOP_BUDGET, // ran the requested cycles or instructions
+    STOP_HALT, // HALT with interrupts disabled, only reset() gets the CPU going again
+    STOP_BREAKPOINT, // pc is at a breakpoint, the instruction there hasn't run yet
+    STOP_INVALID, // an opcode the core doesn't implement (pc is past it) or the watchdog
+    STOP_IO_WAIT, // waiting for input: HALT until an interrupt, or a busy-wait loop on an empty device
+};
 
 class Z80_Core {
     public:
-        bool DEBUG;
+        bool DEBUG = false;
         Z80_Core();
+        ~Z80_Core();
         void reset();
         void loadProgram(vector<uint8_t>& inputProgram);
-        void run();
+        bool loadBinary(const string& path, uint16_t address = 0, uint16_t entry = 0); // false if the file can't be mapped
+        bool loadBanks(const string& path, unsigned bank = 0); // needs memory.setBanking() first
+        uint16_t entryPoint = 0; // pc after reset()
+        void run(); // reset and run until the program ends, sleeps while it waits for input
+
+        // Sliced execution: each call picks up where the last one stopped and returns instead of waiting for input
+        Z80_Stop run_cycles(uint64_t budget); // at least budget T-states, stops at the first instruction boundary after them
+        Z80_Stop run_instructions(uint64_t count);
+        Z80_Stop step(); // one instruction
+        Z80_Stop stopReason; // of the last run
+        void setBreakpoint(uint16_t address);
+        void clearBreakpoint(uint16_t address);
         void view_program();
         void view_ram();
         void printInfo();
         void printCurrentState();
 
         void testAlu(uint8_t& reg, uint8_t reg2, uint8_t ins);
-        int nop_watchdog = 0; // prevent infinite loops
+        int nop_watchdog = 0; // NOPs in a row, prevents running off into empty memory
         bool disableWatchdog = false;
+        bool eagerFlags = false; // update F after every alu() op instead of on demand, for benchmarks and debugging
+        uint8_t dispatch = DISPATCH_CACHED; // instruction dispatch method used by run()
+        bool fuse = true; // merge the pairs listed in fusion.h when pre-decoding, the JIT compiles them anyway
+
+        // Pair profile of pre-decoded code, only collected while profilePairs is set
+        bool profilePairs = false;
+        uint64_t profileDispatches; // handlers called, a fused pair is one
+        uint64_t profileInstructions;
+        unordered_map<uint32_t, uint64_t> pairCounts; // executed back to back, first key << 16 | second key
+        void printPairProfile(ostream& out, unsigned top = 20);
+        void printFusionList(ostream& out, unsigned top = 32); // the profile's hottest fusable pairs, in fusion.h format
         void interruptHandler();
+        bool interruptible(); // an interrupt can still come in
         uint8_t ACIA_6850(uint8_t op, uint8_t operand);
         uint8_t ACIA_6850_Handler();
-        bool isPending;
+        uint8_t ACIA_6850_Latch(); // moves queued input to the receive register
+        bool isPending; // IRQ line asserted
+        void raiseInterrupt();
         uint8_t ACIA_status, ACIA_data, ACIA_control, ACIA_RDR;
+        uint64_t cycles; // emulated T-states since reset
+        uint64_t eiCycles; // cycles right after the last EI
+        Z80_Pacer pacer;
+        Z80_Scheduler scheduler; // device events by cycle count, checked after every instruction
+        Z80_Console console; // stdin filled by the input thread, buffered stdout
+        Z80_Memory memory; // 64 KiB address space, RAM everywhere unless mapped otherwise
+        Z80_Trace trace; // last instructions, recorded while enabled or in DEBUG, run() dumps it at the end
+        void dumpTrace(ostream& out); // oldest first
 
     private:
-        uint8_t ins;
-        uint8_t memory[MEMORY_SIZE] = {0};
-        bool halt, interrupts;
-        vector<string> rom;
-        unsigned pc; // program counter
-        unsigned sp; // stack pointer
-        uint8_t f; // flags
+        // Register file, everything the instruction handlers touch shares one cache line
+        alignas(64) uint16_t pc; // program counter, wraps like the real one
+        uint16_t sp; // stack pointer
+        REG_PAIR(af, a, f);
+        REG_PAIR(bc, b, c);
+        REG_PAIR(de, d, e);
+        REG_PAIR(hl, h, l);
+        REG_PAIR(ix, ixh, ixl); // index registers
+        REG_PAIR(iy, iyh, iyl);
+        uint16_t afa, bca, dea, hla; // alternate register set, EX AF, AF' and EXX swap whole pairs
         uint8_t w,z; // temp regs to hold operands
-        int acc; // accumulator
-        uint8_t a, b, c, d, e, h, l; // main registers, can be made to 16-bit register pairs
-        uint16_t afa, bca, dea, hla; // alternate register pairs
-        uint16_t ix, iy; // index registers
         uint8_t i, r; // interrupt and refresh register
         uint8_t im; // interrupt mode
         bool iff1, iff2;
 
+        // Lazy flags: alu() records its last 8-bit op here instead of updating f, which is
+        // stale while lazyFlags isn't LAZY_NONE. The pending op replaces every flag.
+        uint8_t lazyFlags; // LAZY_* of the pending op, LAZY_NONE when f is up to date
+        uint8_t lazyOp1, lazyOp2; // operands, for H and P/V
+        uint32_t lazyResult; // 8-bit result, C in bit 8 (kept from f for INC/DEC)
+        const uint8_t* operandCursor; // operands of the running pre-decoded instruction, nullptr fetches from memory
+
+        uint8_t ins;
+        bool halt, interrupts; // halt: leave the run loop after this instruction, see stopReason
+        void stop(Z80_Stop reason);
+        bool started; // pacer and console are running
+        bool sliced; // inside run_cycles()/run_instructions()
+        bool begin(); // common start of every run, false if the CPU can't run
+        void execute(); // run loop of the selected dispatcher
+        unsigned budgetEvent; // scheduler id, stops run_cycles()
+        unsigned breakpoints; // number set
+        uint8_t breakMap[0x10000 / 8]; // one bit per address
+        bool breakpointAt(unsigned address);
+        void invalidOpcode();
+        bool halted; // HALT with interrupts enabled, the CPU waits for one
+        void idle(); // sleep through HALT until an interrupt
+        uint64_t waitInput(); // block until input arrives, returns the T-states that passed
+
+        // Busy-wait detection: a loop spinning on an empty device is parked until input arrives
+        unsigned pollPc; // IN of the last empty device read
+        uint64_t pollCycles; // cycles at that read
+        uint64_t pollPeriod; // T-states between the last two
+        unsigned pollStreak; // empty reads in a row from pollPc, pollPeriod apart
+        void pollWait(); // after an empty read
+        bool pollLoop(uint16_t in); // in is part of a loop that only reads and tests the device
+        unsigned pollStep(uint16_t address, int& target, bool& conditional);
+        vector<string> rom;
+        int acc; // accumulator
+
         bool isInput; 
 
         uint8_t inputBuf;
 
-        void alu(uint16_t& op1, uint16_t op2, uint8_t ins);
+        template<uint8_t OP> uint8_t alu8(uint8_t op1, uint8_t op2 = 0); // ALU_* kernels, instantiated per call site
+        template<uint8_t OP> uint16_t alu16(uint16_t op1, uint16_t op2);
+        void deferFlags(uint8_t kind, uint8_t op1, uint8_t op2, unsigned result);
+        void materializeFlags(); // bring f up to date, before anything reads or modifies it as a whole
+        bool flagZ(); // single flags straight from a pending op
+        bool flagC();
+        bool flagS();
+        bool flagP();
 
         uint8_t fetchOperand();
         void fetchInstruction();
         uint8_t inputHandler(uint8_t port);
         uint8_t outputHandler(uint8_t &reg, uint8_t port);
-        void swapRegs(uint8_t& temp1, uint8_t& temp2);
-        uint16_t convToRegPair(uint8_t l, uint8_t h); //used for 16-bit operations
-        void incRegPair(uint8_t& l, uint8_t& h);
-        void decRegPair(uint8_t& l, uint8_t& h);
         void decode_execute(uint8_t instruction); // main instructions
         void push(uint16_t reg);
-        void push_reg_pair(uint8_t l, uint8_t h);
         uint16_t pop();
-        void pop_reg_pair(uint8_t& l, uint8_t& h);
 
         void ed_instruction(uint8_t ins); // extended instructions
         void cb_instruction(uint8_t ins); // bit instructions
-        void dd_instruction(uint8_t ins); // ix prefix instructions
-        void fd_instruction(uint8_t ins); // iy prefix instructions
+        uint8_t cb_operate(uint8_t ins, uint8_t value); // CB operation of ins on value
+        static uint8_t Z80_Core::* const registers8[8]; // B, C, D, E, H, L, -, A by opcode bits
+        template<bool IY> void index_instruction(uint8_t ins); // ix/iy prefix instructions
+
+        // Block instructions, ED A0-BB
+        unsigned repeatBudget();
+        template<uint8_t OP> void repeatBlock(unsigned iterations, bool repeat);
+        template<uint8_t OP> void blockTransfer();
+        template<uint8_t OP> void blockCompare();
+        template<uint8_t OP> void blockInput();
+        template<uint8_t OP> void blockOutput();
+        void blockIOFlags(uint8_t value, unsigned sum);
+
+        // Instruction handlers, one specialization per opcode
+        typedef void (Z80_Core::*Handler)();
+        template<uint8_t OP> void base_op();
+        template<uint8_t OP> void ed_op();
+        template<uint8_t OP, bool IY> void index_op(); // DD (IX) and FD (IY) share one implementation
+        template<bool IY> void index_cb();
+        static const Handler baseTable[256];
+        static const Handler edTable[256];
+        static const Handler ddTable[256];
+        static const Handler fdTable[256];
+
+        void startInstruction(uint8_t instruction, unsigned address); // timing and trace of an unprefixed opcode
+        bool tracing; // trace enabled or DEBUG, as of the last begin()
+        void traceInstruction(uint8_t instruction, unsigned address);
+        unsigned nopEnd; // address after the last NOP, for the watchdog
+        void pollDevices(); // runs the device events that are due, between instructions
+        unsigned pacerEvent, aciaEvent, irqEvent; // scheduler ids
+        void pacerTick();
+        void aciaTick();
+        void decode_switch(uint8_t instruction); // decode_execute() through a switch (DISPATCH_SWITCH)
+        void run_threaded(); // run loop for DISPATCH_THREADED
+
+        // Pre-decoded basic blocks (DISPATCH_CACHED)
+        struct Z80_Decoded {
+            Handler handler; // final handler, the prefix is already resolved
+            unsigned next; // address of the following instruction, 0 past the top of memory
+            uint8_t opcode; // first opcode byte, for the timing and trace
+            uint8_t info; // decodeMain/decodeED flags
+            uint8_t cycles; // prefixed table timing, the unprefixed part comes from cyclesMain
+            uint8_t operands[3]; // immediates and displacements in fetch order
+            uint16_t key; // prefix << 8 | opcode, see fusion.h
+            uint16_t fusedKey; // second instruction of a fused pair, FUSE_NONE if there's none
+        };
+        struct Z80_Block {
+            unsigned start, end; // covers the bytes [start, end)
+            vector<Z80_Decoded> ops;
+            unsigned hits; // interpreted runs, see JIT_THRESHOLD
+            uint8_t* native; // compiled code, nullptr until the JIT picks it up
+            vector<uint8_t*> links; // direct jumps of compiled code chained into this block
+        };
+        unique_ptr<Z80_Block*[]> blockMap[BLOCK_PAGES]; // block starting at each address, a page's table is allocated with its first block
+        Z80_Block* blockAt(unsigned address) { // nullptr if none starts there
+            Z80_Block** page = blockMap[address >> BLOCK_PAGE_SHIFT].get();
+            return page ? page[address & ((1 << BLOCK_PAGE_SHIFT) - 1)] : nullptr;
+        }
+        vector<Z80_Block*> pageBlocks[BLOCK_PAGES]; // blocks overlapping each page
+        vector<Z80_Block*> retiredBlocks; // invalidated, maybe still running, freed at the next lookup
+        uint8_t codeMap[0x10000 / 8]; // one bit per byte decoded into a block
+        bool codeModified; // a store hit a cached block
+
+        void writeMemory(uint16_t address, uint8_t value); // every store goes through here
+        void invalidateRange(uint16_t address, unsigned length); // drop the blocks a bulk store hit
+        Z80_Block* findBlock(unsigned address);
+        Z80_Block* decodeBlock(unsigned address);
+        void markCode(Z80_Block* block);
+        void invalidateCode(uint16_t address);
+        void flushBlocks();
+        void run_block(Z80_Block* block); // interpret a block until it's left
+        void profileOp(const Z80_Decoded& op, bool second, uint32_t& previous);
+
+        // Superinstructions, see fusion.h
+        struct Z80_Fusion {
+            uint16_t first, second;
+            Handler handler;
+        };
+        static const Z80_Fusion fusions[];
+        uint64_t fusedRuns; // pairs that ran both instructions
+        bool fusePair(Z80_Decoded& first, const Z80_Decoded& second); // merge second into first if it's listed
+        template<uint16_t KEY> void fusedStep(); // one instruction of a pair, without its timing
+        template<uint16_t FIRST, uint16_t SECOND> void fused_op();
+        void run_cached(); // run loop for DISPATCH_CACHED
+
+        // x86-64 recompiler (DISPATCH_JIT), translation in src/jit.cpp
+        Z80_Jit jit;
+        void jitCompile(Z80_Block* block);
+        void jitLink(uint8_t* site, Z80_Block* target); // chain a direct jump to compiled code
+        void jitUnlink(Z80_Block* block); // route the jumps into a dropped block back out
+        void jitFlush();
+        static void jitStart(Z80_Core* core, uint8_t opcode); // called by compiled code
+        static void jitPoll(Z80_Core* core);
+        static uint8_t jitRead(Z80_Core* core, uint16_t address); // a device page
+        void run_jit(); // run loop for DISPATCH_JIT
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,225 @@
+#include "../include/console.h"
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+
+// Terminal settings to put back when a signal ends the process while it's in raw mode
+static struct termios savedTerminal;
+static volatile sig_atomic_t terminalSaved = 0;
+static const int restoreSignals[] = {SIGINT, SIGTERM, SIGQUIT, SIGHUP};
+static struct sigaction previousActions[sizeof(restoreSignals) / sizeof(restoreSignals[0])];
+
+static void restoreTerminal(int signal) {
+    if (terminalSaved) tcsetattr(STDIN_FILENO, TCSANOW, &savedTerminal);
+    for (size_t n = 0; n < sizeof(restoreSignals) / sizeof(restoreSignals[0]); n++) {
+        if (restoreSignals[n] == signal) sigaction(signal, &previousActions[n], nullptr);
+    }
+    raise(signal); // delivered once this returns, as if we had never been in the way
+}
+
+Z80_Console::Z80_Console() {
+    head = 0;
+    tail = 0;
+    stopPipe[0] = stopPipe[1] = -1;
+    wakePipe[0] = wakePipe[1] = -1;
+    inputClosed = false;
+    running = false;
+    rawMode = false;
+    outLength = 0;
+    unbuffered = false;
+    setFlushInterval(CONSOLE_FLUSH_INTERVAL_US);
+}
+
+Z80_Console::~Z80_Console() {
+    stop();
+}
+
+void Z80_Console::start() {
+    if (running) return;
+
+    if (isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &oldt) == 0) {
+        struct termios newt = oldt;
+        newt.c_lflag &= ~(ICANON | ECHO); // Disable canonical mode and echo
+        newt.c_cc[VMIN] = 1;
+        newt.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &newt);
+        rawMode = true;
+
+        savedTerminal = oldt;
+        terminalSaved = 1;
+        struct sigaction action = {};
+        action.sa_handler = restoreTerminal;
+        sigemptyset(&action.sa_mask);
+        for (size_t n = 0; n < sizeof(restoreSignals) / sizeof(restoreSignals[0]); n++) {
+            sigaction(restoreSignals[n], &action, &previousActions[n]);
+        }
+    }
+
+    if (pipe(stopPipe) != 0) {
+        stopPipe[0] = stopPipe[1] = -1;
+    }
+    if (pipe(wakePipe) == 0) {
+        for (int fd : wakePipe) fcntl(fd, F_SETFL, O_NONBLOCK); // a full pipe already says there's input
+    } else {
+        wakePipe[0] = wakePipe[1] = -1;
+    }
+    inputClosed = false;
+    running = true;
+    reader = thread(&Z80_Console::readerLoop, this);
+}
+
+void Z80_Console::stop() {
+    flush();
+    if (!running) return;
+    running = false;
+
+    if (stopPipe[1] >= 0) {
+        char wake = 0;
+        (void)!::write(stopPipe[1], &wake, 1);
+    }
+    if (reader.joinable()) {
+        if (stopPipe[1] >= 0) reader.join();
+        else reader.detach(); // can't wake it up, it's blocked in read()
+    }
+    if (stopPipe[1] >= 0) { // joined, a detached reader could still signal and keeps its pipe
+        if (wakePipe[0] >= 0) close(wakePipe[0]);
+        if (wakePipe[1] >= 0) close(wakePipe[1]);
+    }
+    wakePipe[0] = wakePipe[1] = -1;
+    if (stopPipe[0] >= 0) close(stopPipe[0]);
+    if (stopPipe[1] >= 0) close(stopPipe[1]);
+    stopPipe[0] = stopPipe[1] = -1;
+
+    if (rawMode) {
+        for (size_t n = 0; n < sizeof(restoreSignals) / sizeof(restoreSignals[0]); n++) {
+            sigaction(restoreSignals[n], &previousActions[n], nullptr);
+        }
+        terminalSaved = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
+        rawMode = false;
+    }
+}
+
+bool Z80_Console::available() {
+    return head.load(memory_order_acquire) != tail.load(memory_order_relaxed);
+}
+
+bool Z80_Console::read(uint8_t& ch) {
+    uint32_t t = tail.load(memory_order_relaxed);
+    if (head.load(memory_order_acquire) == t) {
+        if (outLength) flush(); // the program waits for input, show it what it printed
+        return false;
+    }
+    ch = buffer[t & (CONSOLE_BUFFER_SIZE - 1)];
+    tail.store(t + 1, memory_order_release);
+    return true;
+}
+
+bool Z80_Console::wait(int timeoutMs) {
+    flush(); // whatever the program printed before it went idle
+    if (available()) return true;
+    if (inputClosed.load(memory_order_acquire) || wakePipe[0] < 0) return false;
+
+    struct pollfd fds;
+    fds.fd = wakePipe[0];
+    fds.events = POLLIN;
+    if (poll(&fds, 1, timeoutMs) > 0) {
+        char drain[64];
+        while (::read(wakePipe[0], drain, sizeof(drain)) > 0) {
+            // the wakeups are only a signal, the data is in the ring
+        }
+    }
+    return available();
+}
+
+bool Z80_Console::closed() {
+    return (!running || inputClosed.load(memory_order_acquire)) && !available();
+}
+
+void Z80_Console::write(uint8_t ch) {
+    if (outLength == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &outSince);
+    }
+    outBuffer[outLength++] = ch;
+    if (unbuffered || ch == '\n' || outLength == CONSOLE_OUTPUT_SIZE) {
+        flush();
+    }
+}
+
+void Z80_Console::flush() {
+    if (outLength == 0) return;
+    fflush(stdout); // keep the order with anything printed through stdio/cout
+
+    uint32_t written = 0;
+    while (written < outLength) {
+        ssize_t n = ::write(STDOUT_FILENO, outBuffer + written, outLength - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break; // stdout is gone, drop the output
+        }
+        written += n;
+    }
+    outLength = 0;
+}
+
+void Z80_Console::flushIfDue() {
+    if (outLength == 0) return;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t age = (int64_t)(now.tv_sec - outSince.tv_sec) * 1000000000LL + (now.tv_nsec - outSince.tv_nsec);
+    if (age >= flushInterval) flush();
+}
+
+void Z80_Console::setUnbuffered(bool enable) {
+    unbuffered = enable;
+    if (unbuffered) flush();
+}
+
+void Z80_Console::setFlushInterval(uint32_t us) {
+    flushInterval = (int64_t)us * 1000;
+}
+
+void Z80_Console::readerLoop() {
+    uint8_t chunk[256];
+    struct pollfd fds[2] = {};
+    fds[0].fd = STDIN_FILENO;
+    fds[0].events = POLLIN;
+    fds[1].fd = stopPipe[0]; // -1 if the pipe couldn't be opened, poll() skips it and leaves revents 0
+    fds[1].events = POLLIN;
+
+    while (true) {
+        uint32_t h = head.load(memory_order_relaxed);
+        uint32_t space = CONSOLE_BUFFER_SIZE - (h - tail.load(memory_order_acquire));
+
+        // Queue full: leave the input in the kernel buffer until the emulator catches up
+        fds[0].events = (space > 0) ? POLLIN : 0;
+        if (poll(fds, 2, space > 0 ? -1 : 1) < 0) {
+            if (errno == EINTR) continue;
+            break; // won't get better, treat it as the end of input
+        }
+        if (fds[1].revents) break; // stop() requested
+        if (fds[0].revents & (POLLERR | POLLNVAL)) break;
+        if (!(fds[0].revents & (POLLIN | POLLHUP))) continue;
+
+        ssize_t bytesRead = ::read(STDIN_FILENO, chunk, space < sizeof(chunk) ? space : sizeof(chunk));
+        if (bytesRead < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) continue; // interrupted, or non-blocking stdin, poll again
+        if (bytesRead <= 0) break; // EOF or error, no more input
+
+        for (ssize_t i = 0; i < bytesRead; i++) {
+            buffer[(h + i) & (CONSOLE_BUFFER_SIZE - 1)] = chunk[i];
+        }
+        head.store(h + bytesRead, memory_order_release);
+        wake();
+    }
+    inputClosed.store(true, memory_order_release);
+    wake();
+}
+
+void Z80_Console::wake() {
+    if (wakePipe[1] < 0) return;
+    char signal = 0;
+    (void)!::write(wakePipe[1], &signal, 1);
+}
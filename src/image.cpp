@@ -0,0 +1,43 @@
+#include "../include/image.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+
+Z80_Image::Z80_Image() {
+    data = nullptr;
+    size = 0;
+    mapped = nullptr;
+}
+
+Z80_Image::~Z80_Image() {
+    if (mapped) munmap(mapped, size);
+}
+
+shared_ptr<Z80_Image> Z80_Image::map(const string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+    struct stat info;
+    void* file = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        file = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd); // the mapping keeps the file, the rest of its last host page reads as zeros
+    if (file == MAP_FAILED) return nullptr;
+
+    shared_ptr<Z80_Image> image(new Z80_Image());
+    image->mapped = file;
+    image->data = (const uint8_t*)file;
+    image->size = info.st_size;
+    return image;
+}
+
+shared_ptr<Z80_Image> Z80_Image::copy(const uint8_t* bytes, size_t length) {
+    shared_ptr<Z80_Image> image(new Z80_Image());
+    image->storage.assign((length + IMAGE_ALIGN - 1) / IMAGE_ALIGN * IMAGE_ALIGN, 0);
+    std::copy(bytes, bytes + length, image->storage.begin());
+    image->data = image->storage.data();
+    image->size = length;
+    return image;
+}
@@ -0,0 +1,386 @@
+#include "../include/z80e.h"
+#include "../include/cycles.h"
+#include "../include/decode.h"
+#include <cstring>
+#include <sys/mman.h>
+
+/*
+    x86-64 dynamic recompiler.
+    A block that ran JIT_THRESHOLD times through the interpreter is compiled
+    from its pre-decoded instructions. Loads and direct branches are emitted
+    inline, every other instruction calls its handler with the operand cursor
+    set up like DISPATCH_CACHED does, so both modes share the same semantics.
+    The pacing/device check after each instruction is inlined, the call to
+    pollDevices() only happens when something is actually due.
+
+    Direct jumps (JR, JP, DJNZ, CALL, RST and falling out of a block) first
+    leave through a stub that asks the run loop to chain them, once the target
+    is compiled the jump goes straight into its code. Blocks end at I/O, IN
+    and OUT always run in the interpreter. Stores into decoded code are caught
+    by the codeMap write check, the dropped block's incoming chains are
+    pointed back at their stubs and the running code leaves after the store.
+*/
+
+Z80_Jit::Z80_Jit() {
+    cache = nullptr;
+    used = 0;
+    trampolines = 0;
+    failed = false;
+    leaveCode = nullptr;
+    linkSite = nullptr;
+}
+
+Z80_Jit::~Z80_Jit() {
+    if (cache) munmap(cache, JIT_CACHE_SIZE);
+}
+
+bool Z80_Jit::start() {
+#if defined(__x86_64__) && defined(__unix__)
+    if (cache) return true;
+    if (failed) return false;
+
+    void* mapped = mmap(nullptr, JIT_CACHE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) { // W^X policy or out of memory, stay interpreted
+        failed = true;
+        return false;
+    }
+    cache = (uint8_t*)mapped;
+
+    static const uint8_t code[] = {
+        0x53,             // enter: push rbx
+        0x48, 0x89, 0xFB, //        mov rbx, rdi (core)
+        0xFF, 0xE6,       //        jmp rsi (block)
+        0x5B,             // leave: pop rbx
+        0xC3,             //        ret
+    };
+    memcpy(cache, code, sizeof(code));
+    leaveCode = cache + 6;
+    trampolines = sizeof(code);
+    used = trampolines;
+    return true;
+#else
+    return false;
+#endif
+}
+
+uint8_t* Z80_Jit::reserve() {
+    if (!cache || used + JIT_BLOCK_MAX > JIT_CACHE_SIZE) return nullptr;
+    return cache + used;
+}
+
+void Z80_Jit::commit(uint8_t* end) {
+    used = end - cache;
+    used = (used + 15) & ~(size_t)15; // keep block entries aligned
+}
+
+void Z80_Jit::reset() {
+    used = trampolines;
+    linkSite = nullptr;
+}
+
+void Z80_Jit::enter(void* core, const uint8_t* code) {
+    ((void (*)(void*, const uint8_t*))cache)(core, code);
+}
+
+#if defined(__x86_64__) && defined(__unix__)
+
+namespace {
+
+// Condition codes for jcc
+#define X86_JB 0x2
+#define X86_JZ 0x4
+#define X86_JNZ 0x5
+
+// x86-64 encoder, every memory operand is [rbx + disp32]
+struct Emitter {
+    uint8_t* p;
+
+    void u8(uint8_t v) { *p++ = v; }
+    void u32(uint32_t v) { memcpy(p, &v, 4); p += 4; }
+    void u64(uint64_t v) { memcpy(p, &v, 8); p += 8; }
+    void mem(uint8_t reg, int32_t disp) { u8(0x83 | (reg << 3)); u32(disp); } // ModRM mod=10 rm=rbx
+
+    void storeImm16(int32_t disp, uint16_t v) { u8(0x66); u8(0xC7); mem(0, disp); u8(v); u8(v >> 8); } // mov word [m], imm16
+    void storeImm8(int32_t disp, uint8_t v) { u8(0xC6); mem(0, disp); u8(v); } // mov byte [m], imm8
+    void storeZero64(int32_t disp) { u8(0x48); u8(0xC7); mem(0, disp); u32(0); } // mov qword [m], 0
+    void addImm64(int32_t disp, uint32_t v) { u8(0x48); u8(0x81); mem(0, disp); u32(v); } // add qword [m], imm32
+    void loadByte(uint8_t reg, int32_t disp) { u8(0x0F); u8(0xB6); mem(reg, disp); } // movzx r32, byte [m]
+    void loadWord(uint8_t reg, int32_t disp) { u8(0x0F); u8(0xB7); mem(reg, disp); } // movzx r32, word [m]
+    void storeAl(int32_t disp) { u8(0x88); mem(0, disp); } // mov byte [m], al
+    void testImm8(int32_t disp, uint8_t v) { u8(0xF6); mem(0, disp); u8(v); } // test byte [m], imm8
+    void cmpImm8(int32_t disp, uint8_t v) { u8(0x80); mem(7, disp); u8(v); } // cmp byte [m], imm8
+    void cmpImm16(int32_t disp, uint16_t v) { u8(0x66); u8(0x81); mem(7, disp); u8(v); u8(v >> 8); } // cmp word [m], imm16
+    void testImm32(int32_t disp, uint32_t v) { u8(0xF7); mem(0, disp); u32(v); } // test dword [m], imm32
+    void decByte(int32_t disp) { u8(0xFE); mem(1, disp); } // dec byte [m]
+    void loadRax(int32_t disp) { u8(0x48); u8(0x8B); mem(0, disp); } // mov rax, [m]
+    void cmpRax(int32_t disp) { u8(0x48); u8(0x3B); mem(0, disp); } // cmp rax, [m]
+    void storeRax(int32_t disp) { u8(0x48); u8(0x89); mem(0, disp); } // mov [m], rax
+    void movRax(uint64_t v) { u8(0x48); u8(0xB8); u64(v); } // mov rax, imm64
+
+    // Memory through the page tables: rcx = table entry of the address in eax, then movzx eax, byte [rcx + rax]
+    void loadPage(int32_t disp) { u8(0x89); u8(0xC1); u8(0xC1); u8(0xE9); u8(MEMORY_PAGE_SHIFT); u8(0x48); u8(0x8B); u8(0x8C); u8(0xCB); u32(disp); }
+    void testRcx() { u8(0x48); u8(0x85); u8(0xC9); } // test rcx, rcx
+    void andEax(uint32_t v) { u8(0x25); u32(v); } // and eax, imm32
+    void loadBytePaged() { u8(0x0F); u8(0xB6); u8(0x04); u8(0x01); }
+    void movEsiEax() { u8(0x89); u8(0xC6); } // mov esi, eax
+
+    void call(const void* fn) { // mov rdi, rbx; mov rax, fn; call rax
+        u8(0x48); u8(0x89); u8(0xDF);
+        movRax((uint64_t)fn);
+        u8(0xFF); u8(0xD0);
+    }
+
+    // Jumps return the address of their rel32 so they can be patched
+    uint8_t* jcc(uint8_t cc, const uint8_t* target) {
+        u8(0x0F); u8(0x80 | cc);
+        uint8_t* site = p;
+        u32(target ? (uint32_t)(target - (site + 4)) : 0);
+        return site;
+    }
+    uint8_t* jmp(const uint8_t* target) {
+        u8(0xE9);
+        uint8_t* site = p;
+        u32(target ? (uint32_t)(target - (site + 4)) : 0);
+        return site;
+    }
+};
+
+void patch(uint8_t* site, const uint8_t* target) {
+    uint32_t rel = (uint32_t)(target - (site + 4));
+    memcpy(site, &rel, 4);
+}
+
+}
+
+void Z80_Core::jitCompile(Z80_Block* block) {
+    if (block->ops[0].info & DECODE_IO) return; // nothing to compile before the interpreter takes over
+
+    uint8_t* code = jit.reserve();
+    if (code == nullptr) {
+        jitFlush();
+        code = jit.reserve();
+        if (code == nullptr) return;
+    }
+
+    // Everything compiled code touches is addressed relative to the core
+    #define OFFSET(member) (int32_t)((uint8_t*)&(member) - (uint8_t*)this)
+    const int32_t offPc = OFFSET(pc);
+    const int32_t offCycles = OFFSET(cycles);
+    const int32_t offNextEvent = OFFSET(scheduler.next);
+    const int32_t offF = OFFSET(f);
+    const int32_t offLazy = OFFSET(lazyFlags);
+    const int32_t offResult = OFFSET(lazyResult);
+    const int32_t offB = OFFSET(b);
+    const int32_t offHL = OFFSET(hl);
+    const int32_t offReadPage = OFFSET(memory.readPage);
+    const int32_t offCursor = OFFSET(operandCursor);
+    const int32_t offModified = OFFSET(codeModified);
+    const int32_t offHalt = OFFSET(halt);
+    const int32_t offLink = OFFSET(jit.linkSite);
+    const int32_t reg[8] = { OFFSET(b), OFFSET(c), OFFSET(d), OFFSET(e), OFFSET(h), OFFSET(l), -1, OFFSET(a) };
+    #undef OFFSET
+
+    const bool trace = tracing; // every instruction goes through startInstruction()
+    uint8_t* leave = jit.leaveCode;
+    Emitter emit = { code };
+    vector<pair<uint8_t*, unsigned>> chains; // direct jumps and their targets, linked below
+
+    // pollDevices() only when a device event is due
+    auto poll = [&](int64_t expected) {
+        emit.loadRax(offCycles);
+        emit.cmpRax(offNextEvent);
+        uint8_t* skip = emit.jcc(X86_JB, nullptr);
+        emit.call((const void*)&Z80_Core::jitPoll);
+        emit.cmpImm8(offHalt, 0); // an event stopped the run
+        emit.jcc(X86_JNZ, leave);
+        if (expected >= 0) { // an interrupt moved pc
+            emit.cmpImm16(offPc, (uint16_t)expected);
+            emit.jcc(X86_JNZ, leave);
+        }
+        patch(skip, emit.p);
+    };
+
+    // pc already holds the target: jump straight there once it's compiled, until then leave through the stub
+    auto chain = [&](unsigned target) {
+        uint8_t* site = emit.jmp(nullptr); // rel32 0 falls into the stub
+        emit.movRax((uint64_t)site);
+        emit.storeRax(offLink);
+        emit.jmp(leave);
+        chains.push_back(make_pair(site, target));
+    };
+
+    bool open = true; // the last instruction falls through
+    for (const Z80_Decoded& op : block->ops) {
+        if (op.info & DECODE_IO) { // pc already points to it
+            emit.jmp(leave);
+            open = false;
+            break;
+        }
+
+        if (trace) {
+            emit.u8(0xBE); emit.u32(op.opcode); // mov esi, opcode
+            emit.call((const void*)&Z80_Core::jitStart);
+            if (op.cycles) emit.addImm64(offCycles, op.cycles);
+        } else {
+            emit.addImm64(offCycles, cyclesMain[op.opcode] + op.cycles);
+        }
+        emit.storeImm16(offPc, op.next);
+
+        // Prefixed forms and fused pairs are never inlined
+        uint8_t opcode = ((op.info & DECODE_PREFIX) || op.fusedKey != FUSE_NONE) ? 0xCB : op.opcode;
+        uint8_t dst = (opcode >> 3) & 7, src = opcode & 7;
+        unsigned target = (op.next + (int8_t)op.operands[0]) & 0xFFFF; // relative jumps wrap like pc
+        unsigned absolute = op.operands[0] | (op.operands[1] << 8);
+
+        if (opcode >= 0x40 && opcode < 0x80 && opcode != 0x76 && dst != 6) { // LD r, r' / LD r, (HL)
+            if (src == 6) {
+                emit.loadWord(0, offHL);
+                emit.loadPage(offReadPage);
+                emit.testRcx();
+                uint8_t* device = emit.jcc(X86_JZ, nullptr);
+                emit.andEax(MEMORY_PAGE_MASK);
+                emit.loadBytePaged();
+                uint8_t* loaded = emit.jmp(nullptr);
+                patch(device, emit.p);
+                emit.movEsiEax();
+                emit.call((const void*)&Z80_Core::jitRead);
+                patch(loaded, emit.p);
+            } else {
+                emit.loadByte(0, reg[src]);
+            }
+            emit.storeAl(reg[dst]);
+            poll(op.next);
+        } else if (opcode < 0x40 && src == 6 && dst != 6) { // LD r, n
+            emit.storeImm8(reg[dst], op.operands[0]);
+            poll(op.next);
+        } else if (opcode == 0x00 && disableWatchdog) { // NOP, only the watchdog looks at it
+            poll(op.next);
+        } else if (opcode == 0x18 || opcode == 0xC3) { // JR e / JP nn
+            unsigned to = (opcode == 0x18) ? target : absolute;
+            emit.storeImm16(offPc, to);
+            poll(to);
+            chain(to);
+            open = false;
+            break;
+        } else if (opcode == 0x10 || (opcode & 0xE7) == 0x20 || opcode == 0xC2 || opcode == 0xCA || opcode == 0xD2 || opcode == 0xDA) {
+            // DJNZ e, JR cc, e, JP cc, nn (NZ, Z, NC, C)
+            bool relative = opcode < 0x40;
+            uint8_t* notTaken;
+            uint8_t* notTakenF = nullptr;
+            if (opcode == 0x10) {
+                emit.decByte(offB);
+                notTaken = emit.jcc(X86_JZ, nullptr);
+            } else {
+                // Same as flagZ()/flagC(): a pending alu() result decides, f otherwise
+                uint8_t cc = (opcode >> 3) & 3; // 0 NZ, 1 Z, 2 NC, 3 C
+                emit.cmpImm8(offLazy, LAZY_NONE);
+                uint8_t* settled = emit.jcc(X86_JZ, nullptr);
+                if (cc & 2) {
+                    emit.testImm32(offResult, 0x100);
+                    notTaken = emit.jcc((cc & 1) ? X86_JZ : X86_JNZ, nullptr);
+                } else {
+                    emit.testImm32(offResult, 0xFF);
+                    notTaken = emit.jcc((cc & 1) ? X86_JNZ : X86_JZ, nullptr);
+                }
+                uint8_t* taken = emit.jmp(nullptr);
+                patch(settled, emit.p);
+                emit.testImm8(offF, (cc & 2) ? FLAG_C : FLAG_Z);
+                notTakenF = emit.jcc((cc & 1) ? X86_JZ : X86_JNZ, nullptr);
+                patch(taken, emit.p);
+            }
+            unsigned to = relative ? target : absolute;
+            if (relative) emit.addImm64(offCycles, opcode == 0x10 ? CYCLES_DJNZ_TAKEN : CYCLES_JR_TAKEN);
+            emit.storeImm16(offPc, to);
+            poll(to);
+            chain(to);
+            patch(notTaken, emit.p);
+            if (notTakenF) patch(notTakenF, emit.p);
+            poll(op.next);
+        } else { // everything else runs its handler
+            union { Handler handler; struct { uintptr_t ptr; ptrdiff_t adjust; } raw; } fn;
+            static_assert(sizeof(fn.handler) == sizeof(fn.raw), "Itanium C++ ABI member function pointer expected");
+            fn.handler = op.handler;
+            if ((fn.raw.ptr & 1) || fn.raw.adjust != 0) { // virtual or adjusted this, can't call it directly
+                return;
+            }
+            bool operands = op.info & DECODE_OPERANDS;
+            if (operands) {
+                emit.movRax((uint64_t)op.operands);
+                emit.storeRax(offCursor);
+            }
+            emit.call((const void*)fn.raw.ptr);
+            if (operands) emit.storeZero64(offCursor);
+            poll(-1);
+            emit.cmpImm8(offHalt, 0); // the handler stopped the run, invalid opcode or the watchdog
+            emit.jcc(X86_JNZ, leave);
+            emit.cmpImm8(offModified, 0); // stored into decoded code, maybe this block
+            emit.jcc(X86_JNZ, leave);
+
+            if (opcode == 0xCD || (opcode & 0xC7) == 0xC7) { // CALL nn / RST n, pc is known unless interrupted
+                unsigned to = (opcode == 0xCD) ? absolute : (opcode & 0x38);
+                emit.cmpImm16(offPc, to);
+                emit.jcc(X86_JNZ, leave);
+                chain(to);
+                open = false;
+                break;
+            }
+            if (op.info & DECODE_JUMP) { // RET, JP (HL), HALT...
+                emit.jmp(leave);
+                open = false;
+                break;
+            }
+            emit.cmpImm16(offPc, op.next); // conditional CALL/RET taken, or an interrupt
+            emit.jcc(X86_JNZ, leave);
+        }
+    }
+    if (open) chain(block->ops.back().next); // fell out of the block
+
+    jit.commit(emit.p);
+    block->native = code;
+
+    // Chain the jumps whose targets are already compiled, this block included
+    for (const pair<uint8_t*, unsigned>& link : chains) {
+        Z80_Block* target = blockAt(link.second);
+        if (target && target->native) jitLink(link.first, target);
+    }
+}
+
+void Z80_Core::jitLink(uint8_t* site, Z80_Block* target) {
+    patch(site, target->native);
+    target->links.push_back(site);
+}
+
+void Z80_Core::jitUnlink(Z80_Block* block) {
+    for (uint8_t* site : block->links) {
+        patch(site, site + 4); // back to the stub right behind the jump
+    }
+    block->links.resize(0);
+}
+
+#else
+
+void Z80_Core::jitCompile(Z80_Block* block) {
+    (void)block;
+}
+
+void Z80_Core::jitLink(uint8_t* site, Z80_Block* target) {
+    (void)site;
+    (void)target;
+}
+
+void Z80_Core::jitUnlink(Z80_Block* block) {
+    block->links.resize(0);
+}
+
+#endif
+
+void Z80_Core::jitFlush() {
+    jit.reset();
+    for (unsigned page = 0; page < BLOCK_PAGES; page++) {
+        for (Z80_Block* block : pageBlocks[page]) { // a block spanning pages is reset more than once
+            block->native = nullptr;
+            block->hits = 0;
+            block->links.resize(0);
+        }
+    }
+}
@@ -1,5 +1,6 @@
 #include "../include/z80e.h"
 #include "../include/loadHex.h"
+#include <cerrno>
 #include <csignal>
 #include <cstdlib>
 #include <execinfo.h>
@@ -9,6 +10,7 @@ void handleSignal(int signal) {
 
     cout << "Current CPU state:" << endl;
     z80.printCurrentState();
+    if (z80.trace.enabled) z80.dumpTrace(cout);
 
     z80.view_program();
 
@@ -16,17 +18,41 @@ void handleSignal(int signal) {
     exit(signal);
 }
 
+// Value of the option at argv[i], exits if it's missing
+const char* argument(int argc, char *argv[], int i) {
+    if (i + 1 >= argc) {
+        cerr << argv[i] << " needs a value" << endl;
+        exit(1);
+    }
+    return argv[i + 1];
+}
+
+// 16-bit address option, decimal or 0x hex, exits if it's anything else
+uint16_t addressArgument(int argc, char *argv[], int i) {
+    const char* text = argument(argc, argv, i);
+    char* end;
+    errno = 0;
+    unsigned long value = strtoul(text, &end, 0);
+    if (text[0] == '-' || end == text || *end != '\0' || errno != 0 || value > 0xFFFF) {
+        cerr << argv[i] << ": " << text << " isn't an address from 0 to 0xFFFF" << endl;
+        exit(1);
+    }
+    return value;
+}
 
 int main(int argc, char *argv[]) {
     //cout << "Z80 emulator v1.0 (C) Benjamin Helle 2024" << endl;
     signal(SIGSEGV, handleSignal);
     string filename;
+    string binary;
+    unsigned loadAddress = 0;
+    int entry = -1;
     bool printMemory = false;
+    bool profile = false;
+    bool fusionList = false;
     for (int i = 0; i < argc; i++) {
         if ((string(argv[i])).find("-s") == 0) { // source program, load and run
-            filename = argv[i + 1];
-            vector<uint8_t> executable_program = loadHexToVector(filename);
-            z80.loadProgram(executable_program);
+            filename = argument(argc, argv, i);
         }
         if ((string(argv[i])).find("-d") == 0) { // debug mode
             z80.DEBUG = true;
@@ -43,8 +69,62 @@ int main(int argc, char *argv[]) {
         if ((string(argv[i])).find("-w") == 0) { // disable watchdog
             z80.disableWatchdog = true;
         }
+        if ((string(argv[i])).find("-c") == 0) { // target clock in MHz, 0 = unthrottled
+            z80.pacer.setClock((uint32_t)(stod(argument(argc, argv, i)) * 1000000));
+        }
+        if ((string(argv[i])).find("-u") == 0) { // unbuffered output, for interactive programs
+            z80.console.setUnbuffered(true);
+        }
+        if ((string(argv[i])).find("-o") == 0) { // output flush interval in ms
+            z80.console.setFlushInterval((uint32_t)(stod(argument(argc, argv, i)) * 1000));
+        }
+        if ((string(argv[i])).find("-j") == 0) { // compile hot code to x86-64
+            z80.dispatch = DISPATCH_JIT;
+        }
+        if ((string(argv[i])).find("-T") == 0) { // keep the last instructions with their registers, printed at the end or on a crash
+            z80.trace.enable(true);
+        }
+        if ((string(argv[i])).find("-l") == 0) { // raw binary image, load and run
+            binary = argument(argc, argv, i);
+        }
+        if ((string(argv[i])).find("-a") == 0) { // load address of the binary
+            loadAddress = addressArgument(argc, argv, i);
+        }
+        if ((string(argv[i])).find("-e") == 0) { // entry point, the load address by default
+            entry = addressArgument(argc, argv, i);
+        }
+        if ((string(argv[i])).find("-b") == 0) { // 512K ROM / 512K RAM banked memory, the program goes into ROM bank 0
+            z80.memory.setBanking(512 * 1024, 512 * 1024);
+        }
+        if ((string(argv[i])).find("-f") == 0) { // print the instruction pair profile after execution
+            profile = true;
+            z80.profilePairs = true;
+        }
+        if ((string(argv[i])).find("-F") == 0) { // print the profile's hottest fusable pairs as a Z80_FUSED_PAIRS list for fusion.h
+            fusionList = true;
+            z80.profilePairs = true;
+        }
+    }
+    if (!filename.empty()) { // after the options, they may change the memory layout
+        vector<uint8_t> executable_program = loadHexToVector(filename);
+        z80.loadProgram(executable_program);
+    }
+    if (!binary.empty()) {
+        uint16_t start = entry >= 0 ? entry : loadAddress;
+        if (z80.memory.banked() && loadAddress != 0) {
+            cerr << "-a can't be used with -b, the image is loaded from bank 0" << endl;
+            return 1;
+        }
+        bool loaded = z80.memory.banked() ? z80.loadBanks(binary) : z80.loadBinary(binary, loadAddress, start);
+        if (!loaded) {
+            cerr << "Can't load " << binary << endl;
+            return 1;
+        }
+        if (z80.memory.banked()) z80.entryPoint = start; // loadBinary() sets it, loadBanks() doesn't know it
     }
     z80.run();
+    if (profile == true) z80.printPairProfile(cerr);
+    if (fusionList == true) z80.printFusionList(cerr);
     if (printMemory == true) z80.view_program();
 
     return 0;
@@ -0,0 +1,279 @@
+#include "../include/memory.h"
+#include <cstring>
+#include <algorithm>
+
+static_assert(MEMORY_PAGE_SIZE <= IMAGE_ALIGN, "a shared page must be readable to its end");
+
+Z80_Memory::Z80_Memory() {
+    memset(openBus, 0xFF, sizeof(openBus));
+    dirty.assign(MEMORY_PAGES, 0);
+    mapDirty = false;
+    romBanks = 0;
+    paging = false;
+    memset(bank, 0, sizeof(bank));
+    setPages(0, MEMORY_SIZE, PAGE_RAM);
+}
+
+uint8_t Z80_Memory::peek(uint16_t address) {
+    const uint8_t* page = readPage[address >> MEMORY_PAGE_SHIFT];
+    return page ? page[address & MEMORY_PAGE_MASK] : 0xFF;
+}
+
+void Z80_Memory::load(uint16_t address, const uint8_t* data, size_t length) {
+    if (length > (size_t)(MEMORY_SIZE - address)) length = MEMORY_SIZE - address;
+    for (size_t done = 0; done < length;) { // page by page, they may come from different banks
+        unsigned at = address + done;
+        size_t chunk = min(length - done, (size_t)(MEMORY_PAGE_SIZE - (at & MEMORY_PAGE_MASK)));
+        uint8_t* target = backing(at >> MEMORY_PAGE_SHIFT);
+        if (target == nullptr && shared(at >> MEMORY_PAGE_SHIFT)) target = privatize(at >> MEMORY_PAGE_SHIFT);
+        if (target) memcpy(target + (at & MEMORY_PAGE_MASK), data + done, chunk);
+        touch(at >> MEMORY_PAGE_SHIFT);
+        done += chunk;
+    }
+    if (remapped) remapped(address, length); // new code there
+}
+
+void Z80_Memory::markDirty(uint16_t address, unsigned length) {
+#if MEMORY_DIRTY
+    if (length == 0) return;
+    unsigned last = (min(address + length, (unsigned)MEMORY_SIZE) - 1) >> MEMORY_PAGE_SHIFT;
+    for (unsigned page = address >> MEMORY_PAGE_SHIFT; page <= last; page++) *dirtyMark[page] = 1; // like write()
+#else
+    (void)address;
+    (void)length;
+#endif
+}
+
+bool Z80_Memory::isDirty(uint16_t address) {
+    unsigned page = backingPage(address >> MEMORY_PAGE_SHIFT);
+    return !MEMORY_DIRTY || (page < dirty.size() && dirty[page]);
+}
+
+const uint8_t* Z80_Memory::backingData(unsigned page) {
+    if (banked()) return banks.data() + ((size_t)page << MEMORY_PAGE_SHIFT);
+    if (!contents.empty()) return contents.data() + (page << MEMORY_PAGE_SHIFT);
+    return own[page] ? own[page].get() : shared(page);
+}
+
+void Z80_Memory::touch(unsigned page) {
+    page = backingPage(page);
+    if (page < dirty.size()) dirty[page] = 1;
+}
+
+void Z80_Memory::reset() {
+    if (banked()) setPaging(false);
+}
+
+void Z80_Memory::setRAM(uint16_t address, unsigned length) {
+    setPages(address, length, PAGE_RAM);
+}
+
+void Z80_Memory::setROM(uint16_t address, unsigned length) {
+    setPages(address, length, PAGE_ROM);
+}
+
+void Z80_Memory::unmap(uint16_t address, unsigned length) {
+    setPages(address, length, PAGE_UNMAPPED);
+}
+
+void Z80_Memory::mapDevice(uint16_t address, unsigned length, function<uint8_t(uint16_t)> read, function<void(uint16_t, uint8_t)> write) {
+    devices.push_back({read, write});
+    setPages(address, length, PAGE_MMIO, devices.size() - 1);
+}
+
+void Z80_Memory::setBanking(size_t romSize, size_t ramSize) {
+    romBanks = romSize / BANK_SIZE;
+    vector<uint8_t>(romBanks * BANK_SIZE + ramSize / BANK_SIZE * BANK_SIZE).swap(banks);
+    dirty.assign(banked() ? banks.size() >> MEMORY_PAGE_SHIFT : MEMORY_PAGES, 1); // the pages point into it again below
+    mapDirty = true;
+    if (!banked()) {
+        for (unsigned page = 0; page < MEMORY_PAGES; page++) {
+            if (attribute[page] != PAGE_MMIO) attribute[page] = PAGE_RAM;
+        }
+        for (unsigned page = 0; page < MEMORY_PAGES; page++) mapPage(page);
+        if (remapped) remapped(0, MEMORY_SIZE);
+        return;
+    }
+    memset(bank, 0, sizeof(bank));
+    paging = false;
+    for (unsigned window = 0; window < BANK_WINDOWS; window++) mapWindow(window);
+}
+
+void Z80_Memory::loadBank(unsigned number, const uint8_t* data, size_t length) {
+    size_t offset = (size_t)number * BANK_SIZE;
+    if (offset >= banks.size()) return;
+    length = min(length, banks.size() - offset);
+    memcpy(banks.data() + offset, data, length);
+    if (length) fill(dirty.begin() + (offset >> MEMORY_PAGE_SHIFT), dirty.begin() + ((offset + length - 1) >> MEMORY_PAGE_SHIFT) + 1, 1);
+    if (remapped) remapped(0, MEMORY_SIZE); // it may be mapped anywhere
+}
+
+void Z80_Memory::selectBank(unsigned window, uint8_t number) {
+    if (bank[window] == number) return;
+    bank[window] = number;
+    if (paging) {
+        mapWindow(window);
+        mapDirty = true;
+    }
+}
+
+void Z80_Memory::setPaging(bool enable) {
+    paging = enable;
+    mapDirty = true;
+    for (unsigned window = 0; window < BANK_WINDOWS; window++) mapWindow(window);
+}
+
+bool Z80_Memory::bankPort(uint8_t port, uint8_t value) {
+    if (!banked()) return false;
+    if (port >= BANK_PORT_SELECT && port < BANK_PORT_SELECT + BANK_WINDOWS) {
+        selectBank(port - BANK_PORT_SELECT, value);
+        return true;
+    }
+    if (port == BANK_PORT_ENABLE) {
+        if ((value & 1) != paging) setPaging(value & 1);
+        return true;
+    }
+    return false;
+}
+
+void Z80_Memory::share(shared_ptr<const Z80_Image> boot, size_t romSize) {
+    if (banked()) setBanking(0, 0);
+    image = boot;
+    vector<uint8_t>().swap(contents);
+    for (unsigned page = 0; page < MEMORY_PAGES; page++) {
+        own[page].reset();
+        if (attribute[page] != PAGE_MMIO) attribute[page] = ((size_t)page << MEMORY_PAGE_SHIFT) < romSize ? PAGE_ROM : PAGE_COW;
+        mapPage(page);
+    }
+    fill(dirty.begin(), dirty.end(), 1);
+    if (remapped) remapped(0, MEMORY_SIZE);
+}
+
+void Z80_Memory::revert() {
+    if (!image) return;
+    for (unsigned page = 0; page < MEMORY_PAGES; page++) {
+        if (!own[page]) continue;
+        own[page].reset();
+        mapPage(page);
+        dirty[page] = 1;
+        if (remapped) remapped(page << MEMORY_PAGE_SHIFT, MEMORY_PAGE_SIZE);
+    }
+}
+
+unsigned Z80_Memory::privatePages() {
+    unsigned count = 0;
+    for (unsigned page = 0; page < MEMORY_PAGES; page++) count += own[page] != nullptr;
+    return count;
+}
+
+uint8_t* Z80_Memory::privatize(unsigned page) {
+    if (!image) { // first store into a fresh address space, everything moves to the flat array
+        contents.assign(MEMORY_SIZE, 0);
+        for (unsigned n = 0; n < MEMORY_PAGES; n++) mapPage(n);
+        return contents.data() + (page << MEMORY_PAGE_SHIFT);
+    }
+    own[page].reset(new uint8_t[MEMORY_PAGE_SIZE]);
+    memcpy(own[page].get(), shared(page), MEMORY_PAGE_SIZE);
+    mapPage(page); // same contents, decoded code stays valid
+    return own[page].get();
+}
+
+const uint8_t* Z80_Memory::shared(unsigned page) {
+    if (banked()) return nullptr;
+    static const uint8_t blank[MEMORY_PAGE_SIZE] = {0}; // past the end of the image, or no image and nothing stored yet
+    if (!image) return blank;
+    size_t offset = (size_t)page << MEMORY_PAGE_SHIFT;
+    return offset < image->size ? image->data + offset : blank;
+}
+
+uint8_t* Z80_Memory::backing(unsigned page) {
+    if (!banked()) return contents.empty() ? own[page].get() : contents.data() + (page << MEMORY_PAGE_SHIFT);
+    unsigned index = backingPage(page);
+    return index != ~0u ? banks.data() + ((size_t)index << MEMORY_PAGE_SHIFT) : nullptr;
+}
+
+unsigned Z80_Memory::backingPage(unsigned page) {
+    if (!banked()) return page;
+    unsigned window = page >> (BANK_SHIFT - MEMORY_PAGE_SHIFT);
+    size_t offset = (size_t)(paging ? bank[window] : 0) * BANK_SIZE + ((page << MEMORY_PAGE_SHIFT) & (BANK_SIZE - 1));
+    return offset < banks.size() ? offset >> MEMORY_PAGE_SHIFT : ~0u;
+}
+
+uint8_t Z80_Memory::bankKind(uint8_t number) {
+    if (number < romBanks) return PAGE_ROM;
+    return (size_t)number * BANK_SIZE < banks.size() ? PAGE_RAM : PAGE_UNMAPPED;
+}
+
+void Z80_Memory::mapPage(unsigned page) {
+    uint8_t* data = backing(page);
+    const uint8_t* source = data ? data : shared(page);
+    uint8_t kind = attribute[page];
+    if (source == nullptr) {
+        kind = PAGE_UNMAPPED;
+    } else if (kind == PAGE_RAM && data == nullptr) {
+        kind = attribute[page] = PAGE_COW;
+    } else if (kind == PAGE_COW && data) {
+        kind = attribute[page] = PAGE_RAM;
+    }
+    switch (kind) {
+        case PAGE_RAM:
+            readPage[page] = data;
+            writePage[page] = data;
+            break;
+        case PAGE_ROM:
+            readPage[page] = source;
+            writePage[page] = discard;
+            break;
+        case PAGE_COW:
+            readPage[page] = source;
+            writePage[page] = nullptr;
+            break;
+        case PAGE_UNMAPPED:
+            readPage[page] = openBus;
+            writePage[page] = discard;
+            break;
+        default:
+            readPage[page] = nullptr;
+            writePage[page] = nullptr;
+            break;
+    }
+    dirtyMark[page] = (kind == PAGE_RAM) ? &dirty[backingPage(page)] : &ignored;
+}
+
+void Z80_Memory::mapWindow(unsigned window) {
+    uint8_t kind = bankKind(paging ? bank[window] : 0);
+    unsigned first = window << (BANK_SHIFT - MEMORY_PAGE_SHIFT);
+    for (unsigned page = first; page < first + (BANK_SIZE >> MEMORY_PAGE_SHIFT); page++) {
+        if (attribute[page] != PAGE_MMIO) attribute[page] = kind;
+        mapPage(page);
+    }
+    if (remapped) remapped(window << BANK_SHIFT, BANK_SIZE);
+}
+
+void Z80_Memory::setPages(uint16_t address, unsigned length, uint8_t kind, unsigned index) {
+    if (length == 0) return;
+    unsigned first = address >> MEMORY_PAGE_SHIFT;
+    unsigned last = (min(address + length, (unsigned)MEMORY_SIZE) - 1) >> MEMORY_PAGE_SHIFT;
+    for (unsigned page = first; page <= last; page++) {
+        attribute[page] = kind;
+        device[page] = index;
+        mapPage(page);
+    }
+    unsigned start = first << MEMORY_PAGE_SHIFT;
+    if (remapped) remapped(start, ((last + 1) << MEMORY_PAGE_SHIFT) - start);
+}
+
+uint8_t Z80_Memory::readDevice(uint16_t address) {
+    Device& target = devices[device[address >> MEMORY_PAGE_SHIFT]];
+    return target.read ? target.read(address) : 0xFF;
+}
+
+void Z80_Memory::writeSlow(uint16_t address, uint8_t value) {
+    if (attribute[address >> MEMORY_PAGE_SHIFT] == PAGE_COW) {
+        privatize(address >> MEMORY_PAGE_SHIFT);
+        write(address, value);
+        return;
+    }
+    Device& target = devices[device[address >> MEMORY_PAGE_SHIFT]];
+    if (target.write) target.write(address, value);
+}
@@ -0,0 +1,69 @@
+#include "../include/pacer.h"
+#include <cerrno>
+
+static int64_t toNanos(const struct timespec& ts) {
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static struct timespec fromNanos(int64_t ns) {
+    struct timespec ts;
+    ts.tv_sec = ns / 1000000000LL;
+    ts.tv_nsec = ns % 1000000000LL;
+    return ts;
+}
+
+Z80_Pacer::Z80_Pacer() {
+    setClock(CLOCK_7_37MHZ);
+}
+
+void Z80_Pacer::setClock(uint32_t hz) {
+    clock_hz = hz;
+    quantum = (uint64_t)hz * PACER_QUANTUM_US / 1000000;
+    if (hz == CLOCK_UNTHROTTLED) quantum = PACER_UNTHROTTLED_QUANTUM;
+    if (quantum == 0) quantum = 1;
+    start(0);
+}
+
+uint32_t Z80_Pacer::getClock() {
+    return clock_hz;
+}
+
+void Z80_Pacer::start(uint64_t cycles) {
+    baseCycles = cycles;
+    clock_gettime(CLOCK_MONOTONIC, &baseTime);
+    nextSync = cycles + quantum;
+}
+
+void Z80_Pacer::sync(uint64_t cycles) {
+    if (clock_hz == CLOCK_UNTHROTTLED) {
+        nextSync = cycles + quantum;
+        return;
+    }
+
+    // Host time at which the emulated clock reaches the current cycle count
+    int64_t emulated = (int64_t)((cycles - baseCycles) * 1000000000ULL / clock_hz);
+    int64_t deadline = toNanos(baseTime) + emulated;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t lag = toNanos(now) - deadline;
+
+    if (lag > (int64_t)PACER_MAX_LAG_US * 1000) {
+        // Host fell far behind (stopped process, slow terminal...), don't try to catch up in a burst
+        start(cycles);
+        return;
+    }
+    if (lag < 0) {
+        struct timespec until = fromNanos(deadline);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, nullptr) == EINTR) {
+            // Interrupted by a signal, sleep again until the deadline
+        }
+    }
+
+    // Rebase once in a while so (cycles - baseCycles) * 1e9 never overflows
+    if (cycles - baseCycles > (uint64_t)clock_hz * 60) {
+        baseTime = fromNanos(deadline);
+        baseCycles = cycles;
+    }
+    nextSync = cycles + quantum;
+}
@@ -0,0 +1,48 @@
+#include "../include/scheduler.h"
+
+Z80_Scheduler::Z80_Scheduler() {
+    next = EVENT_NEVER;
+}
+
+unsigned Z80_Scheduler::add(function<void()> callback) {
+    events.push_back({callback, 0, false});
+    return events.size() - 1;
+}
+
+void Z80_Scheduler::schedule(unsigned id, uint64_t cycle) {
+    Event& event = events[id];
+    event.generation++;
+    event.scheduled = true;
+    heap.push({cycle, id, event.generation});
+    if (cycle < next) next = cycle;
+}
+
+void Z80_Scheduler::cancel(unsigned id) {
+    events[id].generation++; // its heap entry is skipped when it comes up
+    events[id].scheduled = false;
+}
+
+bool Z80_Scheduler::pending(unsigned id) {
+    return events[id].scheduled;
+}
+
+void Z80_Scheduler::reset() {
+    for (Event& event : events) {
+        event.generation++;
+        event.scheduled = false;
+    }
+    heap = {};
+    next = EVENT_NEVER;
+}
+
+void Z80_Scheduler::run(uint64_t cycles) {
+    while (!heap.empty() && heap.top().cycle <= cycles) {
+        Entry entry = heap.top();
+        heap.pop();
+        Event& event = events[entry.id];
+        if (entry.generation != event.generation) continue; // rescheduled or cancelled since
+        event.scheduled = false;
+        event.callback(); // may schedule again, an event due by now still runs in this call
+    }
+    next = heap.empty() ? EVENT_NEVER : heap.top().cycle;
+}
@@ -0,0 +1,31 @@
+#include "../include/trace.h"
+
+Z80_Trace::Z80_Trace() {
+    enabled = false;
+    registers = false;
+    count = 0;
+}
+
+void Z80_Trace::enable(bool withRegisters) {
+    entries.resize(TRACE_SIZE);
+    enabled = true;
+    registers = withRegisters;
+}
+
+void Z80_Trace::disable() {
+    enabled = false;
+    vector<Z80_TraceEntry>().swap(entries);
+    count = 0;
+}
+
+void Z80_Trace::reset() {
+    count = 0;
+}
+
+unsigned Z80_Trace::size() {
+    return count < TRACE_SIZE ? count : TRACE_SIZE;
+}
+
+const Z80_TraceEntry& Z80_Trace::at(unsigned index) {
+    return entries[(count - size() + index) & (TRACE_SIZE - 1)];
+}
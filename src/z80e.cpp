@@ -1,6 +1,12 @@
 
 #include "../include/z80e.h"
-#include <fcntl.h>
+#include "../include/cycles.h"
+#include "../include/decode.h"
+#include "../include/fusion.h"
+#include <cstring>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
 
 #define clear() printf("\033[H\033[J") // macro to clear the screen
 
@@ -284,22 +290,55 @@ map<uint8_t, string> Opcodes = {
 
 
 Z80_Core::Z80_Core() {
+    pacerEvent = scheduler.add([this]() { pacerTick(); });
+    aciaEvent = scheduler.add([this]() { aciaTick(); });
+    irqEvent = scheduler.add([this]() { interruptHandler(); });
+    budgetEvent = scheduler.add([this]() { stop(STOP_BUDGET); });
+    memory.remapped = [this](uint16_t address, unsigned length) { invalidateRange(address, length); };
+    breakpoints = 0;
+    memset(breakMap, 0, sizeof(breakMap));
+    sliced = false;
+    tracing = false;
     reset(); // initialize the cpu
 }
 
+Z80_Core::~Z80_Core() {
+    flushBlocks();
+}
+
 void Z80_Core::loadProgram(vector<uint8_t>& inputProgram) {
-    for (unsigned i = 0; i < inputProgram.size(); i++) {
-        memory[i] = inputProgram[i];
-    }
+    memory.load(0, inputProgram.data(), inputProgram.size());
+    flushBlocks(); // the old program's blocks are stale
     cout << "Program loaded, " << inputProgram.size() << " bytes" << endl;
 
 }
+
+// Raw binary, copied straight from the file mapping, anything past 0xFFFF is left out
+bool Z80_Core::loadBinary(const string& path, uint16_t address, uint16_t entry) {
+    shared_ptr<Z80_Image> image = Z80_Image::map(path);
+    if (!image) return false;
+    memory.load(address, image->data, image->size);
+    entryPoint = entry;
+    flushBlocks();
+    cout << "Program loaded, " << min(image->size, (size_t)(MEMORY_SIZE - address)) << " bytes at 0x" << hex << address << dec << endl;
+    return true;
+}
+
+// ROM set or banked image, into the banks from bank on
+bool Z80_Core::loadBanks(const string& path, unsigned bank) {
+    shared_ptr<Z80_Image> image = Z80_Image::map(path);
+    if (!image || !memory.banked()) return false;
+    memory.loadBank(bank, image->data, image->size);
+    flushBlocks();
+    cout << "Image loaded, " << image->size << " bytes from bank " << bank << endl;
+    return true;
+}
 void Z80_Core::view_ram() {
     int addr1, addr2;
     cout << "Z80 RAM viewer v1.0" << endl;
     cin >> addr1 >> addr2;
     for (int i = addr1; i <= addr2; i++) {
-        cout << i << ": " << unsigned(memory[i]) << endl;
+        cout << i << ": " << unsigned(memory.peek(i)) << endl;
     }
     system("pause");
 }
@@ -309,44 +348,230 @@ void Z80_Core::view_program() {
     cout << "Z80 program viewer v1.0" << endl;
     while (true) {
         if (i > MEMORY_SIZE) break;
-        cout << hex << (unsigned)i << ": " << unsigned(memory[i]) << " " << unsigned(memory[++i]) << " " << unsigned(memory[++i]) << " " << unsigned(memory[++i]) << " " << unsigned(memory[++i]) << " " << unsigned(memory[++i]) << " " << unsigned(memory[++i]) << " " << unsigned(memory[++i]) << " " << unsigned(memory[++i]) << " " << unsigned(memory[++i]) << " " << unsigned(memory[++i]) << " " << unsigned(memory[++i]) << " " << unsigned(memory[++i]) << " " << unsigned(memory[++i]) << " " << unsigned(memory[++i])  << endl;
+        cout << hex << (unsigned)i << ": " << unsigned(memory.peek(i)) << " " << unsigned(memory.peek(++i)) << " " << unsigned(memory.peek(++i)) << " " << unsigned(memory.peek(++i)) << " " << unsigned(memory.peek(++i)) << " " << unsigned(memory.peek(++i)) << " " << unsigned(memory.peek(++i)) << " " << unsigned(memory.peek(++i)) << " " << unsigned(memory.peek(++i)) << " " << unsigned(memory.peek(++i)) << " " << unsigned(memory.peek(++i)) << " " << unsigned(memory.peek(++i)) << " " << unsigned(memory.peek(++i)) << " " << unsigned(memory.peek(++i)) << " " << unsigned(memory.peek(++i))  << endl;
         i++;
     }
 
 }
-vector<uint8_t> ExecutedInstructions;
 
 void Z80_Core::reset() {
-    a = b = c = d = e = h = l = 0;
+    af = bc = de = hl = 0;
     afa = bca = dea = hla = 0;
     ix = iy = 0;
-    pc = 0;
-    sp = MEMORY_SIZE; // set sp to top of memory
+    pc = entryPoint;
+    sp = 0xFFFF; // set sp to top of memory
     acc = 0;
     f = 0;
+    lazyFlags = LAZY_NONE;
     halt = false;
+    halted = false;
+    stopReason = STOP_NONE;
+    started = false;
     isInput = false;
     iff1 = iff2 = false;
+    cycles = 0;
+    eiCycles = ~0ULL;
+    isPending = false;
+    ACIA_status = ACIA_control = 0;
+    memory.reset();
+    scheduler.reset();
+    pollPc = 0;
+    pollCycles = pollPeriod = 0;
+    pollStreak = 0;
+    fusedRuns = 0;
+    profileDispatches = profileInstructions = 0;
+    unordered_map<uint32_t, uint64_t>().swap(pairCounts);
+    trace.reset(); // drop the trace of the previous run
+    nop_watchdog = 0;
+    nopEnd = ~0u;
+    operandCursor = nullptr;
+    flushBlocks();
+}
+
+inline void Z80_Core::startInstruction(uint8_t instruction, unsigned address) {
+    cycles += cyclesMain[instruction];
+    if (tracing) traceInstruction(instruction, address);
+}
+
+void Z80_Core::traceInstruction(uint8_t instruction, unsigned address) {
+    if (trace.enabled) {
+        Z80_TraceEntry& entry = trace.record();
+        entry.pc = address;
+        for (unsigned i = 0; i < 4; i++) entry.bytes[i] = memory.peek(address + i);
+        entry.registers = trace.registers;
+        if (trace.registers) {
+            materializeFlags();
+            entry.af = af;
+            entry.bc = bc;
+            entry.de = de;
+            entry.hl = hl;
+            entry.ix = ix;
+            entry.iy = iy;
+            entry.sp = sp;
+        }
+    }
+    if(DEBUG) cout << "PC: " << hex << address << "  INS: " << (unsigned)instruction << " " << Opcodes[instruction] << endl;
+}
+
+inline void Z80_Core::pollDevices() {
+    if (cycles >= scheduler.next) scheduler.run(cycles);
+}
+
+void Z80_Core::pacerTick() { // once per quantum
+    pacer.sync(cycles);
+    console.flushIfDue();
+    scheduler.schedule(pacerEvent, pacer.nextSync);
+}
+
+// The receiver with RIE set, once per character time
+void Z80_Core::aciaTick() {
+    if (!(ACIA_control & 0x80)) return;
+    ACIA_6850_Handler();
+    if (ACIA_status & 0x01) raiseInterrupt(); // IRQ stays up while RDRF is full
+    scheduler.schedule(aciaEvent, cycles + ACIA_RX_CYCLES);
+}
+
+// IRQ asserted, taken after the current instruction if interrupts are enabled, else once they are
+void Z80_Core::raiseInterrupt() {
+    isPending = true;
+    scheduler.schedule(irqEvent, cycles);
 }
 
 void Z80_Core::run() {
+    if (DEBUG && !trace.enabled) trace.enable(true);
     reset();
-    pc = 0;
-    uint8_t opcode;
-    while (!halt) {
-        opcode = fetchOperand();
-        decode_execute(opcode);
-        ACIA_6850_Handler();
-        if(isPending) interruptHandler();
-        usleep(500); // adjust delay
-    }
-    if (DEBUG) {
-        printInfo();
-        cout << "Executed " << ExecutedInstructions.size() << " instructions:" << endl;
-        for (int i = 0; i < ExecutedInstructions.size(); i++) { // print executed instructions
-            cout << Opcodes[ExecutedInstructions[i]] << endl;
+    sliced = false;
+    if (begin()) execute();
+    console.stop(); // also flushes the output on HALT
+    if (DEBUG) printInfo();
+    if (trace.enabled) dumpTrace(cout);
+}
+
+/*
+    Sliced execution for hosts that drive the CPU themselves. Nothing is reset,
+    a slice continues where the previous one stopped, the pacer and console are
+    started by the first one. Where run() would sleep until input arrives a
+    slice returns STOP_IO_WAIT, the host calls again when it likes.
+*/
+Z80_Stop Z80_Core::run_cycles(uint64_t budget) {
+    sliced = true;
+    scheduler.schedule(budgetEvent, cycles + budget); // HALT skips ahead to it too
+    if (begin()) execute();
+    scheduler.cancel(budgetEvent);
+    return stopReason;
+}
+
+// Runs through the handler table whatever the dispatch mode, so it can count every instruction
+Z80_Stop Z80_Core::run_instructions(uint64_t count) {
+    sliced = true;
+    if (!begin()) return stopReason;
+    for (uint64_t done = 0; !halt; done++) {
+        if (done == count) {
+            stop(STOP_BUDGET);
+            break;
+        }
+        if (done > 0 && breakpoints && breakpointAt(pc)) {
+            stop(STOP_BREAKPOINT);
+            break;
         }
+        decode_execute(fetchOperand());
+        pollDevices();
     }
+    return stopReason;
+}
+
+Z80_Stop Z80_Core::step() {
+    return run_instructions(1);
+}
+
+void Z80_Core::stop(Z80_Stop reason) {
+    halt = true;
+    stopReason = reason;
+}
+
+bool Z80_Core::begin() {
+    if (stopReason == STOP_HALT) return false;
+    halt = false;
+    stopReason = STOP_NONE;
+    if (tracing != (DEBUG || trace.enabled)) {
+        tracing = !tracing;
+        flushBlocks(); // compiled code calls out for every instruction while tracing
+    }
+    if (!started) {
+        pacer.start(cycles);
+        scheduler.schedule(pacerEvent, pacer.nextSync);
+        console.start();
+        started = true;
+    }
+    if (halted) idle(); // still in HALT from the previous slice
+    return !halt;
+}
+
+void Z80_Core::execute() {
+    uint8_t mode = dispatch;
+    if (breakpoints) {
+        // Breakpoints are checked between instructions and at block starts, compiled code runs past them
+        if (mode == DISPATCH_THREADED) mode = DISPATCH_TABLE;
+        if (mode == DISPATCH_JIT) mode = DISPATCH_CACHED;
+        if (breakpointAt(pc)) { // resuming from it, the instruction there runs first
+            decode_execute(fetchOperand());
+            pollDevices();
+        }
+    }
+
+    switch (mode) {
+        case DISPATCH_SWITCH:
+            while (!halt) {
+                if (breakpoints && breakpointAt(pc)) {
+                    stop(STOP_BREAKPOINT);
+                    break;
+                }
+                decode_switch(fetchOperand());
+                pollDevices();
+            }
+            break;
+        case DISPATCH_TABLE:
+            while (!halt) {
+                if (breakpoints && breakpointAt(pc)) {
+                    stop(STOP_BREAKPOINT);
+                    break;
+                }
+                decode_execute(fetchOperand());
+                pollDevices();
+            }
+            break;
+        case DISPATCH_CACHED:
+            run_cached();
+            break;
+        case DISPATCH_JIT:
+            run_jit();
+            break;
+        default:
+            run_threaded();
+            break;
+    }
+}
+
+inline bool Z80_Core::breakpointAt(unsigned address) {
+    return breakMap[(address >> 3) & 0x1FFF] & (1 << (address & 7));
+}
+
+void Z80_Core::setBreakpoint(uint16_t address) {
+    if (breakpointAt(address)) return;
+    breakMap[address >> 3] |= 1 << (address & 7);
+    breakpoints++;
+    invalidateCode(address); // blocks end before breakpoints, this one may be inside one
+}
+
+void Z80_Core::clearBreakpoint(uint16_t address) {
+    if (!breakpointAt(address)) return;
+    breakMap[address >> 3] &= ~(1 << (address & 7));
+    breakpoints--;
+}
+
+// The generic handlers: run() reports the opcode and goes on, a slice stops there
+void Z80_Core::invalidOpcode() {
+    if (sliced) stop(STOP_INVALID);
 }
 
 uint8_t Z80_Core::ACIA_6850(uint8_t op, uint8_t operand) {
@@ -376,11 +601,6 @@ uint8_t Z80_Core::ACIA_6850(uint8_t op, uint8_t operand) {
         Bit 7   - RIE (Receive interrupt enable)
     */
 
-    char ch;
-    struct termios oldt, newt;
-    int flags;
-    ssize_t bytesRead;
-
     switch (op) {
         case 0: // Receive data
             if (ACIA_status & 0x01) {
@@ -391,40 +611,20 @@ uint8_t Z80_Core::ACIA_6850(uint8_t op, uint8_t operand) {
 
         case 1: // Transmit data
             ACIA_status &= ~0x02;
-            printf("%c", operand);
-            fflush(stdout);
+            console.write(operand);
             return 0;
 
         case 2: // Read status register
+            ACIA_6850_Latch();
             return ACIA_status;
 
         case 3: // Write control register
             ACIA_control = operand;
+            if ((operand & 0x80) && !scheduler.pending(aciaEvent)) scheduler.schedule(aciaEvent, cycles);
             return 0;
 
         case 4: // Check if input is available
-            tcgetattr(STDIN_FILENO, &oldt); // Save terminal settings
-            newt = oldt;
-            newt.c_lflag &= ~(ICANON | ECHO); // Disable canonical mode and echo
-            tcsetattr(STDIN_FILENO, TCSANOW, &newt);
-
-            flags = fcntl(STDIN_FILENO, F_GETFL, 0);
-            fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK); // Set non-blocking mode
-
-            bytesRead = read(STDIN_FILENO, &ch, 1); // Try to read input
-            if (bytesRead > 0) {
-                ACIA_RDR = ch;
-                ACIA_status |= 0x01;
-                if (ACIA_control & 0x80) {
-                    interruptHandler();
-                }
-            } else {
-                ACIA_status &= ~0x01;
-            }
-
-            fcntl(STDIN_FILENO, F_SETFL, flags);
-            tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
-            return (bytesRead > 0) ? 1 : 0;
+            return ACIA_6850_Latch();
 
         default:
             break;
@@ -460,78 +660,65 @@ uint8_t Z80_Core::ACIA_6850_Handler() {
         Bit 7   - RIE (Receive interrupt enable)
     */
 
-    char ch;
-    struct termios oldt, newt;
-    int flags;
-    ssize_t bytesRead;
-
-    tcgetattr(STDIN_FILENO, &oldt); // Save terminal settings
-    newt = oldt;
-    newt.c_lflag &= ~(ICANON | ECHO); // Disable canonical mode and echo
-    tcsetattr(STDIN_FILENO, TCSANOW, &newt);
+    // Polled programs pick up input when they read the status register,
+    // only interrupt driven ones need the receiver checked, see aciaTick()
+    if (ACIA_control & 0x80) {
+        return ACIA_6850_Latch();
+    }
+    return (ACIA_status & 0x01) ? 1 : 0;
+}
 
-    flags = fcntl(STDIN_FILENO, F_GETFL, 0);
-    fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK); // Set non-blocking mode
+uint8_t Z80_Core::ACIA_6850_Latch() {
+    uint8_t ch;
 
-    bytesRead = read(STDIN_FILENO, &ch, 1); // Try to read input
-    if (bytesRead > 0) {
+    // Move the next queued byte to the receive register once the program has read the previous one
+    if (!(ACIA_status & 0x01) && console.read(ch)) {
         ACIA_RDR = ch;
         ACIA_status |= 0x01;
         if (ACIA_control & 0x80) {
             //cout << "Interrupt pending, iff1: " << iff1 << " iff2: " << iff2  << endl;
-            isPending = true;
-        } else {
-            // Do nothing
+            raiseInterrupt();
         }
-    } else {
-        isPending = false;
     }
 
-    fcntl(STDIN_FILENO, F_SETFL, flags);
-    tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
-
-    return (bytesRead > 0) ? 1 : 0;
+    return (ACIA_status & 0x01) ? 1 : 0;
 }
 
 
 uint8_t Z80_Core::inputHandler(uint8_t port) {
     uint8_t input = 0;
 
+    bool empty = false; // nothing to read, the program may be waiting for input
+
     if (port == 0x00){ // Stdin
-        struct termios oldt, newt;
-        tcgetattr(STDIN_FILENO, &oldt);  // Save the terminal settings
-        newt = oldt;
-        newt.c_lflag &= ~(ICANON | ECHO);  // Disable canonical mode and echo
-        tcsetattr(STDIN_FILENO, TCSANOW, &newt);  // Apply new settings
-
-        int flags = fcntl(STDIN_FILENO, F_GETFL, 0);
-        fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK);  // Set non-blocking
-
-        char ch;
-        ssize_t bytesRead = read(STDIN_FILENO, &ch, 1);  // Attempt to read input
-        if (bytesRead > 0) {
-            input = static_cast<uint8_t>(ch);
+        uint8_t ch;
+        if (console.read(ch)) {
+            input = ch;
+        } else {
+            empty = true;
         }
-
-        fcntl(STDIN_FILENO, F_SETFL, flags);
-        tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
     }
     if (port == 0x80){ // ACIA 6850 Status Register
         input = ACIA_6850(ACIA_READ_STATUS, 0);
+        empty = !(input & 0x01);
     }
     if (port == 0x81){ // ACIA 6850 Data Register
         input = ACIA_6850(ACIA_RECIEVE, 0);
     }
+
+    if (empty) pollWait();
+    else pollStreak = 0;
     return input;
 }
 
 uint8_t Z80_Core::outputHandler(uint8_t &reg, uint8_t port) {
     switch (port) {
         case 0x00: // stdout
-            printf("%c", reg);
+            console.write(reg);
             break;
         case 0x01: // debug
             if (DEBUG) {
+                console.flush();
                 printInfo();
             }
             break;
@@ -542,28 +729,175 @@ uint8_t Z80_Core::outputHandler(uint8_t &reg, uint8_t port) {
             ACIA_6850(ACIA_TRANSMIT, reg);
             break;
         default:
+            memory.bankPort(port, reg);
             break;
     }
     return reg;
 }
 
 void Z80_Core::interruptHandler() {
-    if (iff1 == 0) return;
-    iff1, iff2 = 0;
+    if (iff1 == 0) return; // disabled, EI, RETI and RETN schedule it again
+    if (cycles == eiCycles) { // EI was the last instruction, the interrupt comes after the next one
+        if (isPending) scheduler.schedule(irqEvent, cycles + 1);
+        return;
+    }
+    iff1 = iff2 = 0;
+    halted = false;
+    isPending = false;
+    push(pc);
     switch (im){
-        case 0: // TODO
+        case 0: // runs the byte on the bus, always an RST
+            pc = IRQ_BUS_BYTE & 0x38;
+            cycles += CYCLES_IRQ_IM0;
             break;
         case 1: // RST 38H
-            push(pc);
             pc = 0x38;
-            isPending = false;
+            cycles += CYCLES_IRQ_IM1;
+            break;
+        case 2: { // vector table at I, the bus byte picks the entry
+            uint16_t vector = (i << 8) | IRQ_BUS_BYTE;
+            pc = memory.read(vector) | (memory.read(vector + 1) << 8);
+            cycles += CYCLES_IRQ_IM2;
+            break;
+        }
+    }
+}
+
+// An interrupt can still come in: they're enabled and the ACIA may raise one
+inline bool Z80_Core::interruptible() {
+    return iff1 && (ACIA_control & 0x80);
+}
+
+/*
+    HALT with interrupts enabled. The CPU would run NOPs until an interrupt,
+    instead the emulator skips ahead to the next device event, and when there's
+    no input for the ACIA to pick up it sleeps until some arrives and accounts
+    the NOPs for the time that passed. pc already points past the HALT, the
+    interrupt returns there.
+*/
+void Z80_Core::idle() {
+    halted = true;
+    while (halted && !halt) {
+        pollDevices(); // takes the interrupt if there is one
+        if (!halted) break;
+        if (console.closed()) { // no more input, nothing will ever wake the CPU up
+            stop(STOP_IO_WAIT);
             break;
-        case 2: // TODO
+        }
+        if (sliced && !console.available()) { // the host decides what to do meanwhile
+            stop(STOP_IO_WAIT);
             break;
+        }
+        uint64_t skipped = console.available() ? scheduler.next - cycles : waitInput();
+        cycles += max<uint64_t>(cyclesMain[0x00], (skipped + cyclesMain[0x00] - 1) & ~3ULL); // whole NOPs up to the event, at least one
+    }
+}
+
+// The emulated time spent waiting: at the emulated clock when throttled, up to the next event when not
+uint64_t Z80_Core::waitInput() {
+    struct timespec from, to;
+    clock_gettime(CLOCK_MONOTONIC, &from);
+    console.wait(-1);
+    clock_gettime(CLOCK_MONOTONIC, &to);
+
+    if (pacer.getClock() == CLOCK_UNTHROTTLED) {
+        return (scheduler.next > cycles) ? scheduler.next - cycles : 0;
+    }
+    int64_t slept = (int64_t)(to.tv_sec - from.tv_sec) * 1000000000LL + (to.tv_nsec - from.tv_nsec);
+    return (uint64_t)slept * pacer.getClock() / 1000000000ULL;
+}
+
+/*
+    Busy-wait loops like IN A, (0x80) / AND 1 / JR Z run millions of times while
+    the console is idle. Once the same IN has come back empty POLL_STREAK times
+    at the same interval and the loop around it can't change anything but A and
+    F, the emulator sleeps until input arrives and accounts the iterations that
+    would have run meanwhile. The registers end up as after any one of them.
+*/
+void Z80_Core::pollWait() {
+    unsigned in = (pc - 2) & 0xFFFF; // IN A, (n) and IN r, (C) are both 2 bytes and pc is past them
+    uint64_t period = cycles - pollCycles;
+    if (in != pollPc || period != pollPeriod) {
+        pollPc = in;
+        pollPeriod = period;
+        pollStreak = 0;
+    }
+    pollCycles = cycles;
+    if (++pollStreak < POLL_STREAK || period == 0) return;
+    pollStreak = 0;
+    if (!pollLoop(in)) return;
+
+    if (console.closed() || sliced) { // no more input and the loop would spin forever, or the host waits
+        stop(STOP_IO_WAIT);
+        return;
+    }
+    cycles += waitInput() / period * period;
+    pollCycles = cycles;
+}
+
+bool Z80_Core::pollLoop(uint16_t in) {
+    int target;
+    bool conditional;
+
+    // Find the branch back over the IN, anything leaving the loop on the way must be conditional
+    uint16_t address = in;
+    int start = -1;
+    for (int i = 0; i < POLL_LOOP_MAX && start < 0; i++) {
+        unsigned length = pollStep(address, target, conditional);
+        if (length == 0) return false;
+        if (target >= 0 && (uint16_t)(in - target) < POLL_LOOP_BYTES) start = target;
+        else if (target >= 0 && !conditional) return false;
+        address += length;
+    }
+    if (start < 0) return false;
+
+    // The same goes for the loop head up to the IN
+    for (address = start; address != in;) {
+        unsigned length = pollStep(address, target, conditional);
+        if (length == 0 || (target >= 0 && !conditional)) return false;
+        address += length;
+        if ((uint16_t)(address - start) > POLL_LOOP_BYTES) return false; // went past the IN
+    }
+    return true;
+}
+
+// Length of the instruction at address if a busy-wait loop may contain it, 0 if not.
+// Only device reads, tests of the value and jumps: repeating them gives the same state.
+unsigned Z80_Core::pollStep(uint16_t address, int& target, bool& conditional) {
+    target = -1;
+    conditional = false;
+    if (address > MEMORY_SIZE - 3) return 0;
+    uint8_t operand = memory.peek(address + 1);
+
+    switch (memory.peek(address)) {
+        case 0x00: case 0x07: case 0x0F: case 0x2F: // NOP, RLCA, RRCA, CPL
+        case 0xA7: case 0xB7: case 0xBF: // AND A, OR A, CP A
+            return 1;
+        case 0xDB: case 0xE6: case 0xEE: case 0xF6: case 0xFE: // IN A, (n), AND n, XOR n, OR n, CP n
+            return 2;
+        case 0x20: case 0x28: case 0x30: case 0x38: // JR cc, e
+            conditional = true;
+            [[fallthrough]];
+        case 0x18: // JR e
+            target = (uint16_t)(address + 2 + (int8_t)operand);
+            return 2;
+        case 0xC2: case 0xCA: case 0xD2: case 0xDA: case 0xE2: case 0xEA: case 0xF2: case 0xFA: // JP cc, nn
+            conditional = true;
+            [[fallthrough]];
+        case 0xC3: // JP nn
+            target = operand | (memory.peek(address + 2) << 8);
+            return 3;
+        case 0xCB: // BIT b, r, not (HL)
+            return ((operand & 0xC0) == 0x40 && (operand & 7) != 6) ? 2 : 0;
+        case 0xED: // IN r, (C), except into C itself
+            return ((operand & 0xC7) == 0x40 && operand != 0x48) ? 2 : 0;
+        default:
+            return 0;
     }
 }
 
 void Z80_Core::printCurrentState() {
+    materializeFlags();
     cout << "PC: " << pc << " SP: " << sp << " F: " << bitset<8>(f) << endl;
     cout << "IX: " << ix << " IY: " << iy << endl;
     cout << "ACC: " << acc << endl;
@@ -571,2678 +905,2495 @@ void Z80_Core::printCurrentState() {
 }
 
 void Z80_Core::printInfo() {
+    materializeFlags();
     cout << "PC: 0x" << hex << pc << " SP: 0x" << sp << " F: 0x" << bitset<8>(f) << endl;
     cout << "IX: 0x" << ix << " IY: 0x" << iy << endl;
     cout << "A: 0x" << hex << unsigned(a) << " BC: 0x" << unsigned(b) << unsigned(c) << " DE: 0x" << unsigned(d) << unsigned(e) << " HL: 0x" << unsigned(h) << unsigned(l) << endl;
+    cout << "T-states: " << dec << cycles << endl;
 }
 
 void Z80_Core::testAlu(uint8_t& reg, uint8_t reg2, uint8_t ins) {
-    alu((uint16_t&)reg, reg2, ins);
-}
-
-void Z80_Core::alu(uint16_t& op1, uint16_t op2, uint8_t ins) {
-
-    /* 
-    OP1 is the destination register
-    OP2 is the source register/immediate
-    INS is the ALU operation
-    
-    ALU instructions
-        0x00, 8-bit ADD reg, reg/n
-        0x01, 16-bit ADD reg, reg/nn
-        0x02, 8-bit ADC reg, reg/n
-        0x03, 16-bit ADC reg, reg/nn
-        0x04, 8-bit SUB reg, reg/n
-        0x05, 16-bit SUB reg, reg/nn
-        0x06, 8-bit SBC reg, reg/n
-        0x07, 16-bit SBC reg, reg/nn
-        0x08, 8-bit AND reg, reg/n
-        0x09, 8-bit OR reg, reg/n
-        0x0A, 8-bit XOR reg, reg/n
-        0x0B, 8-bit CP reg, reg/n
-        0x0C, 8-bit INC reg
-        0x0D, 8-bit DEC reg
-        0x0E, RLC reg
-        0x0F, RL reg
-        0x10, RRC reg
-        0x11, RR reg
-        0x12, SLA reg
-        0x13, SRA reg
-        0x14, SRL reg
-        0x15, BIT 0, reg
-        0x16, BIT 1, reg
-        0x17, BIT 2, reg
-        0x18, BIT 3, reg
-        0x19, BIT 4, reg
-        0x1A, BIT 5, reg
-        0x1B, BIT 6, reg
-        0x1C, BIT 7, reg
-        0x1D, RES 0, reg
-        0x1E, RES 1, reg
-        0x1F, RES 2, reg
-        0x20, RES 3, reg
-        0x21, RES 4, reg
-        0x22, RES 5, reg
-        0x23, RES 6, reg
-        0x24, RES 7, reg
-        0x25, SET 0, reg
-        0x26, SET 1, reg
-        0x27, SET 2, reg
-        0x28, SET 3, reg
-        0x29, SET 4, reg
-        0x2A, SET 5, reg
-        0x2B, SET 6, reg
-        0x2C, SET 7, reg
-        0x2D, 16-bit INC reg
-        0x2E, 16-bit DEC reg
-    */
-   
-    bool isCompare = false;
-    bool bitShort = false;
-    int result = 0;
-    bool carry_in = false;
-    
-    auto updateFlags8bit = [&](int val) {
-        // Zero flag
-        f = (val == 0) ? (f | FLAG_Z) : (f & ~FLAG_Z);
-        // Carry flag
-        f = (val & 0x100) ? (f | FLAG_C) : (f & ~FLAG_C);
-        // Half-carry flag
-        f = ((op1 & 0xF) + (op2 & 0xF)) > 0xF ? (f | FLAG_H) : (f & ~FLAG_H);
-        // Negative flag
-        f = (val < 0) ? (f | FLAG_N) : (f & ~FLAG_N);
-    };
+    switch (ins) { // runtime entry to the ALU kernels, for experiments
+        #define TEST_ALU(op) case op: reg = alu8<op>(reg, reg2); break;
+        TEST_ALU(ALU_ADD8) TEST_ALU(ALU_ADC8) TEST_ALU(ALU_SUB8) TEST_ALU(ALU_SBC8)
+        TEST_ALU(ALU_AND8) TEST_ALU(ALU_OR8) TEST_ALU(ALU_XOR8) TEST_ALU(ALU_CP8)
+        TEST_ALU(ALU_INC8) TEST_ALU(ALU_DEC8)
+        TEST_ALU(ALU_RLC8) TEST_ALU(ALU_RL8) TEST_ALU(ALU_RRC8) TEST_ALU(ALU_RR8)
+        TEST_ALU(ALU_SLA8) TEST_ALU(ALU_SRA8) TEST_ALU(ALU_SRL8)
+        TEST_ALU(ALU_BIT0) TEST_ALU(ALU_BIT1) TEST_ALU(ALU_BIT2) TEST_ALU(ALU_BIT3)
+        TEST_ALU(ALU_BIT4) TEST_ALU(ALU_BIT5) TEST_ALU(ALU_BIT6) TEST_ALU(ALU_BIT7)
+        TEST_ALU(ALU_RES0) TEST_ALU(ALU_RES1) TEST_ALU(ALU_RES2) TEST_ALU(ALU_RES3)
+        TEST_ALU(ALU_RES4) TEST_ALU(ALU_RES5) TEST_ALU(ALU_RES6) TEST_ALU(ALU_RES7)
+        TEST_ALU(ALU_SET0) TEST_ALU(ALU_SET1) TEST_ALU(ALU_SET2) TEST_ALU(ALU_SET3)
+        TEST_ALU(ALU_SET4) TEST_ALU(ALU_SET5) TEST_ALU(ALU_SET6) TEST_ALU(ALU_SET7)
+        #undef TEST_ALU
+    }
+}
 
-    switch (ins) {
-        case 0x00: // ADD8 reg, reg/n
-            result = (op1 & 0xFF) + (op2 & 0xFF);
-            op1 = (op1 & 0xFF00) | (result & 0xFF);
-            updateFlags8bit(result);
-            break;
-        case 0x01: // ADD16 reg, reg/nn
-            result = op1 + op2;
-            bitShort = true;
-            op1 = result;
-            updateFlags8bit(result);
-            break;
-        case 0x02: // ADC8 reg, reg/n
-            result = (op1 & 0xFF) + (op2 & 0xFF) + (f & FLAG_C);
-            op1 = (op1 & 0xFF00) | (result & 0xFF);
-            updateFlags8bit(result);
-            break;
-        case 0x03: // ADC16 reg, reg/nn
-            result = op1 + op2 + (f & FLAG_C);
-            bitShort = true;
-            op1 = result;
-            updateFlags8bit(result);
-            break;
-        case 0x04: // SUB8 reg, reg/n
-            result = (op1 & 0xFF) - (op2 & 0xFF);
-            op1 = (op1 & 0xFF00) | (result & 0xFF);
-            updateFlags8bit(result);
-            break;
-        case 0x05: // SUB16 reg, reg/nn
-            result = op1 - op2;
-            bitShort = true;
-            op1 = result;
-            updateFlags8bit(result);
-            break;
-        case 0x06: // SBC8 reg, reg/n
-            result = (op1 & 0xFF) - (op2 & 0xFF) - (f & FLAG_C);
-            op1 = (op1 & 0xFF00) | (result & 0xFF);
-            updateFlags8bit(result);
-            break;
-        case 0x07: // SBC16 reg, reg/nn
-            result = op1 - op2 - (f & FLAG_C);
-            bitShort = true;
-            op1 = result;
-            updateFlags8bit(result);
-            break;
-        case 0x08: // AND reg, reg/n
-            result = (op1 & 0xFF) & (op2 & 0xFF);
-            op1 = (op1 & 0xFF00) | (result & 0xFF);
-            updateFlags8bit(result);
-            f |= FLAG_H; // Always set the half-carry flag for AND operations
-            break;
-        case 0x09: // OR reg, reg/n
-            result = (op1 & 0xFF) | (op2 & 0xFF);
-            op1 = (op1 & 0xFF00) | (result & 0xFF);
-            updateFlags8bit(result);
-            break;
-        case 0x0A: // XOR reg, reg/n
-            result = (op1 & 0xFF) ^ (op2 & 0xFF);
-            op1 = (op1 & 0xFF00) | (result & 0xFF);
-            updateFlags8bit(result);
-            break;
-        case 0x0B: // CP reg, reg/n
-            result = (op1 & 0xFF) - (op2 & 0xFF);
-            isCompare = true;
-            updateFlags8bit(result);
-            break;
-        case 0x0C: // INC reg
-            result = (op1 & 0xFF) + 1;
-            op1 = (op1 & 0xFF00) | (result & 0xFF);
-            updateFlags8bit(result);
-            break;
-        case 0x0D: // DEC reg
-            result = (op1 & 0xFF) - 1;
-            op1 = (op1 & 0xFF00) | (result & 0xFF);
-            updateFlags8bit(result);
+// 8-bit ops only record what they did, the flags are worked out when something reads them, see materializeFlags()
+inline void Z80_Core::deferFlags(uint8_t kind, uint8_t op1, uint8_t op2, unsigned result) {
+    lazyFlags = kind;
+    lazyOp1 = op1;
+    lazyOp2 = op2;
+    lazyResult = result & 0x1FF;
+    if (eagerFlags) materializeFlags();
+}
+
+/*
+    8-bit ALU, one instantiation per ALU_* operation.
+    OP1 is the destination register, OP2 the source register/immediate (unused by
+    INC, DEC, rotates and bit ops). Returns the new value of the destination, CP and
+    BIT return OP1 unchanged.
+*/
+template<uint8_t OP> inline uint8_t Z80_Core::alu8(uint8_t op1, uint8_t op2) {
+    if constexpr (OP == ALU_ADD8 || OP == ALU_ADC8) {
+        unsigned result = op1 + op2 + (OP == ALU_ADC8 ? flagC() : 0);
+        deferFlags(LAZY_ADD, op1, op2, result);
+        return result;
+    } else if constexpr (OP == ALU_SUB8 || OP == ALU_SBC8 || OP == ALU_CP8) {
+        unsigned result = op1 - op2 - (OP == ALU_SBC8 ? flagC() : 0); // borrow ends up in bit 8
+        deferFlags(OP == ALU_CP8 ? LAZY_CP : LAZY_SUB, op1, op2, result);
+        return (OP == ALU_CP8) ? op1 : result;
+    } else if constexpr (OP == ALU_AND8) {
+        deferFlags(LAZY_AND, op1, op2, op1 & op2);
+        return op1 & op2;
+    } else if constexpr (OP == ALU_OR8) {
+        deferFlags(LAZY_LOGIC, op1, op2, op1 | op2);
+        return op1 | op2;
+    } else if constexpr (OP == ALU_XOR8) {
+        deferFlags(LAZY_LOGIC, op1, op2, op1 ^ op2);
+        return op1 ^ op2;
+    } else if constexpr (OP == ALU_INC8 || OP == ALU_DEC8) {
+        uint8_t result = (OP == ALU_INC8) ? op1 + 1 : op1 - 1;
+        deferFlags(OP == ALU_INC8 ? LAZY_INC : LAZY_DEC, op1, 0, result | (flagC() << 8)); // C is left alone
+        return result;
+    } else if constexpr (OP >= ALU_RLC8 && OP <= ALU_SRL8) {
+        materializeFlags();
+        uint8_t carry = (OP == ALU_RLC8 || OP == ALU_RL8 || OP == ALU_SLA8) ? op1 >> 7 : op1 & 0x01;
+        uint8_t result = 0;
+        if constexpr (OP == ALU_RLC8) result = (op1 << 1) | (op1 >> 7);
+        if constexpr (OP == ALU_RL8) result = (op1 << 1) | (f & FLAG_C);
+        if constexpr (OP == ALU_RRC8) result = (op1 >> 1) | (op1 << 7);
+        if constexpr (OP == ALU_RR8) result = (op1 >> 1) | ((f & FLAG_C) << 7);
+        if constexpr (OP == ALU_SLA8) result = op1 << 1;
+        if constexpr (OP == ALU_SRA8) result = (op1 >> 1) | (op1 & 0x80);
+        if constexpr (OP == ALU_SRL8) result = op1 >> 1;
+        f = flagTables.szp[result] | carry;
+        return result;
+    } else if constexpr (OP >= ALU_BIT0 && OP <= ALU_BIT7) {
+        materializeFlags();
+        uint8_t bit = op1 & (1 << (OP - ALU_BIT0));
+        f = (f & FLAG_C) | FLAG_H | (op1 & (FLAG_5 | FLAG_3)) | (bit ? (bit & FLAG_S) : (FLAG_Z | FLAG_P));
+        return op1;
+    } else if constexpr (OP >= ALU_RES0 && OP <= ALU_RES7) {
+        return op1 & ~(1 << (OP - ALU_RES0));
+    } else if constexpr (OP >= ALU_SET0 && OP <= ALU_SET7) {
+        return op1 | (1 << (OP - ALU_SET0));
+    } else {
+        static_assert(OP != OP, "not an 8-bit ALU operation");
+    }
+}
+
+// 16-bit ADD, ADC, SUB and SBC. Flags are set right away, H and P/V come from the high bytes. ADD only touches H, N and C
+template<uint8_t OP> inline uint16_t Z80_Core::alu16(uint16_t op1, uint16_t op2) {
+    static_assert(OP == ALU_ADD16 || OP == ALU_ADC16 || OP == ALU_SUB16 || OP == ALU_SBC16, "not a 16-bit ALU operation");
+    constexpr bool subtract = (OP == ALU_SUB16 || OP == ALU_SBC16);
+    int carry = (OP == ALU_ADC16 || OP == ALU_SBC16) ? flagC() : 0;
+    int result = subtract ? op1 - op2 - carry : op1 + op2 + carry;
+
+    materializeFlags();
+    uint8_t index = flagIndex(op1 >> 8, op2 >> 8, result >> 8);
+    uint8_t flags = (subtract ? halfcarrySub : halfcarryAdd)[index & 7] | ((result >> 8) & (FLAG_5 | FLAG_3)) | ((result >> 16) & FLAG_C);
+    if (subtract) flags |= FLAG_N;
+    if (OP == ALU_ADD16) {
+        flags |= f & (FLAG_S | FLAG_Z | FLAG_P);
+    } else {
+        flags |= (subtract ? overflowSub : overflowAdd)[index >> 4] | ((result >> 8) & FLAG_S) | ((result & 0xFFFF) ? 0 : FLAG_Z);
+    }
+    f = flags;
+    return result;
+}
+
+void Z80_Core::materializeFlags() {
+    uint8_t result = lazyResult & 0xFF;
+    uint8_t carry = (lazyResult >> 8) & FLAG_C;
+    uint8_t index = flagIndex(lazyOp1, lazyOp2, result);
+    switch (lazyFlags) {
+        case LAZY_NONE:
+            return;
+        case LAZY_ADD:
+            f = flagTables.sz[result] | halfcarryAdd[index & 7] | overflowAdd[index >> 4] | carry;
             break;
-        // Rotation and shifting
-        case 0x0E: // RLC reg
-        case 0x0F: // RL reg
-        case 0x10: // RRC reg
-        case 0x11: // RR reg
-        case 0x12: // SLA reg
-        case 0x13: // SRA reg
-        case 0x14: // SRL reg
-            op1 &= 0xFF; // clear upper 8 bits
-            carry_in = (f & FLAG_C);
-            switch (ins) {
-                case 0x0E: // RLC
-                    f = (op1 & 0x80) ? (f | FLAG_C) : (f & ~FLAG_C);
-                    op1 = (op1 << 1) | (op1 >> 7);
-                    break;
-                case 0x0F: // RL
-                    f = (op1 & 0x80) ? (f | FLAG_C) : (f & ~FLAG_C);
-                    op1 = (op1 << 1) | carry_in;
-                    break;
-                case 0x10: // RRC
-                    f = (op1 & 0x01) ? (f | FLAG_C) : (f & ~FLAG_C);
-                    op1 = (op1 >> 1) | (op1 << 7);
-                    break;
-                case 0x11: // RR
-                    f = (op1 & 0x01) ? (f | FLAG_C) : (f & ~FLAG_C);
-                    op1 = (op1 >> 1) | (carry_in << 7);
-                    break;
-                case 0x12: // SLA
-                    f = (op1 & 0x80) ? (f | FLAG_C) : (f & ~FLAG_C);
-                    op1 = (op1 << 1);
-                    break;
-                case 0x13: // SRA
-                    f = (op1 & 0x01) ? (f | FLAG_C) : (f & ~FLAG_C);
-                    op1 = (op1 >> 1) | (op1 & 0x80);
-                    break;
-                case 0x14: // SRL
-                    f = (op1 & 0x01) ? (f | FLAG_C) : (f & ~FLAG_C);
-                    op1 = (op1 >> 1);
-                    break;
-            }
-            f = (op1 == 0) ? (f | FLAG_Z) : (f & ~FLAG_Z); // Set zero flag
+        case LAZY_SUB:
+            f = flagTables.sz[result] | halfcarrySub[index & 7] | overflowSub[index >> 4] | FLAG_N | carry;
             break;
-
-        case 0x15: // BIT 0, reg
-        case 0x16: // BIT 1, reg
-        case 0x17: // BIT 2, reg
-        case 0x18: // BIT 3, reg
-        case 0x19: // BIT 4, reg
-        case 0x1A: // BIT 5, reg
-        case 0x1B: // BIT 6, reg
-        case 0x1C: // BIT 7, reg
-            f = (op1 & (1 << (ins - 0x15))) ? (f | FLAG_Z) : (f & ~FLAG_Z);
-            f |= FLAG_H;
+        case LAZY_CP:
+            f = (flagTables.sz[result] & ~(FLAG_5 | FLAG_3)) | (lazyOp2 & (FLAG_5 | FLAG_3));
+            f |= halfcarrySub[index & 7] | overflowSub[index >> 4] | FLAG_N | carry;
             break;
-
-        case 0x1D: // RES 0, reg
-        case 0x1E: // RES 1, reg
-        case 0x1F: // RES 2, reg
-        case 0x20: // RES 3, reg
-        case 0x21: // RES 4, reg
-        case 0x22: // RES 5, reg
-        case 0x23: // RES 6, reg
-        case 0x24: // RES 7, reg
-            op1 &= ~(1 << (ins - 0x20));
+        case LAZY_AND:
+            f = flagTables.szp[result] | FLAG_H;
             break;
-
-        case 0x25: // SET 0, reg
-        case 0x26: // SET 1, reg
-        case 0x27: // SET 2, reg
-        case 0x28: // SET 3, reg
-        case 0x29: // SET 4, reg
-        case 0x2A: // SET 5, reg
-        case 0x2B: // SET 6, reg
-        case 0x2C: // SET 7, reg
-            op1 |= (1 << (ins - 0x28));
+        case LAZY_LOGIC:
+            f = flagTables.szp[result];
             break;
-        
-        case 0x2D: // 16-bit INC reg
-            op1++;
+        case LAZY_INC:
+            f = flagTables.inc[result] | carry;
             break;
-        case 0x2E: // 16-bit DEC reg
-            op1--;
+        case LAZY_DEC:
+            f = flagTables.dec[result] | carry;
             break;
     }
+    lazyFlags = LAZY_NONE;
 }
 
+inline bool Z80_Core::flagZ() {
+    if (lazyFlags != LAZY_NONE) return (lazyResult & 0xFF) == 0;
+    return f & FLAG_Z;
+}
 
-uint8_t Z80_Core::fetchOperand() { // fetch operand
-    uint8_t operand = memory[pc];
-    pc++;
-    return operand;
+inline bool Z80_Core::flagC() {
+    if (lazyFlags != LAZY_NONE) return lazyResult & 0x100;
+    return f & FLAG_C;
 }
 
-void Z80_Core::fetchInstruction() {
-    ins = memory[pc];
-    pc++;
+inline bool Z80_Core::flagS() {
+    if (lazyFlags != LAZY_NONE) return lazyResult & 0x80;
+    return f & FLAG_S;
+}
 
-    //cout << "INS: " << ins << endl; // for debugging
+inline bool Z80_Core::flagP() {
+    materializeFlags(); // parity and overflow depend on the op
+    return f & FLAG_P;
 }
 
-void Z80_Core::swapRegs(uint8_t& temp1, uint8_t& temp2) {
-    uint8_t temp3 = temp1;
-    temp1 = temp2;
-    temp2 = temp3;
+
+uint8_t Z80_Core::fetchOperand() { // fetch operand
+    if (operandCursor) return *operandCursor++; // pre-decoded, pc already points past the instruction
+    uint8_t operand = memory.read(pc);
+    pc++;
+    return operand;
 }
 
-uint16_t Z80_Core::convToRegPair(uint8_t l, uint8_t h) {
-    return (uint16_t)l | (h << 8);
+inline void Z80_Core::writeMemory(uint16_t address, uint8_t value) {
+    memory.write(address, value);
+    if (codeMap[address >> 3] & (1 << (address & 7))) invalidateCode(address); // self-modifying code
 }
 
-void Z80_Core::incRegPair(uint8_t& l, uint8_t& h) {
-    if (l == 0xFF) {
-        l = 0;
-        h++;
-    } else {
-        l++;
+void Z80_Core::invalidateRange(uint16_t address, unsigned length) { // after a bulk store to [address, address + length)
+    for (unsigned at = address, end = address + length; at < end; at++) {
+        if ((at & 7) == 0 && end - at >= 8 && codeMap[at >> 3] == 0) { // no code in these 8 bytes
+            at += 7;
+            continue;
+        }
+        if (codeMap[at >> 3] & (1 << (at & 7))) invalidateCode(at);
     }
 }
 
-void Z80_Core::decRegPair(uint8_t& l, uint8_t& h) {
-    if (h == 0) {
-        l--;
-    } else {
-        h--;
-    }
+void Z80_Core::fetchInstruction() {
+    ins = memory.read(pc);
+    pc++;
+
+    //cout << "INS: " << ins << endl; // for debugging
 }
 
 void Z80_Core::push(uint16_t reg){
     //cout << "SP: " << hex << (unsigned)sp << endl;
     sp--;
-    memory[sp] = (reg >> 8); // high byte
+    writeMemory(sp, (reg >> 8)); // high byte
     sp--;
-    memory[sp] = reg & 0xFF; // low byte
+    writeMemory(sp, reg & 0xFF); // low byte
     //cout << "Pushed: " << hex << (unsigned)reg << endl;
 }
 
-void Z80_Core::push_reg_pair(uint8_t l, uint8_t h) {
-    push(convToRegPair(l, h));
-}
-
 uint16_t Z80_Core::pop() {
     //cout << "SP: " << hex << (unsigned)sp << endl;
-    uint16_t reg = memory[sp];
+    uint16_t reg = memory.read(sp);
     sp++;
-    reg |= memory[sp] << 8;
+    reg |= memory.read(sp) << 8;
     sp++;
     return reg;
 }
 
-void Z80_Core::pop_reg_pair(uint8_t& l, uint8_t& h) {
-    uint16_t reg = pop();
-    h = reg >> 8;
-    l = reg & 0xFF;
+/* UNPREFIXED INSTRUCTIONS */
+template<uint8_t OP> void Z80_Core::base_op() {
+    cout << "Invalid MAIN instruction: " << hex << (int)OP << endl;
+    invalidOpcode();
 }
 
-void Z80_Core::decode_execute(uint8_t instruction) {
-    int8_t raddr = 0; // relative address, used for relative jumps
-    uint16_t temp, temp2 = 0;
+template<> void Z80_Core::base_op<0x00>() { // NOP
+    nop_watchdog = (((pc - 1) & 0xFFFF) == nopEnd) ? nop_watchdog + 1 : 1;
+    nopEnd = pc;
     if (nop_watchdog > 10 && !disableWatchdog) { // prevent infinite loops, can be adjusted or disabled
-        cout << "Infinite loop detected at address: " << hex << pc << endl;
-        exit(0);
+        cout << "Infinite loop detected at address: " << hex << pc << dec << endl;
+        stop(STOP_INVALID);
     }
-    ExecutedInstructions.push_back(instruction);
-    if(DEBUG) cout << "PC: " << hex << (unsigned)pc << "  INS: " << (unsigned)instruction << " " << Opcodes[instruction] << endl;
-    switch (instruction) {
-        case 0x00: // NOP
-            if(ExecutedInstructions[pc-1] == 0x00) nop_watchdog++;
-            break;
-        case 0x01: // LD BC, nn
-            c = fetchOperand();
-            b = fetchOperand();
-            break;
-        case 0x02: // LD (BC), A
-            memory[c | (b << 8)] = a;
-            break;
-        case 0x03: // INC BC
-            if (c == 0xFF) {
-                c = 0;
-                b++;
-            } else {
-                c++;
-            }
-            break;
-        case 0x04: // INC B
-            alu((uint16_t&)b, (uint16_t&)w, ALU_INC8);
-            break;
-        case 0x05: // DEC B
-            alu((uint16_t&)b, 0, ALU_DEC8);
-            break;
-        case 0x06: // LD B, n
-            b = fetchOperand();
-            break;
-        case 0x07: // RLCA
-            alu((uint16_t&)a, (uint16_t&)f, ALU_RLC8);
-            break;
-        case 0x08: // EX AF, AF'
-            w = (uint8_t)(afa << 8);
-            swapRegs(a, w);
-            z = (uint8_t)(afa & 0xff);
-            swapRegs(f, z);
-            break;
-        case 0x09: // ADD HL, BC
-            temp = (uint16_t&)l | (h << 8);
-            temp2 = (uint16_t&)c | (b << 8);
-            alu(temp,temp2, ALU_ADC16);
-            l = temp & 0xFF;
-            h = temp >> 8;
-            break;
-        case 0x0A: // LD A, (BC)
-            a = memory[c | (b << 8)];
-            break;
-        case 0x0B: // DEC BC
-            if (b == 0) {
-                c--;
-            } else {
-                b--;
-            }
-            break;
-        case 0x0C: // INC C
-            alu((uint16_t&)c, (uint16_t&)w, ALU_INC8);
-            break;
-        case 0x0D: // DEC C
-            alu((uint16_t&)c, (uint16_t&)w, ALU_DEC8);
-            break;
-        case 0x0E: // LD C, n
-            c = fetchOperand();
-            break;
-        case 0x0F: // RRCA
-            alu((uint16_t&)a, (uint16_t&)f, ALU_RRC8);
-            break;
-        case 0x10: // DJNZ d
-            b--;
-            if (b != 0) {
-                pc = pc + fetchOperand();
-            }
-            break;
-        case 0x11: // LD DE, nn
-            e = fetchOperand();
-            d = fetchOperand();
-            break;
-        case 0x12: // LD (DE), A
-            memory[e | (d << 8)] = a;
-            break;
-        case 0x13: // INC DE
-            if (e == 0xFF) {
-                e = 0;
-                d++;
-            } else {
-                e++;
-            }
-            break;
-        case 0x14: // INC D
-            alu((uint16_t&)d, (uint16_t&)w, ALU_INC8);
-            break;
-        case 0x15: // DEC D
-            alu((uint16_t&)d, (uint16_t&)w, ALU_DEC8);
-            break;
-        case 0x16: // LD D, n
-            d = fetchOperand();
-            break;
-        case 0x17: // RLA
-            alu((uint16_t&)a, (uint16_t&)f, ALU_RL8);
-            break;
-        case 0x18: // JR n
-            raddr = (int8_t)fetchOperand();
-            pc = pc + raddr;
-            break;
-        case 0x19: // ADD HL, DE
-            temp = (uint16_t&)l | (h << 8);
-            temp2 = (uint16_t&)e | (d << 8);
-            alu(temp,temp2, ALU_ADC16);
-            l = temp & 0xFF;
-            h = temp >> 8;
-            break;
-        case 0x1A: // LD A, (DE)
-            a = memory[e | (d << 8)];
-            break;
-        case 0x1B: // DEC DE
-            if (d == 0) {
-                e--;
-            } else {
-                d--;
-            }
-            break;
-        case 0x1C: // INC E
-            alu((uint16_t&)e, (uint16_t&)w, ALU_INC8);
-            break;
-        case 0x1D: // DEC E
-            alu((uint16_t&)e, (uint16_t&)w, ALU_DEC8);
-            break;
-        case 0x1E: // LD E, n
-            e = fetchOperand();
-            break;
-        case 0x1F: // RRA
-            alu((uint16_t&)a, (uint16_t&)f, ALU_RR8);
-            break;
-        case 0x20: // JR NZ, n
-            raddr = (int8_t)fetchOperand();
-            if (!(f & FLAG_Z)){
-                pc = pc + raddr;
-            }
-            break;
-        case 0x21: // LD HL, nn
-            l = fetchOperand();
-            h = fetchOperand();
-            break;
-        case 0x22: // LD (nn), HL
-            w = fetchOperand(); // low byte
-            z = fetchOperand(); // high byte
-            memory[w | (z << 8)] = l;
-            memory[w | (z << 8) + 1] = h;
-            break;
-        case 0x23: // INC HL
-            if (l == 0xFF) {
-                l = 0;
-                h++;
-            } else {
-                l++;
-            }
-            break;
-        case 0x24: // INC H
-            alu((uint16_t&)h, (uint16_t&)w, ALU_INC8);
-            break;
-        case 0x25: // DEC H
-            alu((uint16_t&)h, (uint16_t&)w, ALU_DEC8);
-            break;
-        case 0x26: // LD H, n
-            h = fetchOperand();
-            break;
-        case 0x27: // DAA
-            //TODO
-            break;
-        case 0x28: // JR Z, n
-            raddr = (int8_t)fetchOperand();
-            if (f & FLAG_Z) {
-                pc = pc + raddr;
-            }
-            break;
-        case 0x29: // ADD HL, HL
-            temp = (uint16_t&)l | (h << 8);
-            temp2 = (uint16_t&)l | (h << 8);
-            alu(temp,temp2, ALU_ADC16);
-            l = temp & 0xFF;
-            h = temp >> 8;
-            break;
-        case 0x2A: // LD HL, (nn)
-            w = fetchOperand();
-            z = fetchOperand();
-            l = memory[w | (z << 8)];
-            h = memory[w | (z << 8) + 1];
-            break;
-        case 0x2B: // DEC HL
-            if (h == 0) {
-                l--;
-            } else {
-                h--;
-            }
-            break;
-        case 0x2C: // INC L
-            alu((uint16_t&)l, (uint16_t&)w, ALU_INC8);
-            break;
-        case 0x2D: // DEC L
-            alu((uint16_t&)l, (uint16_t&)w, ALU_DEC8);
-            break;
-        case 0x2E: // LD L, n
-            l = fetchOperand();
-            break;
-        case 0x2F: // CPL
-            a = ~a + 1;
-            f ^= (1 << 4) | (1 << 1);
-            break;
-        case 0x30: // JR NC, n
-            raddr = (int8_t)fetchOperand();
-            if (!(f & FLAG_C)) {
-                pc = pc + raddr;
-            }
-            break;
-        case 0x31: // LD SP, nn
-            sp = fetchOperand() | (fetchOperand() << 8);
-            break;
-        case 0x32: // LD (nn), A
-            memory[fetchOperand() | (fetchOperand() << 8)] = a;
-            break;
-        case 0x33: // INC SP
-            sp++;
-            break;
-        case 0x34: // INC (HL)
-            alu((uint16_t&)memory[l | (h << 8)], (uint16_t&)w, ALU_INC8);
-            //memory[l | (h << 8)]++;
-            break;
-        case 0x35: // DEC (HL)
-            alu((uint16_t&)memory[l | (h << 8)], (uint16_t&)w, ALU_DEC8);
-            //memory[l | (h << 8)]--;
-            break;
-        case 0x36: // LD (HL), n
-            memory[l | (h << 8)] = fetchOperand();
-            break;
-        case 0x37: // SCF
-            f |= 1;
-            break;
-        case 0x38: // JR C, n
-            raddr = (int8_t)fetchOperand();
-            if (f & FLAG_C) {
-                pc = pc + raddr;
-            }
-            break;
-        case 0x39: // ADD HL, SP
-            acc = (h << 8 | l) + sp;
-            if (acc > 65535) {
-                f |= 0x01;
-            }
-            h = acc >> 8;
-            l = acc & 0xff;
-            break;
-        case 0x3A: // LD A, (nn)
-            a = memory[fetchOperand() | (fetchOperand() << 8)];
-            break;
-        case 0x3B: // DEC SP
-            sp--;
-            break;
-        case 0x3C: // INC A
-            alu((uint16_t&)a, (uint16_t&)a, ALU_INC8);
-            break;
-        case 0x3D: // DEC A
-            alu((uint16_t&)a, (uint16_t&)a, ALU_DEC8);
-            break;
-        case 0x3E: // LD A, n
-            a = fetchOperand();
-            break;
-        case 0x3F: // CCF, invert carry flag
-            f |= !(f & FLAG_C);
-            break;
-        case 0x40: // LD B, B
-            b = b;
-            break;
-        case 0x41: // LD B, C
-            b = c;
-            break;
-        case 0x42: // LD B, D
-            b = d;
-            break;
-        case 0x43: // LD B, E
-            b = e;
-            break;
-        case 0x44: // LD B, H
-            b = h;
-            break;
-        case 0x45: // LD B, L
-            b = l;
-            break;
-        case 0x46: // LD B, (HL)
-            b = memory[l | (h << 8)];
-            break;
-        case 0x47: // LD B, A
-            b = a;
-            break;
-        case 0x48: // LD C, B
-            c = b;
-            break;
-        case 0x49: // LD C, C
-            c = c;
-            break;
-        case 0x4A: // LD C, D
-            c = d;
-            break;
-        case 0x4B: // LD C, E
-            c = e;
-            break;
-        case 0x4C: // LD C, H
-            c = h;
-            break;
-        case 0x4D: // LD C, L
-            c = l;
-            break;
-        case 0x4E: // LD C, (HL)
-            c = memory[l | (h << 8)];
-            break;
-        case 0x4F: // LD C, A
-            c = a;
-            break;
-        case 0x50: // LD D, B
-            d = b;
-            break;
-        case 0x51: // LD D, C
-            d = c;
-            break;
-        case 0x52: // LD D, D
-            d = d;
-            break;
-        case 0x53: // LD D, E
-            d = e;
-            break;
-        case 0x54: // LD D, H
-            d = h;
-            break;
-        case 0x55: // LD D, L
-            d = l;
-            break;
-        case 0x56: // LD D, (HL)
-            d = memory[l | (h << 8)];
-            break;
-        case 0x57: // LD D, A
-            d = a;
-            break;
-        case 0x58: // LD E, B
-            e = b;
-            break;
-        case 0x59: // LD E, C
-            e = c;
-            break;
-        case 0x5A: // LD E, D
-            e = d;
-            break;
-        case 0x5B: // LD E, E
-            e = e;
-            break;
-        case 0x5C: // LD E, H
-            e = h;
-            break;
-        case 0x5D: // LD E, L
-            e = l;
-            break;
-        case 0x5E: // LD E, (HL)
-            e = memory[l | (h << 8)];
-            break;
-        case 0x5F: // LD E, A
-            e = a;
-            break;
-        case 0x60: // LD H, B
-            h = b;
-            break;
-        case 0x61: // LD H, C
-            h = c;
-            break;
-        case 0x62: // LD H, D
-            h = d;
-            break;
-        case 0x63: // LD H, E
-            h = e;
-            break;
-        case 0x64: // LD H, H
-            h = h;
-            break;
-        case 0x65: // LD H, L
-            h = l;
-            break;
-        case 0x66: // LD H, (HL)
-            h = memory[l | (h << 8)];
-            break;
-        case 0x67: // LD H, A
-            h = a;
-            break;
-        case 0x68: // LD L, B
-            l = b;
-            break;
-        case 0x69: // LD L, C
-            l = c;
-            break;
-        case 0x6A: // LD L, D
-            l = d;
-            break;
-        case 0x6B: // LD L, E
-            l = e;
-            break;
-        case 0x6C: // LD L, H
-            l = h;
-            break;
-        case 0x6D: // LD L, L
-            l = l;
-            break;
-        case 0x6E: // LD L, (HL)
-            l = memory[l | (h << 8)];
-            break;
-        case 0x6F: // LD L, A
-            l = a;
-            break;
-        case 0x70: // LD (HL), B
-            memory[l | (h << 8)] = b;
-            break;
-        case 0x71: // LD (HL), C
-            memory[l | (h << 8)] = c;
-            break;
-        case 0x72: // LD (HL), D
-            memory[l | (h << 8)] = d;
-            break;
-        case 0x73: // LD (HL), E
-            memory[l | (h << 8)] = e;
-            break;
-        case 0x74: // LD (HL), H
-            memory[l | (h << 8)] = h;
-            break;
-        case 0x75: // LD (HL), L
-            memory[l | (h << 8)] = l;
-            break;
-        case 0x76: // HALT
-            halt = true;
-            break;
-        case 0x77: // LD (HL), A
-            memory[l | (h << 8)] = a;
-            break;
-        case 0x78: // LD A, B
-            a = b;
-            break;
-        case 0x79: // LD A, C
-            a = c;
-            break;
-        case 0x7A: // LD A, D
-            a = d;
-            break;
-        case 0x7B: // LD A, E
-            a = e;
-            break;
-        case 0x7C: // LD A, H
-            a = h;
-            break;
-        case 0x7D: // LD A, L
-            a = l;
-            break;
-        case 0x7E: // LD A, (HL)
-            a = memory[l | (h << 8)];
-            break;
-        case 0x7F: // LD A, A
-            a = a;
-            break;
-        case 0x80: // ADD A, B
-            alu((uint16_t&)a, (uint16_t&)b, ALU_ADD8);
-            break;
-        case 0x81: // ADD A, C
-            alu((uint16_t&)a, (uint16_t&)c, ALU_ADD8);
-            break;
-        case 0x82: // ADD A, D
-            alu((uint16_t&)a, (uint16_t&)d, ALU_ADD8);
-            break;
-        case 0x83: // ADD A, E
-            alu((uint16_t&)a, (uint16_t&)e, ALU_ADD8);
-            break;
-        case 0x84: // ADD A, H
-            alu((uint16_t&)a, (uint16_t&)h, ALU_ADD8);
-            break;
-        case 0x85: // ADD A, L
-            alu((uint16_t&)a, (uint16_t&)l, ALU_ADD8);
-            break;
-        case 0x86: // ADD A, (HL)
-            alu((uint16_t&)a, (uint16_t&)memory[l | (h << 8)], ALU_ADD8);
-            break;
-        case 0x87: // ADD A, A
-            alu((uint16_t&)a, (uint16_t&)a, ALU_ADD8);
-            break;
-        case 0x88: // ADC A, B
-            alu((uint16_t&)a, (uint16_t&)b, ALU_ADC8);
-            break;
-        case 0x89: // ADC A, C
-            alu((uint16_t&)a, (uint16_t&)c, ALU_ADC8);
-            break;
-        case 0x8A: // ADC A, D
-            alu((uint16_t&)a, (uint16_t&)d, ALU_ADC8);
-            break;
-        case 0x8B: // ADC A, E
-            alu((uint16_t&)a, (uint16_t&)e, ALU_ADC8);
-            break;
-        case 0x8C: // ADC A, H
-            alu((uint16_t&)a, (uint16_t&)h, ALU_ADC8);
-            break;
-        case 0x8D: // ADC A, L
-            alu((uint16_t&)a, (uint16_t&)l, ALU_ADC8);
-            break;
-        case 0x8E: // ADC A, (HL)
-            alu((uint16_t&)a, (uint16_t&)memory[l | (h << 8)], ALU_ADC8);
-            break;
-        case 0x8F: // ADC A, A
-            alu((uint16_t&)a, (uint16_t&)a, ALU_ADC8);
-            break;
-        case 0x90: // SUB B
-            alu((uint16_t&)a, (uint16_t&)b, ALU_SUB8);
-            break;
-        case 0x91: // SUB C
-            alu((uint16_t&)a, (uint16_t&)c, ALU_SUB8);
-            break;
-        case 0x92: // SUB D
-            alu((uint16_t&)a, (uint16_t&)d, ALU_SUB8);
-            break;
-        case 0x93: // SUB E
-            alu((uint16_t&)a, (uint16_t&)e, ALU_SUB8);
-            break;
-        case 0x94: // SUB H
-            alu((uint16_t&)a, (uint16_t&)h, ALU_SUB8);
-            break;
-        case 0x95: // SUB L
-            alu((uint16_t&)a, (uint16_t&)l, ALU_SUB8);
-            break;
-        case 0x96: // SUB (HL)
-            alu((uint16_t&)a, (uint16_t&)memory[l | (h << 8)], ALU_SUB8);
-            break;
-        case 0x97: // SUB A
-            alu((uint16_t&)a, (uint16_t&)a, ALU_SUB8);
-            break;
-        case 0x98: // SBC A, B
-            alu((uint16_t&)a, (uint16_t&)b, ALU_SBC8);
-            break;
-        case 0x99: // SBC A, C
-            alu((uint16_t&)a, (uint16_t&)c, ALU_SBC8);
-            break;
-        case 0x9A: // SBC A, D
-            alu((uint16_t&)a, (uint16_t&)d, ALU_SBC8);
-            break;
-        case 0x9B: // SBC A, E
-            alu((uint16_t&)a, (uint16_t&)e, ALU_SBC8);
-            break;
-        case 0x9C: // SBC A, H
-            alu((uint16_t&)a, (uint16_t&)h, ALU_SBC8);
-            break;
-        case 0x9D: // SBC A, L
-            alu((uint16_t&)a, (uint16_t&)l, ALU_SBC8);
-            break;
-        case 0x9E: // SBC A, (HL)
-            alu((uint16_t&)a, (uint16_t&)memory[l | (h << 8)], ALU_SBC8);
-            break;
-        case 0x9F: // SBC A, A
-            alu((uint16_t&)a, (uint16_t&)a, ALU_SBC8);
-            break;
-        case 0xA0: // AND B
-            alu((uint16_t&)a, (uint16_t&)b, ALU_AND8);
-            break;
-        case 0xA1: // AND C
-            alu((uint16_t&)a, (uint16_t&)c, ALU_AND8);
-            break;
-        case 0xA2: // AND D
-            alu((uint16_t&)a, (uint16_t&)d, ALU_AND8);
-            break;
-        case 0xA3: // AND E
-            alu((uint16_t&)a, (uint16_t&)e, ALU_AND8);
-            break;
-        case 0xA4: // AND H
-            alu((uint16_t&)a, (uint16_t&)h, ALU_AND8);
-            break;
-        case 0xA5: // AND L
-            alu((uint16_t&)a, (uint16_t&)l, ALU_AND8);
-            break;
-        case 0xA6: // AND (HL)
-            alu((uint16_t&)a, (uint16_t&)memory[l | (h << 8)], ALU_AND8);
-            break;
-        case 0xA7: // AND A
-            alu((uint16_t&)a, (uint16_t&)a, ALU_AND8);
-            break;
-        case 0xA8: // XOR B
-            alu((uint16_t&)a, (uint16_t&)b, ALU_XOR8);
-            break;
-        case 0xA9: // XOR C
-            alu((uint16_t&)a, (uint16_t&)c, ALU_XOR8);
-            break;
-        case 0xAA: // XOR D
-            alu((uint16_t&)a, (uint16_t&)d, ALU_XOR8);
-            break;
-        case 0xAB: // XOR E
-            alu((uint16_t&)a, (uint16_t&)e, ALU_XOR8);
-            break;
-        case 0xAC: // XOR H
-            alu((uint16_t&)a, (uint16_t&)h, ALU_XOR8);
-            break;
-        case 0xAD: // XOR L
-            alu((uint16_t&)a, (uint16_t&)l, ALU_XOR8);
-            break;
-        case 0xAE: // XOR (HL)
-            alu((uint16_t&)a, (uint16_t&)memory[l | (h << 8)], ALU_XOR8);
-            break;
-        case 0xAF: // XOR A
-            alu((uint16_t&)a, (uint16_t&)a, ALU_XOR8);
-            break;
-        case 0xB0: // OR B
-            alu((uint16_t&)a, (uint16_t&)b, ALU_OR8);
-            break;
-        case 0xB1: // OR C
-            alu((uint16_t&)a, (uint16_t&)c, ALU_OR8);
-            break;
-        case 0xB2: // OR D
-            alu((uint16_t&)a, (uint16_t&)d, ALU_OR8);
-            break;
-        case 0xB3: // OR E
-            alu((uint16_t&)a, (uint16_t&)e, ALU_OR8);
-            break;
-        case 0xB4: // OR H
-            alu((uint16_t&)a, (uint16_t&)h, ALU_OR8);
-            break;
-        case 0xB5: // OR L
-            alu((uint16_t&)a, (uint16_t&)l, ALU_OR8);
-            break;
-        case 0xB6: // OR (HL)
-            alu((uint16_t&)a, (uint16_t&)memory[l | (h << 8)], ALU_OR8);
-            break;
-        case 0xB7: // OR A
-            alu((uint16_t&)a, (uint16_t&)a, ALU_OR8);
-            break;
-        case 0xB8: // CP B
-            alu((uint16_t&)a, (uint16_t&)b, ALU_CP8);
-            break;
-        case 0xB9: // CP C
-            alu((uint16_t&)a, (uint16_t&)c, ALU_CP8);
-            break;
-        case 0xBA: // CP D
-            alu((uint16_t&)a, (uint16_t&)d, ALU_CP8);
-            break;
-        case 0xBB: // CP E
-            alu((uint16_t&)a, (uint16_t&)e, ALU_CP8);
-            break;
-        case 0xBC: // CP H
-            alu((uint16_t&)a, (uint16_t&)h, ALU_CP8);
-            break;
-        case 0xBD: // CP L
-            alu((uint16_t&)a, (uint16_t&)l, ALU_CP8);
-            break;
-        case 0xBE: // CP (HL)
-            alu((uint16_t&)a, (uint16_t&)memory[l | (h << 8)], ALU_CP8);
-            break;
-        case 0xBF: // CP A
-            alu((uint16_t&)a, (uint16_t&)a, ALU_CP8);
-            break;
-        case 0xC0: // RET NZ
-            if (!(f & FLAG_Z)) {
-                pc = pop();
-            }
-            //cout << "Returned PC by RET NZ: " << hex << (unsigned)pc << endl;
-            break;
-        case 0xC1: // POP BC
-            pop_reg_pair(c, b);
-            break;
-        case 0xC2: // JP NZ, nn
-            w = fetchOperand(); // low byte
-            z = fetchOperand(); // high byte
-            if (!(f & FLAG_Z)) {
-                pc = (w | (z << 8));
-            }
-            break;
-        case 0xC3: // JP nn
-            pc = (fetchOperand() | (fetchOperand() << 8));
-            break;
-        case 0xC4: // CALL NZ, nn
-            w = fetchOperand(); // low byte
-            z = fetchOperand(); // high byte
-            if (!(f & FLAG_Z)) {
-                push(pc);
-                pc = (w | (z << 8));
-            }
-            break;
-        case 0xC5: // PUSH BC
-            push_reg_pair(c, b);
-            break;
-        case 0xC6: // ADD A, n
-            w = fetchOperand();
-            alu((uint16_t&)a, (uint16_t&)w, ALU_ADD8);
-            break;
-        case 0xC7: // RST 00h
-            push(pc);
-            pc = 0x00;
-            break;
-        case 0xC8: // RET Z
-            if(f & FLAG_Z){
-                pc = pop();
-            }
-            break;
-        case 0xC9: // RET
-            //cout << "Stack:" << hex << (unsigned)memory[sp+1] << (unsigned)memory[sp] << endl;
-            pc = pop();
-            //cout << "Popped PC: " << hex << (unsigned)pc << endl;
-            break;
-        case 0xCA: // JP Z, nn
-            w = fetchOperand(); // low byte
-            z = fetchOperand(); // high byte
-            if(f & FLAG_Z){
-                pc = (w | (z << 8));
-            }
-            break;
-        case 0xCB: //BIT INSTRUCTION
-            w = fetchOperand();
-            ed_instruction(w);
-            break;
-        case 0xCC: // CALL Z, nn
-            w = fetchOperand(); // low byte
-            z = fetchOperand(); // high byte
-            if(f & FLAG_Z){
-                push(pc);
-                pc = (w | (z << 8));
-            }
-            break;
-        case 0xCD: // CALL nn
-            w = fetchOperand(); // low byte
-            z = fetchOperand(); // high byte
-            push(pc);
-            //cout << "Saving PC: " << hex << (unsigned)pc << endl;
-            //cout << "Saved PC: " << hex << (unsigned)memory[sp+1] << (unsigned)memory[sp] << endl;
-            pc = (w | (z << 8));
-            break;
-        case 0xCE: // ADC A, n
-            w = fetchOperand();
-            alu((uint16_t&)a, (uint16_t&)w, ALU_ADC8);
-            break;
-        case 0xCF: // RST 08h
-            push(pc);
-            pc = 0x08;
-            break;
-        case 0xD0: // RET NC
-            if(!(f & FLAG_C)){
-                pc = pop();
-            }
-            break;
-        case 0xD1: // POP DE
-            pop_reg_pair(e, d);
-            break;
-        case 0xD2: // JP NC, nn
-            w = fetchOperand(); // low byte
-            z = fetchOperand(); // high byte
-            if(!(f & FLAG_C)){
-                pc = (w | (z << 8));
-            }
-            break;
-        case 0xD3: // OUT (n), A
-            w = fetchOperand();
-            outputHandler(a,w);
-            break;
-        case 0xD4: // CALL NC, nn
-            w = fetchOperand(); // low byte
-            z = fetchOperand(); // high byte
-            if(!(f & FLAG_C)){
-                push(pc);
-                pc = (w | (z << 8));
-            }
-            break;
-        case 0xD5: // PUSH DE
-            push_reg_pair(e, d);
-            break;
-        case 0xD6: // SUB n
-            w = fetchOperand();
-            alu((uint16_t&)a, (uint16_t&)w, ALU_SUB8);
-            break;
-        case 0xD7: // RST 10h
-            push(pc);
-            pc = 0x10;
-            break;
-        case 0xD8: // RET C
-            if(f & FLAG_C){
-                pc = pop();
-            }
-            break;
-        case 0xD9: // EXX
-            w = (uint8_t)(bca >> 8);
-            swapRegs(b, w);
-            w = (uint8_t)(bca & 0xFF);
-            swapRegs(c, w);
-            w = (uint8_t)(dea >> 8);
-            swapRegs(d, w);
-            w = (uint8_t)(dea & 0xFF);
-            swapRegs(e, w);
-            w = (uint8_t)(hla >> 8);
-            swapRegs(h, w);
-            w = (uint8_t)(hla & 0xFF);
-            swapRegs(l, w);
-            break;
-        case 0xDA: // JP C, nn
-            w = fetchOperand(); // low byte
-            z = fetchOperand(); // high byte
-            if(f & FLAG_C){
-                pc = (w | (z << 8));
-            }
-            break;
-        case 0xDB: // IN A, (n)
-            w = fetchOperand();
-            a = inputHandler(w);
-            break;
-        case 0xDC: // CALL C, nn
-            w = fetchOperand(); // low byte
-            z = fetchOperand(); // high byte
-            if(f & FLAG_C){
-                push(pc);
-                pc = (w | (z << 8));
-            }
-            break;
-        case 0xDD: // IX PREFIX
-            w = fetchOperand();
-            dd_instruction(w);
-            break;
-        case 0xDE: // SBC A, n
-            w = fetchOperand();
-            alu((uint16_t&)a, (uint16_t&)w, ALU_SBC8);
-            break;
-        case 0xDF: // RST 18h
-            push(pc);
-            pc = 0x18;
-            break;
-        case 0xE0: // RET PO
-            if(!(f & 0x04)){
-                pc = pop();
-            }
-            break;
-        case 0xE1: // POP HL
-            pop_reg_pair(l, h);
-            break;
-        case 0xE2: // JP PO, nn
-            w = fetchOperand(); // low byte
-            z = fetchOperand(); // high byte
-            if(!(f & 0x04)){
-                pc = (w | (z << 8));
-            }
-            break;
-        case 0xE3: // EX (SP), HL
-            w = memory[sp];
-            memory[sp] = l;
-            l = w;
-            sp++;
-            z = memory[sp];
-            sp++;
-            memory[sp] = h;
-            h = z;
-            break;
-        case 0xE4: // CALL PO, nn
-            w = fetchOperand(); // low byte
-            z = fetchOperand(); // high byte
-            if(!(f & 0x04)){
-                push(pc);
-                pc = (w | (z << 8));
-            }
-            break;
-        case 0xE5: // PUSH HL
-            push_reg_pair(l,h);
-            break;
-        case 0xE6: // AND n
-            w = fetchOperand();
-            alu((uint16_t&)a, (uint16_t&)w, ALU_AND8);
-            break;
-        case 0xE7: // RST 20h
-            push(pc);
-            pc = 0x20;
-            break;
-        case 0xE8: // RET PE
-            if(!(f & 0x04)){
-                pc = pop();
-            }
-            break;
-        case 0xE9: // JP (HL)
-            pc = l | (h << 8);
-            break;
-        case 0xEA: // JP PE, nn
-            w = fetchOperand(); // low byte
-            z = fetchOperand(); // high byte
-            if(!(f & 0x04)){
-                pc = (w | (z << 8));
-            }
-            break;
-        case 0xEB: // EX DE, HL
-            w = (uint8_t)(dea >> 8);
-            swapRegs(d, w);
-            w = (uint8_t)(dea & 0xFF);
-            swapRegs (e, w);
-            w = (uint8_t)(hla >> 8);
-            swapRegs (h, w);
-            w = (uint8_t)(hla & 0xFF);
-            swapRegs (l, w);
-            break;
-        case 0xEC: // CALL PE, nn
-            w = fetchOperand(); // low byte
-            z = fetchOperand(); // high byte
-            if((f & 0x04)){
-                push(pc);
-                pc = (w | (z << 8));
-            }
-            break;
-        case 0xED: // ED PREFIX
-            w = fetchOperand();
-            ed_instruction(w); // call ed instruction
-            break;
-        case 0xEE: // XOR n
-            w = fetchOperand();
-            alu((uint16_t&)a, (uint16_t&)w, ALU_XOR8);
-            break;
-        case 0xEF: // RST 28h
-            push(pc);
-            pc = 0x28;
-            break;
-        case 0xF0: // RET P
-            if(!(f & 0x80)){
-                pc = pop();
-            }
-            break;
-        case 0xF1: // POP AF
-            pop_reg_pair(f, a);
-            break;
-        case 0xF2: // JP P, nn
-            w = fetchOperand(); // low byte
-            z = fetchOperand(); // high byte
-            if(!(f & 0x80)){
-                pc = (w | (z << 8));
-            }
-            break;
-        case 0xF3: // DI
-            iff1 = iff2 = false;
-            break;
-        case 0xF4: // CALL P, nn
-            w = fetchOperand(); // low byte
-            z = fetchOperand(); // high byte
-            if(!(f & 0x80)){
-                push(pc);
-                pc = (w | (z << 8));
-            }
-            break;
-        case 0xF5: // PUSH AF
-            push_reg_pair(f, a);
-            break;
-        case 0xF6: // OR n
-            w = fetchOperand();
-            alu((uint16_t&)a, (uint16_t&)w, ALU_OR8);
-            break;
-        case 0xF7: // RST 30h
-            push(pc);
-            pc = 0x30;
-            break;
-        case 0xF8: // RET M
-            if(!(f & 0x80)){
-                pc = pop();
-            }
-            break;
-        case 0xF9: // LD SP, HL
-            sp = l | (h << 8);
-            break;
-        case 0xFA: // JP M, nn
-            w = fetchOperand(); // low byte
-            z = fetchOperand(); // high byte
-            if((f & 0x80)){
-                pc = (w | (z << 8));
-            }
-            break;
-        case 0xFB: // EI
-            iff1 = iff2 = 1;
-            break;
-        case 0xFC: // CALL M, nn
-            w = fetchOperand(); // low byte
-            z = fetchOperand(); // high byte
-            if((f & 0x80)){
-                push(pc);
-                pc = (w | (z << 8));
-            }
-            break;
-        case 0xFD: // IY PREFIX
-            w = fetchOperand();
-            fd_instruction(w);
-            break;
-        case 0xFE: // CP n
-            w = fetchOperand();
-            alu((uint16_t&)a, (uint16_t&)w, ALU_CP8);
-            break;
-        case 0xFF: // RST 38h
-            push(pc);
-            pc = 0x38;
-            break;
-        default:
-            cout << "Invalid MAIN instruction: " << hex << (int)ins << endl;
-            break;
+}
+
+template<> void Z80_Core::base_op<0x01>() { // LD BC, nn
+    c = fetchOperand();
+    b = fetchOperand();
+}
+
+template<> void Z80_Core::base_op<0x02>() { // LD (BC), A
+    writeMemory(bc, a);
+}
+
+template<> void Z80_Core::base_op<0x03>() { // INC BC
+    bc++;
+}
+
+template<> void Z80_Core::base_op<0x04>() { // INC B
+    b = alu8<ALU_INC8>(b);
+}
+
+template<> void Z80_Core::base_op<0x05>() { // DEC B
+    b = alu8<ALU_DEC8>(b);
+}
+
+template<> void Z80_Core::base_op<0x06>() { // LD B, n
+    b = fetchOperand();
+}
+
+template<> void Z80_Core::base_op<0x07>() { // RLCA
+    materializeFlags();
+    uint8_t kept = f & (FLAG_S | FLAG_Z | FLAG_P); // the accumulator rotates leave S, Z and P/V alone
+    a = alu8<ALU_RLC8>(a);
+    f = (f & (FLAG_5 | FLAG_3 | FLAG_C)) | kept;
+}
+
+template<> void Z80_Core::base_op<0x08>() { // EX AF, AF'
+    materializeFlags();
+    swap(af, afa);
+}
+
+template<> void Z80_Core::base_op<0x09>() { // ADD HL, BC
+    hl = alu16<ALU_ADD16>(hl, bc);
+}
+
+template<> void Z80_Core::base_op<0x0A>() { // LD A, (BC)
+    a = memory.read(bc);
+}
+
+template<> void Z80_Core::base_op<0x0B>() { // DEC BC
+    bc--;
+}
+
+template<> void Z80_Core::base_op<0x0C>() { // INC C
+    c = alu8<ALU_INC8>(c);
+}
+
+template<> void Z80_Core::base_op<0x0D>() { // DEC C
+    c = alu8<ALU_DEC8>(c);
+}
+
+template<> void Z80_Core::base_op<0x0E>() { // LD C, n
+    c = fetchOperand();
+}
+
+template<> void Z80_Core::base_op<0x0F>() { // RRCA
+    materializeFlags();
+    uint8_t kept = f & (FLAG_S | FLAG_Z | FLAG_P); // the accumulator rotates leave S, Z and P/V alone
+    a = alu8<ALU_RRC8>(a);
+    f = (f & (FLAG_5 | FLAG_3 | FLAG_C)) | kept;
+}
+
+template<> void Z80_Core::base_op<0x10>() { // DJNZ d
+    int8_t raddr; // relative address, used for relative jumps
+    raddr = (int8_t)fetchOperand();
+    b--;
+    if (b != 0) {
+        cycles += CYCLES_DJNZ_TAKEN;
+        pc = pc + raddr;
+    }
+}
+
+template<> void Z80_Core::base_op<0x11>() { // LD DE, nn
+    e = fetchOperand();
+    d = fetchOperand();
+}
+
+template<> void Z80_Core::base_op<0x12>() { // LD (DE), A
+    writeMemory(de, a);
+}
+
+template<> void Z80_Core::base_op<0x13>() { // INC DE
+    de++;
+}
+
+template<> void Z80_Core::base_op<0x14>() { // INC D
+    d = alu8<ALU_INC8>(d);
+}
+
+template<> void Z80_Core::base_op<0x15>() { // DEC D
+    d = alu8<ALU_DEC8>(d);
+}
+
+template<> void Z80_Core::base_op<0x16>() { // LD D, n
+    d = fetchOperand();
+}
+
+template<> void Z80_Core::base_op<0x17>() { // RLA
+    materializeFlags();
+    uint8_t kept = f & (FLAG_S | FLAG_Z | FLAG_P); // the accumulator rotates leave S, Z and P/V alone
+    a = alu8<ALU_RL8>(a);
+    f = (f & (FLAG_5 | FLAG_3 | FLAG_C)) | kept;
+}
+
+template<> void Z80_Core::base_op<0x18>() { // JR n
+    int8_t raddr; // relative address, used for relative jumps
+    raddr = (int8_t)fetchOperand();
+    pc = pc + raddr;
+}
+
+template<> void Z80_Core::base_op<0x19>() { // ADD HL, DE
+    hl = alu16<ALU_ADD16>(hl, de);
+}
+
+template<> void Z80_Core::base_op<0x1A>() { // LD A, (DE)
+    a = memory.read(de);
+}
+
+template<> void Z80_Core::base_op<0x1B>() { // DEC DE
+    de--;
+}
+
+template<> void Z80_Core::base_op<0x1C>() { // INC E
+    e = alu8<ALU_INC8>(e);
+}
+
+template<> void Z80_Core::base_op<0x1D>() { // DEC E
+    e = alu8<ALU_DEC8>(e);
+}
+
+template<> void Z80_Core::base_op<0x1E>() { // LD E, n
+    e = fetchOperand();
+}
+
+template<> void Z80_Core::base_op<0x1F>() { // RRA
+    materializeFlags();
+    uint8_t kept = f & (FLAG_S | FLAG_Z | FLAG_P); // the accumulator rotates leave S, Z and P/V alone
+    a = alu8<ALU_RR8>(a);
+    f = (f & (FLAG_5 | FLAG_3 | FLAG_C)) | kept;
+}
+
+template<> void Z80_Core::base_op<0x20>() { // JR NZ, n
+    int8_t raddr; // relative address, used for relative jumps
+    raddr = (int8_t)fetchOperand();
+    if (!flagZ()){
+        cycles += CYCLES_JR_TAKEN;
+        pc = pc + raddr;
+    }
+}
+
+template<> void Z80_Core::base_op<0x21>() { // LD HL, nn
+    l = fetchOperand();
+    h = fetchOperand();
+}
+
+template<> void Z80_Core::base_op<0x22>() { // LD (nn), HL
+    w = fetchOperand(); // low byte
+    z = fetchOperand(); // high byte
+    writeMemory(w | (z << 8), l);
+    writeMemory((w | (z << 8)) + 1, h);
+}
+
+template<> void Z80_Core::base_op<0x23>() { // INC HL
+    hl++;
+}
+
+template<> void Z80_Core::base_op<0x24>() { // INC H
+    h = alu8<ALU_INC8>(h);
+}
+
+template<> void Z80_Core::base_op<0x25>() { // DEC H
+    h = alu8<ALU_DEC8>(h);
+}
+
+template<> void Z80_Core::base_op<0x26>() { // LD H, n
+    h = fetchOperand();
+}
+
+template<> void Z80_Core::base_op<0x27>() { // DAA
+    materializeFlags();
+    af = flagTables.daa[a | ((f & FLAG_C) << 8) | ((f & FLAG_H) << 5) | ((f & FLAG_N) << 9)];
+}
+
+template<> void Z80_Core::base_op<0x28>() { // JR Z, n
+    int8_t raddr; // relative address, used for relative jumps
+    raddr = (int8_t)fetchOperand();
+    if (flagZ()) {
+        cycles += CYCLES_JR_TAKEN;
+        pc = pc + raddr;
+    }
+}
+
+template<> void Z80_Core::base_op<0x29>() { // ADD HL, HL
+    hl = alu16<ALU_ADD16>(hl, hl);
+}
+
+template<> void Z80_Core::base_op<0x2A>() { // LD HL, (nn)
+    w = fetchOperand();
+    z = fetchOperand();
+    hl = memory.read(w | (z << 8)) | (memory.read((w | (z << 8)) + 1) << 8);
+}
+
+template<> void Z80_Core::base_op<0x2B>() { // DEC HL
+    hl--;
+}
+
+template<> void Z80_Core::base_op<0x2C>() { // INC L
+    l = alu8<ALU_INC8>(l);
+}
+
+template<> void Z80_Core::base_op<0x2D>() { // DEC L
+    l = alu8<ALU_DEC8>(l);
+}
+
+template<> void Z80_Core::base_op<0x2E>() { // LD L, n
+    l = fetchOperand();
+}
+
+template<> void Z80_Core::base_op<0x2F>() { // CPL
+    a = ~a;
+    materializeFlags();
+    f = (f & (FLAG_S | FLAG_Z | FLAG_P | FLAG_C)) | (a & (FLAG_5 | FLAG_3)) | FLAG_H | FLAG_N;
+}
+
+template<> void Z80_Core::base_op<0x30>() { // JR NC, n
+    int8_t raddr; // relative address, used for relative jumps
+    raddr = (int8_t)fetchOperand();
+    if (!flagC()) {
+        cycles += CYCLES_JR_TAKEN;
+        pc = pc + raddr;
+    }
+}
+
+template<> void Z80_Core::base_op<0x31>() { // LD SP, nn
+    w = fetchOperand(); // low byte
+    z = fetchOperand(); // high byte
+    sp = w | (z << 8);
+}
+
+template<> void Z80_Core::base_op<0x32>() { // LD (nn), A
+    w = fetchOperand(); // low byte
+    z = fetchOperand(); // high byte
+    writeMemory(w | (z << 8), a);
+}
+
+template<> void Z80_Core::base_op<0x33>() { // INC SP
+    sp++;
+}
+
+template<> void Z80_Core::base_op<0x34>() { // INC (HL)
+    writeMemory(hl, alu8<ALU_INC8>(memory.read(hl)));
+    //memory.read(hl)++;
+}
+
+template<> void Z80_Core::base_op<0x35>() { // DEC (HL)
+    writeMemory(hl, alu8<ALU_DEC8>(memory.read(hl)));
+    //memory.read(hl)--;
+}
+
+template<> void Z80_Core::base_op<0x36>() { // LD (HL), n
+    writeMemory(hl, fetchOperand());
+}
+
+template<> void Z80_Core::base_op<0x37>() { // SCF
+    materializeFlags();
+    f = (f & (FLAG_S | FLAG_Z | FLAG_P)) | (a & (FLAG_5 | FLAG_3)) | FLAG_C;
+}
+
+template<> void Z80_Core::base_op<0x38>() { // JR C, n
+    int8_t raddr; // relative address, used for relative jumps
+    raddr = (int8_t)fetchOperand();
+    if (flagC()) {
+        cycles += CYCLES_JR_TAKEN;
+        pc = pc + raddr;
+    }
+}
+
+template<> void Z80_Core::base_op<0x39>() { // ADD HL, SP
+    hl = alu16<ALU_ADD16>(hl, sp);
+}
+
+template<> void Z80_Core::base_op<0x3A>() { // LD A, (nn)
+    w = fetchOperand(); // low byte
+    z = fetchOperand(); // high byte
+    a = memory.read(w | (z << 8));
+}
+
+template<> void Z80_Core::base_op<0x3B>() { // DEC SP
+    sp--;
+}
+
+template<> void Z80_Core::base_op<0x3C>() { // INC A
+    a = alu8<ALU_INC8>(a);
+}
+
+template<> void Z80_Core::base_op<0x3D>() { // DEC A
+    a = alu8<ALU_DEC8>(a);
+}
+
+template<> void Z80_Core::base_op<0x3E>() { // LD A, n
+    a = fetchOperand();
+}
+
+template<> void Z80_Core::base_op<0x3F>() { // CCF, invert carry flag
+    materializeFlags();
+    f = ((f & (FLAG_S | FLAG_Z | FLAG_P | FLAG_C)) | (a & (FLAG_5 | FLAG_3)) | ((f & FLAG_C) << 4)) ^ FLAG_C; // H is the old carry
+}
+
+template<> void Z80_Core::base_op<0x40>() { // LD B, B
+    b = b;
+}
+
+template<> void Z80_Core::base_op<0x41>() { // LD B, C
+    b = c;
+}
+
+template<> void Z80_Core::base_op<0x42>() { // LD B, D
+    b = d;
+}
+
+template<> void Z80_Core::base_op<0x43>() { // LD B, E
+    b = e;
+}
+
+template<> void Z80_Core::base_op<0x44>() { // LD B, H
+    b = h;
+}
+
+template<> void Z80_Core::base_op<0x45>() { // LD B, L
+    b = l;
+}
+
+template<> void Z80_Core::base_op<0x46>() { // LD B, (HL)
+    b = memory.read(hl);
+}
+
+template<> void Z80_Core::base_op<0x47>() { // LD B, A
+    b = a;
+}
+
+template<> void Z80_Core::base_op<0x48>() { // LD C, B
+    c = b;
+}
+
+template<> void Z80_Core::base_op<0x49>() { // LD C, C
+    c = c;
+}
+
+template<> void Z80_Core::base_op<0x4A>() { // LD C, D
+    c = d;
+}
+
+template<> void Z80_Core::base_op<0x4B>() { // LD C, E
+    c = e;
+}
+
+template<> void Z80_Core::base_op<0x4C>() { // LD C, H
+    c = h;
+}
+
+template<> void Z80_Core::base_op<0x4D>() { // LD C, L
+    c = l;
+}
+
+template<> void Z80_Core::base_op<0x4E>() { // LD C, (HL)
+    c = memory.read(hl);
+}
+
+template<> void Z80_Core::base_op<0x4F>() { // LD C, A
+    c = a;
+}
+
+template<> void Z80_Core::base_op<0x50>() { // LD D, B
+    d = b;
+}
+
+template<> void Z80_Core::base_op<0x51>() { // LD D, C
+    d = c;
+}
+
+template<> void Z80_Core::base_op<0x52>() { // LD D, D
+    d = d;
+}
+
+template<> void Z80_Core::base_op<0x53>() { // LD D, E
+    d = e;
+}
+
+template<> void Z80_Core::base_op<0x54>() { // LD D, H
+    d = h;
+}
+
+template<> void Z80_Core::base_op<0x55>() { // LD D, L
+    d = l;
+}
+
+template<> void Z80_Core::base_op<0x56>() { // LD D, (HL)
+    d = memory.read(hl);
+}
+
+template<> void Z80_Core::base_op<0x57>() { // LD D, A
+    d = a;
+}
+
+template<> void Z80_Core::base_op<0x58>() { // LD E, B
+    e = b;
+}
+
+template<> void Z80_Core::base_op<0x59>() { // LD E, C
+    e = c;
+}
+
+template<> void Z80_Core::base_op<0x5A>() { // LD E, D
+    e = d;
+}
+
+template<> void Z80_Core::base_op<0x5B>() { // LD E, E
+    e = e;
+}
+
+template<> void Z80_Core::base_op<0x5C>() { // LD E, H
+    e = h;
+}
+
+template<> void Z80_Core::base_op<0x5D>() { // LD E, L
+    e = l;
+}
+
+template<> void Z80_Core::base_op<0x5E>() { // LD E, (HL)
+    e = memory.read(hl);
+}
+
+template<> void Z80_Core::base_op<0x5F>() { // LD E, A
+    e = a;
+}
+
+template<> void Z80_Core::base_op<0x60>() { // LD H, B
+    h = b;
+}
+
+template<> void Z80_Core::base_op<0x61>() { // LD H, C
+    h = c;
+}
+
+template<> void Z80_Core::base_op<0x62>() { // LD H, D
+    h = d;
+}
+
+template<> void Z80_Core::base_op<0x63>() { // LD H, E
+    h = e;
+}
+
+template<> void Z80_Core::base_op<0x64>() { // LD H, H
+    h = h;
+}
+
+template<> void Z80_Core::base_op<0x65>() { // LD H, L
+    h = l;
+}
+
+template<> void Z80_Core::base_op<0x66>() { // LD H, (HL)
+    h = memory.read(hl);
+}
+
+template<> void Z80_Core::base_op<0x67>() { // LD H, A
+    h = a;
+}
+
+template<> void Z80_Core::base_op<0x68>() { // LD L, B
+    l = b;
+}
+
+template<> void Z80_Core::base_op<0x69>() { // LD L, C
+    l = c;
+}
+
+template<> void Z80_Core::base_op<0x6A>() { // LD L, D
+    l = d;
+}
+
+template<> void Z80_Core::base_op<0x6B>() { // LD L, E
+    l = e;
+}
+
+template<> void Z80_Core::base_op<0x6C>() { // LD L, H
+    l = h;
+}
+
+template<> void Z80_Core::base_op<0x6D>() { // LD L, L
+    l = l;
+}
+
+template<> void Z80_Core::base_op<0x6E>() { // LD L, (HL)
+    l = memory.read(hl);
+}
+
+template<> void Z80_Core::base_op<0x6F>() { // LD L, A
+    l = a;
+}
+
+template<> void Z80_Core::base_op<0x70>() { // LD (HL), B
+    writeMemory(hl, b);
+}
+
+template<> void Z80_Core::base_op<0x71>() { // LD (HL), C
+    writeMemory(hl, c);
+}
+
+template<> void Z80_Core::base_op<0x72>() { // LD (HL), D
+    writeMemory(hl, d);
+}
+
+template<> void Z80_Core::base_op<0x73>() { // LD (HL), E
+    writeMemory(hl, e);
+}
+
+template<> void Z80_Core::base_op<0x74>() { // LD (HL), H
+    writeMemory(hl, h);
+}
+
+template<> void Z80_Core::base_op<0x75>() { // LD (HL), L
+    writeMemory(hl, l);
+}
+
+template<> void Z80_Core::base_op<0x76>() { // HALT
+    if (!interruptible()) { // nothing can wake the CPU up anymore, the program is done
+        stop(STOP_HALT);
+        return;
+    }
+    idle();
+}
+
+template<> void Z80_Core::base_op<0x77>() { // LD (HL), A
+    writeMemory(hl, a);
+}
+
+template<> void Z80_Core::base_op<0x78>() { // LD A, B
+    a = b;
+}
+
+template<> void Z80_Core::base_op<0x79>() { // LD A, C
+    a = c;
+}
+
+template<> void Z80_Core::base_op<0x7A>() { // LD A, D
+    a = d;
+}
+
+template<> void Z80_Core::base_op<0x7B>() { // LD A, E
+    a = e;
+}
+
+template<> void Z80_Core::base_op<0x7C>() { // LD A, H
+    a = h;
+}
+
+template<> void Z80_Core::base_op<0x7D>() { // LD A, L
+    a = l;
+}
+
+template<> void Z80_Core::base_op<0x7E>() { // LD A, (HL)
+    a = memory.read(hl);
+}
+
+template<> void Z80_Core::base_op<0x7F>() { // LD A, A
+    a = a;
+}
+
+template<> void Z80_Core::base_op<0x80>() { // ADD A, B
+    a = alu8<ALU_ADD8>(a, b);
+}
+
+template<> void Z80_Core::base_op<0x81>() { // ADD A, C
+    a = alu8<ALU_ADD8>(a, c);
+}
+
+template<> void Z80_Core::base_op<0x82>() { // ADD A, D
+    a = alu8<ALU_ADD8>(a, d);
+}
+
+template<> void Z80_Core::base_op<0x83>() { // ADD A, E
+    a = alu8<ALU_ADD8>(a, e);
+}
+
+template<> void Z80_Core::base_op<0x84>() { // ADD A, H
+    a = alu8<ALU_ADD8>(a, h);
+}
+
+template<> void Z80_Core::base_op<0x85>() { // ADD A, L
+    a = alu8<ALU_ADD8>(a, l);
+}
+
+template<> void Z80_Core::base_op<0x86>() { // ADD A, (HL)
+    a = alu8<ALU_ADD8>(a, memory.read(hl));
+}
+
+template<> void Z80_Core::base_op<0x87>() { // ADD A, A
+    a = alu8<ALU_ADD8>(a, a);
+}
+
+template<> void Z80_Core::base_op<0x88>() { // ADC A, B
+    a = alu8<ALU_ADC8>(a, b);
+}
+
+template<> void Z80_Core::base_op<0x89>() { // ADC A, C
+    a = alu8<ALU_ADC8>(a, c);
+}
+
+template<> void Z80_Core::base_op<0x8A>() { // ADC A, D
+    a = alu8<ALU_ADC8>(a, d);
+}
+
+template<> void Z80_Core::base_op<0x8B>() { // ADC A, E
+    a = alu8<ALU_ADC8>(a, e);
+}
+
+template<> void Z80_Core::base_op<0x8C>() { // ADC A, H
+    a = alu8<ALU_ADC8>(a, h);
+}
+
+template<> void Z80_Core::base_op<0x8D>() { // ADC A, L
+    a = alu8<ALU_ADC8>(a, l);
+}
+
+template<> void Z80_Core::base_op<0x8E>() { // ADC A, (HL)
+    a = alu8<ALU_ADC8>(a, memory.read(hl));
+}
+
+template<> void Z80_Core::base_op<0x8F>() { // ADC A, A
+    a = alu8<ALU_ADC8>(a, a);
+}
+
+template<> void Z80_Core::base_op<0x90>() { // SUB B
+    a = alu8<ALU_SUB8>(a, b);
+}
+
+template<> void Z80_Core::base_op<0x91>() { // SUB C
+    a = alu8<ALU_SUB8>(a, c);
+}
+
+template<> void Z80_Core::base_op<0x92>() { // SUB D
+    a = alu8<ALU_SUB8>(a, d);
+}
+
+template<> void Z80_Core::base_op<0x93>() { // SUB E
+    a = alu8<ALU_SUB8>(a, e);
+}
+
+template<> void Z80_Core::base_op<0x94>() { // SUB H
+    a = alu8<ALU_SUB8>(a, h);
+}
+
+template<> void Z80_Core::base_op<0x95>() { // SUB L
+    a = alu8<ALU_SUB8>(a, l);
+}
+
+template<> void Z80_Core::base_op<0x96>() { // SUB (HL)
+    a = alu8<ALU_SUB8>(a, memory.read(hl));
+}
+
+template<> void Z80_Core::base_op<0x97>() { // SUB A
+    a = alu8<ALU_SUB8>(a, a);
+}
+
+template<> void Z80_Core::base_op<0x98>() { // SBC A, B
+    a = alu8<ALU_SBC8>(a, b);
+}
+
+template<> void Z80_Core::base_op<0x99>() { // SBC A, C
+    a = alu8<ALU_SBC8>(a, c);
+}
+
+template<> void Z80_Core::base_op<0x9A>() { // SBC A, D
+    a = alu8<ALU_SBC8>(a, d);
+}
+
+template<> void Z80_Core::base_op<0x9B>() { // SBC A, E
+    a = alu8<ALU_SBC8>(a, e);
+}
+
+template<> void Z80_Core::base_op<0x9C>() { // SBC A, H
+    a = alu8<ALU_SBC8>(a, h);
+}
+
+template<> void Z80_Core::base_op<0x9D>() { // SBC A, L
+    a = alu8<ALU_SBC8>(a, l);
+}
+
+template<> void Z80_Core::base_op<0x9E>() { // SBC A, (HL)
+    a = alu8<ALU_SBC8>(a, memory.read(hl));
+}
+
+template<> void Z80_Core::base_op<0x9F>() { // SBC A, A
+    a = alu8<ALU_SBC8>(a, a);
+}
+
+template<> void Z80_Core::base_op<0xA0>() { // AND B
+    a = alu8<ALU_AND8>(a, b);
+}
+
+template<> void Z80_Core::base_op<0xA1>() { // AND C
+    a = alu8<ALU_AND8>(a, c);
+}
+
+template<> void Z80_Core::base_op<0xA2>() { // AND D
+    a = alu8<ALU_AND8>(a, d);
+}
+
+template<> void Z80_Core::base_op<0xA3>() { // AND E
+    a = alu8<ALU_AND8>(a, e);
+}
+
+template<> void Z80_Core::base_op<0xA4>() { // AND H
+    a = alu8<ALU_AND8>(a, h);
+}
+
+template<> void Z80_Core::base_op<0xA5>() { // AND L
+    a = alu8<ALU_AND8>(a, l);
+}
+
+template<> void Z80_Core::base_op<0xA6>() { // AND (HL)
+    a = alu8<ALU_AND8>(a, memory.read(hl));
+}
+
+template<> void Z80_Core::base_op<0xA7>() { // AND A
+    a = alu8<ALU_AND8>(a, a);
+}
+
+template<> void Z80_Core::base_op<0xA8>() { // XOR B
+    a = alu8<ALU_XOR8>(a, b);
+}
+
+template<> void Z80_Core::base_op<0xA9>() { // XOR C
+    a = alu8<ALU_XOR8>(a, c);
+}
+
+template<> void Z80_Core::base_op<0xAA>() { // XOR D
+    a = alu8<ALU_XOR8>(a, d);
+}
+
+template<> void Z80_Core::base_op<0xAB>() { // XOR E
+    a = alu8<ALU_XOR8>(a, e);
+}
+
+template<> void Z80_Core::base_op<0xAC>() { // XOR H
+    a = alu8<ALU_XOR8>(a, h);
+}
+
+template<> void Z80_Core::base_op<0xAD>() { // XOR L
+    a = alu8<ALU_XOR8>(a, l);
+}
+
+template<> void Z80_Core::base_op<0xAE>() { // XOR (HL)
+    a = alu8<ALU_XOR8>(a, memory.read(hl));
+}
+
+template<> void Z80_Core::base_op<0xAF>() { // XOR A
+    a = alu8<ALU_XOR8>(a, a);
+}
+
+template<> void Z80_Core::base_op<0xB0>() { // OR B
+    a = alu8<ALU_OR8>(a, b);
+}
+
+template<> void Z80_Core::base_op<0xB1>() { // OR C
+    a = alu8<ALU_OR8>(a, c);
+}
+
+template<> void Z80_Core::base_op<0xB2>() { // OR D
+    a = alu8<ALU_OR8>(a, d);
+}
+
+template<> void Z80_Core::base_op<0xB3>() { // OR E
+    a = alu8<ALU_OR8>(a, e);
+}
+
+template<> void Z80_Core::base_op<0xB4>() { // OR H
+    a = alu8<ALU_OR8>(a, h);
+}
+
+template<> void Z80_Core::base_op<0xB5>() { // OR L
+    a = alu8<ALU_OR8>(a, l);
+}
+
+template<> void Z80_Core::base_op<0xB6>() { // OR (HL)
+    a = alu8<ALU_OR8>(a, memory.read(hl));
+}
+
+template<> void Z80_Core::base_op<0xB7>() { // OR A
+    a = alu8<ALU_OR8>(a, a);
+}
+
+template<> void Z80_Core::base_op<0xB8>() { // CP B
+    alu8<ALU_CP8>(a, b);
+}
+
+template<> void Z80_Core::base_op<0xB9>() { // CP C
+    alu8<ALU_CP8>(a, c);
+}
+
+template<> void Z80_Core::base_op<0xBA>() { // CP D
+    alu8<ALU_CP8>(a, d);
+}
+
+template<> void Z80_Core::base_op<0xBB>() { // CP E
+    alu8<ALU_CP8>(a, e);
+}
+
+template<> void Z80_Core::base_op<0xBC>() { // CP H
+    alu8<ALU_CP8>(a, h);
+}
+
+template<> void Z80_Core::base_op<0xBD>() { // CP L
+    alu8<ALU_CP8>(a, l);
+}
+
+template<> void Z80_Core::base_op<0xBE>() { // CP (HL)
+    alu8<ALU_CP8>(a, memory.read(hl));
+}
+
+template<> void Z80_Core::base_op<0xBF>() { // CP A
+    alu8<ALU_CP8>(a, a);
+}
+
+template<> void Z80_Core::base_op<0xC0>() { // RET NZ
+    if (!flagZ()) {
+        cycles += CYCLES_RET_TAKEN;
+        pc = pop();
+    }
+    //cout << "Returned PC by RET NZ: " << hex << (unsigned)pc << endl;
+}
+
+template<> void Z80_Core::base_op<0xC1>() { // POP BC
+    bc = pop();
+}
+
+template<> void Z80_Core::base_op<0xC2>() { // JP NZ, nn
+    w = fetchOperand(); // low byte
+    z = fetchOperand(); // high byte
+    if (!flagZ()) {
+        pc = (w | (z << 8));
+    }
+}
+
+template<> void Z80_Core::base_op<0xC3>() { // JP nn
+    w = fetchOperand(); // low byte
+    z = fetchOperand(); // high byte
+    pc = (w | (z << 8));
+}
+
+template<> void Z80_Core::base_op<0xC4>() { // CALL NZ, nn
+    w = fetchOperand(); // low byte
+    z = fetchOperand(); // high byte
+    if (!flagZ()) {
+        cycles += CYCLES_CALL_TAKEN;
+        push(pc);
+        pc = (w | (z << 8));
+    }
+}
+
+template<> void Z80_Core::base_op<0xC5>() { // PUSH BC
+    push(bc);
+}
+
+template<> void Z80_Core::base_op<0xC6>() { // ADD A, n
+    w = fetchOperand();
+    a = alu8<ALU_ADD8>(a, w);
+}
+
+template<> void Z80_Core::base_op<0xC7>() { // RST 00h
+    push(pc);
+    pc = 0x00;
+}
+
+template<> void Z80_Core::base_op<0xC8>() { // RET Z
+    if(flagZ()){
+        cycles += CYCLES_RET_TAKEN;
+        pc = pop();
+    }
+}
+
+template<> void Z80_Core::base_op<0xC9>() { // RET
+    //cout << "Stack:" << hex << (unsigned)memory.read(sp+1) << (unsigned)memory.read(sp) << endl;
+    pc = pop();
+    //cout << "Popped PC: " << hex << (unsigned)pc << endl;
+}
+
+template<> void Z80_Core::base_op<0xCA>() { // JP Z, nn
+    w = fetchOperand(); // low byte
+    z = fetchOperand(); // high byte
+    if(flagZ()){
+        pc = (w | (z << 8));
+    }
+}
+
+template<> void Z80_Core::base_op<0xCB>() { //BIT INSTRUCTION
+    w = fetchOperand();
+    cb_instruction(w);
+}
+
+template<> void Z80_Core::base_op<0xCC>() { // CALL Z, nn
+    w = fetchOperand(); // low byte
+    z = fetchOperand(); // high byte
+    if(flagZ()){
+        cycles += CYCLES_CALL_TAKEN;
+        push(pc);
+        pc = (w | (z << 8));
+    }
+}
+
+template<> void Z80_Core::base_op<0xCD>() { // CALL nn
+    w = fetchOperand(); // low byte
+    z = fetchOperand(); // high byte
+    push(pc);
+    //cout << "Saving PC: " << hex << (unsigned)pc << endl;
+    //cout << "Saved PC: " << hex << (unsigned)memory.read(sp+1) << (unsigned)memory.read(sp) << endl;
+    pc = (w | (z << 8));
+}
+
+template<> void Z80_Core::base_op<0xCE>() { // ADC A, n
+    w = fetchOperand();
+    a = alu8<ALU_ADC8>(a, w);
+}
+
+template<> void Z80_Core::base_op<0xCF>() { // RST 08h
+    push(pc);
+    pc = 0x08;
+}
+
+template<> void Z80_Core::base_op<0xD0>() { // RET NC
+    if(!flagC()){
+        cycles += CYCLES_RET_TAKEN;
+        pc = pop();
+    }
+}
+
+template<> void Z80_Core::base_op<0xD1>() { // POP DE
+    de = pop();
+}
+
+template<> void Z80_Core::base_op<0xD2>() { // JP NC, nn
+    w = fetchOperand(); // low byte
+    z = fetchOperand(); // high byte
+    if(!flagC()){
+        pc = (w | (z << 8));
+    }
+}
+
+template<> void Z80_Core::base_op<0xD3>() { // OUT (n), A
+    w = fetchOperand();
+    outputHandler(a,w);
+}
+
+template<> void Z80_Core::base_op<0xD4>() { // CALL NC, nn
+    w = fetchOperand(); // low byte
+    z = fetchOperand(); // high byte
+    if(!flagC()){
+        cycles += CYCLES_CALL_TAKEN;
+        push(pc);
+        pc = (w | (z << 8));
+    }
+}
+
+template<> void Z80_Core::base_op<0xD5>() { // PUSH DE
+    push(de);
+}
+
+template<> void Z80_Core::base_op<0xD6>() { // SUB n
+    w = fetchOperand();
+    a = alu8<ALU_SUB8>(a, w);
+}
+
+template<> void Z80_Core::base_op<0xD7>() { // RST 10h
+    push(pc);
+    pc = 0x10;
+}
+
+template<> void Z80_Core::base_op<0xD8>() { // RET C
+    if(flagC()){
+        cycles += CYCLES_RET_TAKEN;
+        pc = pop();
+    }
+}
 
+template<> void Z80_Core::base_op<0xD9>() { // EXX
+    swap(bc, bca);
+    swap(de, dea);
+    swap(hl, hla);
+}
+
+template<> void Z80_Core::base_op<0xDA>() { // JP C, nn
+    w = fetchOperand(); // low byte
+    z = fetchOperand(); // high byte
+    if(flagC()){
+        pc = (w | (z << 8));
     }
 }
 
-void Z80_Core::ed_instruction(uint8_t ins) {
-    uint16_t temp, temp2 = 0;
-    switch (ins) {
-        case 0x40: // IN B, (C)
-            b = inputHandler(c);
-            break;
-        case 0x41: // OUT (C), B
-            outputHandler(b, c);
-            break;
-        case 0x42: // SBC HL, BC
-            temp = (uint16_t&)l | (h << 8);
-            temp2 = (uint16_t&)c | (b << 8);
-            alu(temp,temp2, ALU_SBC16);
-            l = temp & 0xFF;
-            h = temp >> 8;
-            break;
-        case 0x43: // LD (nn), BC
-            memory[fetchOperand() | (fetchOperand() << 8)] = c;
-            memory[fetchOperand() | (fetchOperand() << 8) + 1] = b;
-            break;
-        case 0x44: // NEG
-            a = -a;
-            break;
-        case 0x45: // RETN
-            // Add more functionality later when interrupts are better implemented
-            pc = pop();
-            iff1 = iff2;
-            break;
-        case 0x46: // IM 0
-            im = 0;
-            break;
-        case 0x47: // LD I, A
-            i = a;
-            break;
-        case 0x48: // IN C, (C)
-            c = inputHandler(c);
-            break;
-        case 0x49: // OUT (C), C
-            outputHandler(c, c);
-            break;
-        case 0x4A: // ADC HL, BC
-            temp = (uint16_t&)l | (h << 8);
-            temp2 = (uint16_t&)c | (b << 8);
-            alu(temp,temp2, ALU_ADC16);
-            l = temp & 0xFF;
-            h = temp >> 8;
-            break;
-        case 0x4B: // LD BC, (nn)
-            c = memory[fetchOperand() | (fetchOperand() << 8)];
-            b = memory[fetchOperand() | (fetchOperand() << 8) + 1];
-            break;
-        case 0x4D: // RETI
-            // Add more functionality later when interrupts are better implemented
-            pc = pop();
-            iff1 = iff2;
-            break;
-        case 0x4F: // LD R, A
-            r = a;
-            break;
-        case 0x50: // IN D, (C)
-            d = inputHandler(c);
-            break;
-        case 0x51: // OUT (C), D
-            outputHandler(d, c);
-            break;
-        case 0x52: // SBC HL, DE
-            temp = (uint16_t&)l | (h << 8);
-            temp2 = (uint16_t&)d | (e << 8);
-            alu(temp,temp2, ALU_SBC16);
-            l = temp & 0xFF;
-            h = temp >> 8;
-            break;
-        case 0x53: // LD (nn), DE
-            memory[fetchOperand() | (fetchOperand() << 8)] = e;
-            memory[fetchOperand() | (fetchOperand() << 8) + 1] = d;
-            break;
-        case 0x56: // IM 1
-            im = 1;
-            break;
-        case 0x57: // LD A, I
-            a = i;
-            break;
-        case 0x58: // IN E, (C)
-            e = inputHandler(c);
-            break;
-        case 0x59: // OUT (C), E
-            outputHandler(e, c);
-            break;
-        case 0x5A: // ADC HL, DE
-            temp = (uint16_t&)l | (h << 8);
-            temp2 = (uint16_t&)d | (e << 8);
-            alu(temp,temp2, ALU_ADC16);
-            l = temp & 0xFF;
-            h = temp >> 8;
-            break;
-        case 0x5B: // LD DE, (nn)
-            e = memory[fetchOperand() | (fetchOperand() << 8)];
-            d = memory[fetchOperand() | (fetchOperand() << 8) + 1];
-            break;
-        case 0x5E: // IM 2
-            im = 2;
-            break;
-        case 0x5F: // LD A, R
-            a = r;
-            break;
-        case 0x60: // IN H, (C)
-            h = inputHandler(c);
-            break;
-        case 0x61: // OUT (C), H
-            outputHandler(h, c);
-            break;
-        case 0x62: // SBC HL, HL
-            temp = (uint16_t&)l | (h << 8);
-            alu(temp,temp, ALU_SBC16);
-            l = temp & 0xFF;
-            h = temp >> 8;
-            break;
-        case 0x67: // RRD
-            w = memory[fetchOperand() | (fetchOperand() << 8)];
-            memory[fetchOperand() | (fetchOperand() << 8)] = (w >> 4) | (w << 4);
-            break;
-        case 0x68: // IN L, (C)
-            l = inputHandler(c);
-            break;
-        case 0x69: // OUT (C), L
-            outputHandler(l, c);
-            break;
-        case 0x6A: // ADC HL, HL
-            temp = (uint16_t&)l | (h << 8);
-            alu(temp,temp, ALU_ADC16);
-            l = temp & 0xFF;
-            h = temp >> 8;
-            break;
-        case 0x6F: // RLD
-            w = memory[fetchOperand() | (fetchOperand() << 8)];
-            memory[fetchOperand() | (fetchOperand() << 8)] = (w << 4) | (w >> 4);
-            break;
-        case 0x72: // SBC HL, SP
-            temp = (uint16_t&)l | (h << 8);
-            alu(temp, sp, ALU_SBC16);
-            l = temp & 0xFF;
-            h = temp >> 8;
-            break;
-        case 0x73: // LD (nn), SP
-            memory[fetchOperand() | (fetchOperand() << 8)] = (sp & 0xff);
-            memory[fetchOperand() | (fetchOperand() << 8) + 1] = (sp << 8);
-            break;
-        case 0x78: // IN A, (C)
-            a = inputHandler(c);
-            break;
-        case 0x79: // OUT (C), A
-            outputHandler(a,c);
-            break;
-        case 0x7A: // ADC HL, SP
-            temp = (uint16_t&)l | (h << 8);
-            alu(temp, sp, ALU_ADC16);
-            l = temp & 0xFF;
-            h = temp >> 8;
-        case 0x7B: // LD (nn), SP
-            temp = fetchOperand() | (fetchOperand() << 8);
-            sp = (memory[temp] | memory[temp+1] << 8);
-        case 0xA0: // LDI
-            memory[e | (d << 8)] = memory[h | (l << 8)];
-            incRegPair(l, h);
-            incRegPair(e, d);
-            decRegPair(c, b);
-            if (b == 0 && c == 0) {
-                f |= FLAG_C;
-            } else f &= ~FLAG_C;
-            break;
-        case 0xA1: // CPI
-            alu((uint16_t&)a, memory[h | (l << 8)], ALU_CP8);
-            incRegPair(l, h);
-            incRegPair(e, d);
-            decRegPair(c, b);
-            if (b == 0 && c == 0) {
-                f |= FLAG_C;
-            } else f &= ~FLAG_C;
-            break;
-        case 0xA2: // INI
-            memory[e | (d << 8)] = inputHandler(c);
-            incRegPair(l, h);
-            alu((uint16_t&)b, 0, ALU_DEC8);
-            break;
-        case 0xA3: // OUTI
-            outputHandler(memory[h | (l << 8)], c);
-            incRegPair(l, h);
-            alu((uint16_t&)b, 0, ALU_DEC8);
-            break;
-        case 0xA8: // LDD
-            memory[e | (d << 8)] = memory[h | (l << 8)];
-            decRegPair(l, h);
-            decRegPair(e, d);
-            decRegPair(c, b);
-            if (b == 0 && c == 0) {
-                f |= FLAG_C;
-            } else f&= ~FLAG_C;
-            break;
-        case 0xA9: // CPD
-            alu((uint16_t&)a, memory[h | (l << 8)], ALU_CP8);
-            decRegPair(l, h);
-            decRegPair(e, d);
-            decRegPair(c, b);
-            if (b == 0 && c == 0) {
-                f |= FLAG_C;
-            } else f &= ~FLAG_C;
-            break;
-        case 0xAA: // IND
-            memory[e | (d << 8)] = inputHandler(c);
-            decRegPair(l, h);
-            alu((uint16_t&)b, 0, ALU_DEC8);
-            break;
-        case 0xAB: // OUTD
-            outputHandler(memory[h | (l << 8)], c);
-            decRegPair(l, h);
-            alu((uint16_t&)b, 0, ALU_DEC8);
-            break;
-        case 0xB0: // LDIR
-            while (b != 0 || c != 0) {
-                memory[e | (d << 8)] = memory[h | (l << 8)];
-                incRegPair(l, h);
-                incRegPair(e, d);
-                decRegPair(c, b);
-                if (b == 0 && c == 0) {
-                    f |= FLAG_C;
-                } else f &= ~FLAG_C;
-            }
-            break;
-        case 0xB1: // CPIR
-            while (b != 0 || c != 0 || (f & FLAG_Z) == 0) {
-                alu((uint16_t&)a, memory[h | (l << 8)], ALU_CP8);
-                incRegPair(l, h);
-                incRegPair(e, d);
-                decRegPair(c, b);
-                if (b == 0 && c == 0) {
-                    f |= FLAG_C;
-                } else f &= ~FLAG_C;
-            }
-            break;
-        case 0xB2: // INIR
-            while (b != 0 || c != 0) {
-                memory[e | (d << 8)] = inputHandler(c);
-                incRegPair(l, h);
-                alu((uint16_t&)b, 0, ALU_DEC8);
-            }
-            break;
-        case 0xB3: // OUTIR
-            while (b != 0 || c != 0 || (f & FLAG_Z) == 0) {
-                outputHandler(memory[h | (l << 8)], c);
-                incRegPair(l, h);
-                alu((uint16_t&)b, 0, ALU_DEC8);
-            }
-            break;
-        case 0xB4: // LDDR
-            while (b != 0 || c != 0) {
-                memory[e | (d << 8)] = memory[h | (l << 8)];
-                decRegPair(l, h);
-                decRegPair(e, d);
-                decRegPair(c, b);
-                if (b == 0 && c == 0) {
-                    f |= FLAG_C;
-                } else f &= ~FLAG_C;
-            }
-            break;
-        case 0xB5: // CPDR
-            while (b != 0 || c != 0 || (f & FLAG_Z) == 0) {
-                alu((uint16_t&)a, memory[h | (l << 8)], ALU_CP8);
-                decRegPair(l, h);
-                decRegPair(e, d);
-                decRegPair(c, b);
-                if (b == 0 && c == 0) {
-                    f |= FLAG_C;
-                } else f &= ~FLAG_C;
+template<> void Z80_Core::base_op<0xDB>() { // IN A, (n)
+    w = fetchOperand();
+    a = inputHandler(w);
+}
+
+template<> void Z80_Core::base_op<0xDC>() { // CALL C, nn
+    w = fetchOperand(); // low byte
+    z = fetchOperand(); // high byte
+    if(flagC()){
+        cycles += CYCLES_CALL_TAKEN;
+        push(pc);
+        pc = (w | (z << 8));
+    }
+}
+
+template<> void Z80_Core::base_op<0xDD>() { // IX PREFIX
+    w = fetchOperand();
+    index_instruction<false>(w);
+}
+
+template<> void Z80_Core::base_op<0xDE>() { // SBC A, n
+    w = fetchOperand();
+    a = alu8<ALU_SBC8>(a, w);
+}
+
+template<> void Z80_Core::base_op<0xDF>() { // RST 18h
+    push(pc);
+    pc = 0x18;
+}
+
+template<> void Z80_Core::base_op<0xE0>() { // RET PO
+    if(!flagP()){
+        cycles += CYCLES_RET_TAKEN;
+        pc = pop();
+    }
+}
+
+template<> void Z80_Core::base_op<0xE1>() { // POP HL
+    hl = pop();
+}
+
+template<> void Z80_Core::base_op<0xE2>() { // JP PO, nn
+    w = fetchOperand(); // low byte
+    z = fetchOperand(); // high byte
+    if(!flagP()){
+        pc = (w | (z << 8));
+    }
+}
+
+template<> void Z80_Core::base_op<0xE3>() { // EX (SP), HL
+    uint16_t temp = memory.read(sp) | (memory.read((sp + 1) & 0xFFFF) << 8);
+    writeMemory(sp, l);
+    writeMemory(sp + 1, h);
+    hl = temp;
+}
+
+template<> void Z80_Core::base_op<0xE4>() { // CALL PO, nn
+    w = fetchOperand(); // low byte
+    z = fetchOperand(); // high byte
+    if(!flagP()){
+        cycles += CYCLES_CALL_TAKEN;
+        push(pc);
+        pc = (w | (z << 8));
+    }
+}
+
+template<> void Z80_Core::base_op<0xE5>() { // PUSH HL
+    push(hl);
+}
+
+template<> void Z80_Core::base_op<0xE6>() { // AND n
+    w = fetchOperand();
+    a = alu8<ALU_AND8>(a, w);
+}
+
+template<> void Z80_Core::base_op<0xE7>() { // RST 20h
+    push(pc);
+    pc = 0x20;
+}
+
+template<> void Z80_Core::base_op<0xE8>() { // RET PE
+    if(flagP()){
+        cycles += CYCLES_RET_TAKEN;
+        pc = pop();
+    }
+}
+
+template<> void Z80_Core::base_op<0xE9>() { // JP (HL)
+    pc = hl;
+}
+
+template<> void Z80_Core::base_op<0xEA>() { // JP PE, nn
+    w = fetchOperand(); // low byte
+    z = fetchOperand(); // high byte
+    if(flagP()){
+        pc = (w | (z << 8));
+    }
+}
+
+template<> void Z80_Core::base_op<0xEB>() { // EX DE, HL
+    swap(de, hl);
+}
+
+template<> void Z80_Core::base_op<0xEC>() { // CALL PE, nn
+    w = fetchOperand(); // low byte
+    z = fetchOperand(); // high byte
+    if(flagP()){
+        cycles += CYCLES_CALL_TAKEN;
+        push(pc);
+        pc = (w | (z << 8));
+    }
+}
+
+template<> void Z80_Core::base_op<0xED>() { // ED PREFIX
+    w = fetchOperand();
+    ed_instruction(w); // call ed instruction
+}
+
+template<> void Z80_Core::base_op<0xEE>() { // XOR n
+    w = fetchOperand();
+    a = alu8<ALU_XOR8>(a, w);
+}
+
+template<> void Z80_Core::base_op<0xEF>() { // RST 28h
+    push(pc);
+    pc = 0x28;
+}
+
+template<> void Z80_Core::base_op<0xF0>() { // RET P
+    if(!flagS()){
+        cycles += CYCLES_RET_TAKEN;
+        pc = pop();
+    }
+}
+
+template<> void Z80_Core::base_op<0xF1>() { // POP AF
+    af = pop();
+    lazyFlags = LAZY_NONE;
+}
+
+template<> void Z80_Core::base_op<0xF2>() { // JP P, nn
+    w = fetchOperand(); // low byte
+    z = fetchOperand(); // high byte
+    if(!flagS()){
+        pc = (w | (z << 8));
+    }
+}
+
+template<> void Z80_Core::base_op<0xF3>() { // DI
+    iff1 = iff2 = false;
+}
+
+template<> void Z80_Core::base_op<0xF4>() { // CALL P, nn
+    w = fetchOperand(); // low byte
+    z = fetchOperand(); // high byte
+    if(!flagS()){
+        cycles += CYCLES_CALL_TAKEN;
+        push(pc);
+        pc = (w | (z << 8));
+    }
+}
+
+template<> void Z80_Core::base_op<0xF5>() { // PUSH AF
+    materializeFlags();
+    push(af);
+}
+
+template<> void Z80_Core::base_op<0xF6>() { // OR n
+    w = fetchOperand();
+    a = alu8<ALU_OR8>(a, w);
+}
+
+template<> void Z80_Core::base_op<0xF7>() { // RST 30h
+    push(pc);
+    pc = 0x30;
+}
+
+template<> void Z80_Core::base_op<0xF8>() { // RET M
+    if(flagS()){
+        cycles += CYCLES_RET_TAKEN;
+        pc = pop();
+    }
+}
+
+template<> void Z80_Core::base_op<0xF9>() { // LD SP, HL
+    sp = hl;
+}
+
+template<> void Z80_Core::base_op<0xFA>() { // JP M, nn
+    w = fetchOperand(); // low byte
+    z = fetchOperand(); // high byte
+    if(flagS()){
+        pc = (w | (z << 8));
+    }
+}
+
+template<> void Z80_Core::base_op<0xFB>() { // EI
+    iff1 = iff2 = 1;
+    eiCycles = cycles; // no interrupt before the next instruction, EI; RETI and EI; HALT rely on it
+    if (isPending) scheduler.schedule(irqEvent, cycles + 1);
+}
+
+template<> void Z80_Core::base_op<0xFC>() { // CALL M, nn
+    w = fetchOperand(); // low byte
+    z = fetchOperand(); // high byte
+    if(flagS()){
+        cycles += CYCLES_CALL_TAKEN;
+        push(pc);
+        pc = (w | (z << 8));
+    }
+}
+
+template<> void Z80_Core::base_op<0xFD>() { // IY PREFIX
+    w = fetchOperand();
+    index_instruction<true>(w);
+}
+
+template<> void Z80_Core::base_op<0xFE>() { // CP n
+    w = fetchOperand();
+    alu8<ALU_CP8>(a, w);
+}
+
+template<> void Z80_Core::base_op<0xFF>() { // RST 38h
+    push(pc);
+    pc = 0x38;
+}
+
+
+/* ED PREFIX, EXTENDED INSTRUCTIONS */
+template<uint8_t OP> void Z80_Core::ed_op() {
+    cout << "Invalid MISC instruction: " << hex << (int)OP << " at PC: " << (int)pc << endl;
+    invalidOpcode();
+}
+
+template<> void Z80_Core::ed_op<0x40>() { // IN B, (C)
+    b = inputHandler(c);
+}
+
+template<> void Z80_Core::ed_op<0x41>() { // OUT (C), B
+    outputHandler(b, c);
+}
+
+template<> void Z80_Core::ed_op<0x42>() { // SBC HL, BC
+    hl = alu16<ALU_SBC16>(hl, bc);
+}
+
+template<> void Z80_Core::ed_op<0x43>() { // LD (nn), BC
+    w = fetchOperand(); // low byte
+    z = fetchOperand(); // high byte
+    writeMemory(w | (z << 8), c);
+    writeMemory((w | (z << 8)) + 1, b);
+}
+
+template<> void Z80_Core::ed_op<0x44>() { // NEG
+    a = alu8<ALU_SUB8>(0, a);
+}
+
+template<> void Z80_Core::ed_op<0x45>() { // RETN
+    // Add more functionality later when interrupts are better implemented
+    pc = pop();
+    iff1 = iff2;
+    if (iff1 && isPending) scheduler.schedule(irqEvent, cycles);
+}
+
+template<> void Z80_Core::ed_op<0x46>() { // IM 0
+    im = 0;
+}
+
+template<> void Z80_Core::ed_op<0x47>() { // LD I, A
+    i = a;
+}
+
+template<> void Z80_Core::ed_op<0x48>() { // IN C, (C)
+    c = inputHandler(c);
+}
+
+template<> void Z80_Core::ed_op<0x49>() { // OUT (C), C
+    outputHandler(c, c);
+}
+
+template<> void Z80_Core::ed_op<0x4A>() { // ADC HL, BC
+    hl = alu16<ALU_ADC16>(hl, bc);
+}
+
+template<> void Z80_Core::ed_op<0x4B>() { // LD BC, (nn)
+    w = fetchOperand(); // low byte
+    z = fetchOperand(); // high byte
+    c = memory.read(w | (z << 8));
+    b = memory.read((w | (z << 8)) + 1);
+}
+
+template<> void Z80_Core::ed_op<0x4D>() { // RETI
+    // Add more functionality later when interrupts are better implemented
+    pc = pop();
+    iff1 = iff2;
+    if (iff1 && isPending) scheduler.schedule(irqEvent, cycles);
+}
+
+template<> void Z80_Core::ed_op<0x4F>() { // LD R, A
+    r = a;
+}
+
+template<> void Z80_Core::ed_op<0x50>() { // IN D, (C)
+    d = inputHandler(c);
+}
+
+template<> void Z80_Core::ed_op<0x51>() { // OUT (C), D
+    outputHandler(d, c);
+}
+
+template<> void Z80_Core::ed_op<0x52>() { // SBC HL, DE
+    hl = alu16<ALU_SBC16>(hl, de);
+}
+
+template<> void Z80_Core::ed_op<0x53>() { // LD (nn), DE
+    w = fetchOperand(); // low byte
+    z = fetchOperand(); // high byte
+    writeMemory(w | (z << 8), e);
+    writeMemory((w | (z << 8)) + 1, d);
+}
+
+template<> void Z80_Core::ed_op<0x56>() { // IM 1
+    im = 1;
+}
+
+template<> void Z80_Core::ed_op<0x57>() { // LD A, I
+    a = i;
+}
+
+template<> void Z80_Core::ed_op<0x58>() { // IN E, (C)
+    e = inputHandler(c);
+}
+
+template<> void Z80_Core::ed_op<0x59>() { // OUT (C), E
+    outputHandler(e, c);
+}
+
+template<> void Z80_Core::ed_op<0x5A>() { // ADC HL, DE
+    hl = alu16<ALU_ADC16>(hl, de);
+}
+
+template<> void Z80_Core::ed_op<0x5B>() { // LD DE, (nn)
+    w = fetchOperand(); // low byte
+    z = fetchOperand(); // high byte
+    e = memory.read(w | (z << 8));
+    d = memory.read((w | (z << 8)) + 1);
+}
+
+template<> void Z80_Core::ed_op<0x5E>() { // IM 2
+    im = 2;
+}
+
+template<> void Z80_Core::ed_op<0x5F>() { // LD A, R
+    a = r;
+}
+
+template<> void Z80_Core::ed_op<0x60>() { // IN H, (C)
+    h = inputHandler(c);
+}
+
+template<> void Z80_Core::ed_op<0x61>() { // OUT (C), H
+    outputHandler(h, c);
+}
+
+template<> void Z80_Core::ed_op<0x62>() { // SBC HL, HL
+    hl = alu16<ALU_SBC16>(hl, hl);
+}
+
+template<> void Z80_Core::ed_op<0x63>() { // LD (nn), HL
+    w = fetchOperand(); // low byte
+    z = fetchOperand(); // high byte
+    writeMemory(w | (z << 8), l);
+    writeMemory((w | (z << 8)) + 1, h);
+}
+
+template<> void Z80_Core::ed_op<0x67>() { // RRD
+    w = memory.read(hl);
+    writeMemory(hl, (w >> 4) | (w << 4));
+}
+
+template<> void Z80_Core::ed_op<0x68>() { // IN L, (C)
+    l = inputHandler(c);
+}
+
+template<> void Z80_Core::ed_op<0x69>() { // OUT (C), L
+    outputHandler(l, c);
+}
+
+template<> void Z80_Core::ed_op<0x6A>() { // ADC HL, HL
+    hl = alu16<ALU_ADC16>(hl, hl);
+}
+
+template<> void Z80_Core::ed_op<0x6B>() { // LD HL, (nn)
+    w = fetchOperand(); // low byte
+    z = fetchOperand(); // high byte
+    l = memory.read(w | (z << 8));
+    h = memory.read((w | (z << 8)) + 1);
+}
+
+template<> void Z80_Core::ed_op<0x6F>() { // RLD
+    w = memory.read(hl);
+    writeMemory(hl, (w << 4) | (w >> 4));
+}
+
+template<> void Z80_Core::ed_op<0x72>() { // SBC HL, SP
+    hl = alu16<ALU_SBC16>(hl, sp);
+}
+
+template<> void Z80_Core::ed_op<0x73>() { // LD (nn), SP
+    w = fetchOperand(); // low byte
+    z = fetchOperand(); // high byte
+    writeMemory(w | (z << 8), (sp & 0xff));
+    writeMemory((w | (z << 8)) + 1, (sp >> 8));
+}
+
+template<> void Z80_Core::ed_op<0x78>() { // IN A, (C)
+    a = inputHandler(c);
+}
+
+template<> void Z80_Core::ed_op<0x79>() { // OUT (C), A
+    outputHandler(a,c);
+}
+
+template<> void Z80_Core::ed_op<0x7A>() { // ADC HL, SP
+    hl = alu16<ALU_ADC16>(hl, sp);
+}
+
+template<> void Z80_Core::ed_op<0x7B>() { // LD (nn), SP
+    uint16_t temp;
+    w = fetchOperand(); // low byte
+    z = fetchOperand(); // high byte
+    temp = w | (z << 8);
+    sp = (memory.read(temp) | memory.read(temp+1) << 8);
+}
+
+/*
+    Block instructions. A repeating one runs as many iterations as it can in
+    one pass, with bulk copies and searches where memory is contiguous, and
+    then rewinds pc to run again while BC (B for I/O) isn't done, so devices
+    and interrupts get polled between passes like they would between the
+    CPU's own repeats. repeatBudget() bounds a pass while an interrupt can
+    come in. Bit 3 of the opcode is the direction, bit 4 repeats.
+*/
+
+// Iterations a repeating block instruction may run before devices and interrupts get a look
+inline unsigned Z80_Core::repeatBudget() {
+    return interruptible() ? REPEAT_CHUNK : 0x10000;
+}
+
+// Timing of a pass over iterations, the first one is in cyclesED. Another pass comes if repeat is set
+template<uint8_t OP> inline void Z80_Core::repeatBlock(unsigned iterations, bool repeat) {
+    cycles += (iterations - 1) * (cyclesED[OP] + CYCLES_BLOCK_REPEAT);
+    if (repeat) {
+        cycles += CYCLES_BLOCK_REPEAT;
+        pc = (pc - 2) & 0xFFFF; // back to the ED prefix
+    }
+}
+
+template<uint8_t OP> void Z80_Core::blockTransfer() { // LDI, LDD, LDIR, LDDR
+    constexpr bool repeat = OP & 0x10;
+    constexpr int step = (OP & 0x08) ? -1 : 1;
+    unsigned count = repeat ? min(bc ? bc : 0x10000u, repeatBudget()) : 1;
+    uint8_t last = 0; // the last byte copied
+
+    for (unsigned done = 0; done < count;) {
+        // A run stops where either pointer crosses a page, the pages may be anywhere on the host
+        unsigned length = (step > 0) ? min(MEMORY_PAGE_SIZE - (hl & MEMORY_PAGE_MASK), MEMORY_PAGE_SIZE - (de & MEMORY_PAGE_MASK))
+                                     : min((hl & MEMORY_PAGE_MASK) + 1, (de & MEMORY_PAGE_MASK) + 1);
+        length = min(length, count - done);
+        uint16_t from = (step > 0) ? hl : hl - length + 1;
+        uint16_t to = (step > 0) ? de : de - length + 1;
+        const uint8_t* source = memory.readPointer(from);
+        uint8_t* target = memory.writePointer(to);
+
+        if (source == nullptr || target == nullptr) { // a device sees every access in order
+            for (unsigned n = 0; n < length; n++) {
+                unsigned at = (step > 0) ? n : length - 1 - n;
+                last = memory.read(from + at);
+                memory.write(to + at, last);
             }
-            break;
-        case 0xB6: // INDR
-            while (b != 0 || c != 0) {
-                memory[e | (d << 8)] = inputHandler(c);
-                decRegPair(l, h);
-                alu((uint16_t&)b, 0, ALU_DEC8);
+        } else {
+            // How far the copy writes ahead of its reads, on the host: ROM writes go elsewhere
+            uintptr_t distance = (step > 0) ? (uintptr_t)target - (uintptr_t)source : (uintptr_t)source - (uintptr_t)target;
+            if (distance == 0 || distance >= length) {
+                memmove(target, source, length);
+            } else {
+                // Byte by byte the first distance bytes repeat over the whole run: copy
+                // what's already final, twice as much every time
+                for (unsigned copied = 0; copied < length;) {
+                    unsigned chunk = min(length - copied, (unsigned)distance + copied);
+                    if (step > 0) memcpy(target + copied, source, chunk);
+                    else memcpy(target + length - copied - chunk, source + length - chunk, chunk);
+                    copied += chunk;
+                }
             }
-            break;
-        case 0xB7: // OUTDR
-            while (b != 0 || c != 0 || (f & FLAG_Z) == 0) {
-                outputHandler(memory[h | (l << 8)], c);
-                decRegPair(l, h);
-                alu((uint16_t&)b, 0, ALU_DEC8);
+            last = (step > 0) ? target[length - 1] : target[0];
+            memory.markDirty(to, length);
+        }
+        invalidateRange(to, length);
+        hl += step * (int)length;
+        de += step * (int)length;
+        done += length;
+        bc -= length;
+    }
+
+    materializeFlags();
+    uint8_t n = a + last;
+    f = (f & (FLAG_S | FLAG_Z | FLAG_C)) | (bc ? FLAG_P : 0) | (n & FLAG_3) | ((n << 4) & FLAG_5);
+    if (repeat) repeatBlock<OP>(count, bc != 0);
+}
+
+template<uint8_t OP> void Z80_Core::blockCompare() { // CPI, CPD, CPIR, CPDR
+    constexpr bool repeat = OP & 0x10;
+    constexpr int step = (OP & 0x08) ? -1 : 1;
+    unsigned count = repeat ? min(bc ? bc : 0x10000u, repeatBudget()) : 1;
+    unsigned done = 0;
+    bool found = false;
+    uint8_t last = 0; // the last byte compared
+
+    while (done < count && !found) {
+        unsigned length = min((step > 0) ? MEMORY_PAGE_SIZE - (hl & MEMORY_PAGE_MASK) : (hl & MEMORY_PAGE_MASK) + 1, count - done);
+        unsigned n = 0; // bytes compared, up to and including a match
+        const uint8_t* bytes = memory.readPointer(hl);
+        if (step > 0 && bytes) {
+            const uint8_t* match = (const uint8_t*)memchr(bytes, a, length);
+            found = match != nullptr;
+            n = found ? match - bytes + 1 : length;
+            last = bytes[n - 1];
+        } else {
+            for (; n < length && !found; n++) {
+                last = memory.read(hl + step * (int)n);
+                found = last == a;
             }
-            break;
-        default:
-            cout << "Invalid MISC instruction: " << hex << (int)ins << " at PC: " << (int)pc << endl;
-            break;
+        }
+        hl += step * (int)n;
+        done += n;
+        bc -= n;
     }
+
+    materializeFlags();
+    uint8_t carry = f & FLAG_C;
+    alu8<ALU_CP8>(a, last);
+    materializeFlags();
+    uint8_t n = a - last - ((f & FLAG_H) ? 1 : 0);
+    f = (f & (FLAG_S | FLAG_Z | FLAG_H)) | FLAG_N | carry | (bc ? FLAG_P : 0) | (n & FLAG_3) | ((n << 4) & FLAG_5);
+    if (repeat) repeatBlock<OP>(done, bc != 0 && !found);
 }
 
-void Z80_Core::cb_instruction(uint8_t ins) {
-    switch (ins) {
-        case 0x00: // RLC B
-            alu((uint16_t&)b, 0, ALU_RLC8);
-            break;
-        case 0x01: // RLC C
-            alu((uint16_t&)c, 0, ALU_RLC8);
-            break;
-        case 0x02: // RLC D
-            alu((uint16_t&)d, 0, ALU_RLC8);
-            break;
-        case 0x03: // RLC E
-            alu((uint16_t&)e, 0, ALU_RLC8);
-            break;
-        case 0x04: // RLC H
-            alu((uint16_t&)h, 0, ALU_RLC8);
-            break;
-        case 0x05: // RLC L
-            alu((uint16_t&)l, 0, ALU_RLC8);
-            break;
-        case 0x06: // RLC (HL)
-            alu((uint16_t&)memory[l | (h << 8)], 0, ALU_RLC8);
-            break;
-        case 0x07: // RLC A
-            alu((uint16_t&)a, 0, ALU_RLC8);
-            break;
-        case 0x08: // RRC B
-            alu((uint16_t&)b, 0, ALU_RRC8);
-            break;
-        case 0x09: // RRC C
-            alu((uint16_t&)c, 0, ALU_RRC8);
-            break;
-        case 0x0A: // RRC D
-            alu((uint16_t&)d, 0, ALU_RRC8);
-            break;
-        case 0x0B: // RRC E
-            alu((uint16_t&)e, 0, ALU_RRC8);
-            break;
-        case 0x0C: // RRC H
-            alu((uint16_t&)h, 0, ALU_RRC8);
-            break;
-        case 0x0D: // RRC L
-            alu((uint16_t&)l, 0, ALU_RRC8);
-            break;
-        case 0x0E: // RRC (HL)
-            alu((uint16_t&)memory[l | (h << 8)], 0, ALU_RRC8);
-            break;
-        case 0x0F: // RRC A
-            alu((uint16_t&)a, 0, ALU_RRC8);
-            break;
-        case 0x10: // RL B
-            alu((uint16_t&)b, 0, ALU_RL8);
-            break;
-        case 0x11: // RL C
-            alu((uint16_t&)c, 0, ALU_RL8);
-            break;
-        case 0x12: // RL D
-            alu((uint16_t&)d, 0, ALU_RL8);
-            break;
-        case 0x13: // RL E
-            alu((uint16_t&)e, 0, ALU_RL8);
-            break;
-        case 0x14: // RL H
-            alu((uint16_t&)h, 0, ALU_RL8);
-            break;
-        case 0x15: // RL L
-            alu((uint16_t&)l, 0, ALU_RL8);
-            break;
-        case 0x16: // RL (HL)
-            alu((uint16_t&)memory[l | (h << 8)], 0, ALU_RL8);
-            break;
-        case 0x17: // RL A
-            alu((uint16_t&)a, 0, ALU_RL8);
-            break;
-        case 0x18: // RR B
-            alu((uint16_t&)b, 0, ALU_RR8);
-            break;
-        case 0x19: // RR C
-            alu((uint16_t&)c, 0, ALU_RR8);
-            break;
-        case 0x1A: // RR D
-            alu((uint16_t&)d, 0, ALU_RR8);
-            break;
-        case 0x1B: // RR E
-            alu((uint16_t&)e, 0, ALU_RR8);
-            break;
-        case 0x1C: // RR H
-            alu((uint16_t&)h, 0, ALU_RR8);
-            break;
-        case 0x1D: // RR L
-            alu((uint16_t&)l, 0, ALU_RR8);
-            break;
-        case 0x1E: // RR (HL)
-            alu((uint16_t&)memory[l | (h << 8)], 0, ALU_RR8);
-            break;
-        case 0x1F: // RR A
-            alu((uint16_t&)a, 0, ALU_RR8);
-            break;
-        case 0x20: // SLA B
-            alu((uint16_t&)b, 0, ALU_SLA8);
-            break;
-        case 0x21: // SLA C
-            alu((uint16_t&)c, 0, ALU_SLA8);
-            break;
-        case 0x22: // SLA D
-            alu((uint16_t&)d, 0, ALU_SLA8);
-            break;
-        case 0x23: // SLA E
-            alu((uint16_t&)e, 0, ALU_SLA8);
-            break;
-        case 0x24: // SLA H
-            alu((uint16_t&)h, 0, ALU_SLA8);
-            break;
-        case 0x25: // SLA L
-            alu((uint16_t&)l, 0, ALU_SLA8);
-            break;
-        case 0x26: // SLA (HL)
-            alu((uint16_t&)memory[l | (h << 8)], 0, ALU_SLA8);
-            break;
-        case 0x27: // SLA A
-            alu((uint16_t&)a, 0, ALU_SLA8);
-            break;
-        case 0x28: // SRA B
-            alu((uint16_t&)b, 0, ALU_SRA8);
-            break;
-        case 0x29: // SRA C
-            alu((uint16_t&)c, 0, ALU_SRA8);
-            break;
-        case 0x2A: // SRA D
-            alu((uint16_t&)d, 0, ALU_SRA8);
-            break;
-        case 0x2B: // SRA E
-            alu((uint16_t&)e, 0, ALU_SRA8);
-            break;
-        case 0x2C: // SRA H
-            alu((uint16_t&)h, 0, ALU_SRA8);
-            break;
-        case 0x2D: // SRA L
-            alu((uint16_t&)l, 0, ALU_SRA8);
-            break;
-        case 0x2E: // SRA (HL)
-            alu((uint16_t&)memory[l | (h << 8)], 0, ALU_SRA8);
-            break;
-        case 0x2F: // SRA A
-            alu((uint16_t&)a, 0, ALU_SRA8);
-            break;
-        case 0x38: // SRL B
-            alu((uint16_t&)b, 0, ALU_SRL8);
-            break;
-        case 0x39: // SRL C
-            alu((uint16_t&)c, 0, ALU_SRL8);
-            break;
-        case 0x3A: // SRL D
-            alu((uint16_t&)d, 0, ALU_SRL8);
-            break;
-        case 0x3B: // SRL E
-            alu((uint16_t&)e, 0, ALU_SRL8);
-            break;
-        case 0x3C: // SRL H
-            alu((uint16_t&)h, 0, ALU_SRL8);
-            break;
-        case 0x3D: // SRL L
-            alu((uint16_t&)l, 0, ALU_SRL8);
-            break;
-        case 0x3E: // SRL (HL)
-            alu((uint16_t&)memory[l | (h << 8)], 0, ALU_SRL8);
-            break;
-        case 0x3F: // SRL A
-            alu((uint16_t&)a, 0, ALU_SRL8);
-            break;
-        case 0x40: // BIT 0, B
-            alu((uint16_t&)b, 0, ALU_BIT0);
-            break;
-        case 0x41: // BIT 0, C
-            alu((uint16_t&)c, 0, ALU_BIT0);
-            break;
-        case 0x42: // BIT 0, D
-            alu((uint16_t&)d, 0, ALU_BIT0);
-            break;
-        case 0x43: // BIT 0, E
-            alu((uint16_t&)e, 0, ALU_BIT0);
-            break;
-        case 0x44: // BIT 0, H
-            alu((uint16_t&)h, 0, ALU_BIT0);
-            break;
-        case 0x45: // BIT 0, L
-            alu((uint16_t&)l, 0, ALU_BIT0);
-            break;
-        case 0x46: // BIT 0, (HL)
-            alu((uint16_t&)memory[l | (h << 8)], 0, ALU_BIT0);
-            break;
-        case 0x47: // BIT 0, A
-            alu((uint16_t&)a, 0, ALU_BIT0);
-            break;
-        case 0x48: // BIT 1, B
-            alu((uint16_t&)b, 0, ALU_BIT1);
-            break;
-        case 0x49: // BIT 1, C
-            alu((uint16_t&)c, 0, ALU_BIT1);
-            break;
-        case 0x4A: // BIT 1, D
-            alu((uint16_t&)d, 0, ALU_BIT1);
-            break;
-        case 0x4B: // BIT 1, E
-            alu((uint16_t&)e, 0, ALU_BIT1);
-            break;
-        case 0x4C: // BIT 1, H
-            alu((uint16_t&)h, 0, ALU_BIT1);
-            break;
-        case 0x4D: // BIT 1, L
-            alu((uint16_t&)l, 0, ALU_BIT1);
-            break;
-        case 0x4E: // BIT 1, (HL)
-            alu((uint16_t&)memory[l | (h << 8)], 0, ALU_BIT1);
-            break;
-        case 0x4F: // BIT 1, A
-            alu((uint16_t&)a, 0, ALU_BIT1);
-            break;
-        case 0x50: // BIT 2, B
-            alu((uint16_t&)b, 0, ALU_BIT2);
-            break;
-        case 0x51: // BIT 2, C
-            alu((uint16_t&)c, 0, ALU_BIT2);
-            break;
-        case 0x52: // BIT 2, D
-            alu((uint16_t&)d, 0, ALU_BIT2);
-            break;
-        case 0x53: // BIT 2, E
-            alu((uint16_t&)e, 0, ALU_BIT2);
-            break;
-        case 0x54: // BIT 2, H
-            alu((uint16_t&)h, 0, ALU_BIT2);
-            break;
-        case 0x55: // BIT 2, L
-            alu((uint16_t&)l, 0, ALU_BIT2);
-            break;
-        case 0x56: // BIT 2, (HL)
-            alu((uint16_t&)memory[l | (h << 8)], 0, ALU_BIT2);
-            break;
-        case 0x57: // BIT 2, A
-            alu((uint16_t&)a, 0, ALU_BIT2);
-            break;
-        case 0x58: // BIT 3, B
-            alu((uint16_t&)b, 0, ALU_BIT3);
-            break;
-        case 0x59: // BIT 3, C
-            alu((uint16_t&)c, 0, ALU_BIT3);
-            break;
-        case 0x5A: // BIT 3, D
-            alu((uint16_t&)d, 0, ALU_BIT3);
-            break;
-        case 0x5B: // BIT 3, E
-            alu((uint16_t&)e, 0, ALU_BIT3);
-            break;
-        case 0x5C: // BIT 3, H
-            alu((uint16_t&)h, 0, ALU_BIT3);
-            break;
-        case 0x5D: // BIT 3, L
-            alu((uint16_t&)l, 0, ALU_BIT3);
-            break;
-        case 0x5E: // BIT 3, (HL)
-            alu((uint16_t&)memory[l | (h << 8)], 0, ALU_BIT3);
-            break;
-        case 0x5F: // BIT 3, A
-            alu((uint16_t&)a, 0, ALU_BIT3);
-            break;
-        case 0x60: // BIT 4, B
-            alu((uint16_t&)b, 0, ALU_BIT4);
-            break;
-        case 0x61: // BIT 4, C
-            alu((uint16_t&)c, 0, ALU_BIT4);
-            break;
-        case 0x62: // BIT 4, D
-            alu((uint16_t&)d, 0, ALU_BIT4);
-            break;
-        case 0x63: // BIT 4, E
-            alu((uint16_t&)e, 0, ALU_BIT4);
-            break;
-        case 0x64: // BIT 4, H
-            alu((uint16_t&)h, 0, ALU_BIT4);
-            break;
-        case 0x65: // BIT 4, L
-            alu((uint16_t&)l, 0, ALU_BIT4);
-            break;
-        case 0x66: // BIT 4, (HL)
-            alu((uint16_t&)memory[l | (h << 8)], 0, ALU_BIT4);
-            break;
-        case 0x67: // BIT 4, A
-            alu((uint16_t&)a, 0, ALU_BIT4);
-            break;
-        case 0x68: // BIT 5, B
-            alu((uint16_t&)b, 0, ALU_BIT5);
-            break;
-        case 0x69: // BIT 5, C
-            alu((uint16_t&)c, 0, ALU_BIT5);
-            break;
-        case 0x6A: // BIT 5, D
-            alu((uint16_t&)d, 0, ALU_BIT5);
-            break;
-        case 0x6B: // BIT 5, E
-            alu((uint16_t&)e, 0, ALU_BIT5);
-            break;
-        case 0x6C: // BIT 5, H
-            alu((uint16_t&)h, 0, ALU_BIT5);
-            break;
-        case 0x6D: // BIT 5, L
-            alu((uint16_t&)l, 0, ALU_BIT5);
-            break;
-        case 0x6E: // BIT 5, (HL)
-            alu((uint16_t&)memory[l | (h << 8)], 0, ALU_BIT5);
-            break;
-        case 0x6F: // BIT 5, A
-            alu((uint16_t&)a, 0, ALU_BIT5);
-            break;
-        case 0x70: // BIT 6, B
-            alu((uint16_t&)b, 0, ALU_BIT6);
-            break;
-        case 0x71: // BIT 6, C
-            alu((uint16_t&)c, 0, ALU_BIT6);
-            break;
-        case 0x72: // BIT 6, D
-            alu((uint16_t&)d, 0, ALU_BIT6);
-            break;
-        case 0x73: // BIT 6, E
-            alu((uint16_t&)e, 0, ALU_BIT6);
-            break;
-        case 0x74: // BIT 6, H
-            alu((uint16_t&)h, 0, ALU_BIT6);
-            break;
-        case 0x75: // BIT 6, L
-            alu((uint16_t&)l, 0, ALU_BIT6);
-            break;
-        case 0x76: // BIT 6, (HL)
-            alu((uint16_t&)memory[l | (h << 8)], 0, ALU_BIT6);
-            break;
-        case 0x77: // BIT 6, A
-            alu((uint16_t&)a, 0, ALU_BIT6);
-            break;
-        case 0x78: // BIT 7, B
-            alu((uint16_t&)b, 0, ALU_BIT7);
-            break;
-        case 0x79: // BIT 7, C
-            alu((uint16_t&)c, 0, ALU_BIT7);
-            break;
-        case 0x7A: // BIT 7, D
-            alu((uint16_t&)d, 0, ALU_BIT7);
-            break;
-        case 0x7B: // BIT 7, E
-            alu((uint16_t&)e, 0, ALU_BIT7);
-            break;
-        case 0x7C: // BIT 7, H
-            alu((uint16_t&)h, 0, ALU_BIT7);
-            break;
-        case 0x7D: // BIT 7, L
-            alu((uint16_t&)l, 0, ALU_BIT7);
-            break;
-        case 0x7E: // BIT 7, (HL)
-            alu((uint16_t&)memory[l | (h << 8)], 0, ALU_BIT7);
-            break;
-        case 0x7F: // BIT 7, A
-            alu((uint16_t&)a, 0, ALU_BIT7);
-            break;
-        case 0x80: // RES 0, B
-            alu((uint16_t&)b, 0, ALU_RES0);
-            break;
-        case 0x81: // RES 0, C
-            alu((uint16_t&)c, 0, ALU_RES0);
-            break;
-        case 0x82: // RES 0, D
-            alu((uint16_t&)d, 0, ALU_RES0);
-            break;
-        case 0x83: // RES 0, E
-            alu((uint16_t&)e, 0, ALU_RES0);
-            break;
-        case 0x84: // RES 0, H
-            alu((uint16_t&)h, 0, ALU_RES0);
-            break;
-        case 0x85: // RES 0, L
-            alu((uint16_t&)l, 0, ALU_RES0);
-            break;
-        case 0x86: // RES 0, (HL)
-            alu((uint16_t&)memory[l | (h << 8)], 0, ALU_RES0);
-            break;
-        case 0x87: // RES 0, A
-            alu((uint16_t&)a, 0, ALU_RES0);
-            break;
-        case 0x88: // RES 1, B
-            alu((uint16_t&)b, 0, ALU_RES1);
-            break;
-        case 0x89: // RES 1, C
-            alu((uint16_t&)c, 0, ALU_RES1);
-            break;
-        case 0x8A: // RES 1, D
-            alu((uint16_t&)d, 0, ALU_RES1);
-            break;
-        case 0x8B: // RES 1, E
-            alu((uint16_t&)e, 0, ALU_RES1);
-            break;
-        case 0x8C: // RES 1, H
-            alu((uint16_t&)h, 0, ALU_RES1);
-            break;
-        case 0x8D: // RES 1, L
-            alu((uint16_t&)l, 0, ALU_RES1);
-            break;
-        case 0x8E: // RES 1, (HL)
-            alu((uint16_t&)memory[l | (h << 8)], 0, ALU_RES1);
-            break;
-        case 0x8F: // RES 1, A
-            alu((uint16_t&)a, 0, ALU_RES1);
-            break;
-        case 0x90: // RES 2, B
-            alu((uint16_t&)b, 0, ALU_RES2);
-            break;
-        case 0x91: // RES 2, C
-            alu((uint16_t&)c, 0, ALU_RES2);
-            break;
-        case 0x92: // RES 2, D
-            alu((uint16_t&)d, 0, ALU_RES2);
-            break;
-        case 0x93: // RES 2, E
-            alu((uint16_t&)e, 0, ALU_RES2);
-            break;
-        case 0x94: // RES 2, H
-            alu((uint16_t&)h, 0, ALU_RES2);
-            break;
-        case 0x95: // RES 2, L
-            alu((uint16_t&)l, 0, ALU_RES2);
-            break;
-        case 0x96: // RES 2, (HL)
-            alu((uint16_t&)memory[l | (h << 8)], 0, ALU_RES2);
-            break;
-        case 0x97: // RES 2, A
-            alu((uint16_t&)a, 0, ALU_RES2);
-            break;
-        case 0x98: // RES 3, B
-            alu((uint16_t&)b, 0, ALU_RES3);
-            break;
-        case 0x99: // RES 3, C
-            alu((uint16_t&)c, 0, ALU_RES3);
-            break;
-        case 0x9A: // RES 3, D
-            alu((uint16_t&)d, 0, ALU_RES3);
-            break;
-        case 0x9B: // RES 3, E
-            alu((uint16_t&)e, 0, ALU_RES3);
-            break;
-        case 0x9C: // RES 3, H
-            alu((uint16_t&)h, 0, ALU_RES3);
-            break;
-        case 0x9D: // RES 3, L
-            alu((uint16_t&)l, 0, ALU_RES3);
-            break;
-        case 0x9E: // RES 3, (HL)
-            alu((uint16_t&)memory[l | (h << 8)], 0, ALU_RES3);
-            break;
-        case 0x9F: // RES 3, A
-            alu((uint16_t&)a, 0, ALU_RES3);
-            break;
-        case 0xA0: // RES 4, B
-            alu((uint16_t&)b, 0, ALU_RES4);
-            break;
-        case 0xA1: // RES 4, C
-            alu((uint16_t&)c, 0, ALU_RES4);
-            break;
-        case 0xA2: // RES 4, D
-            alu((uint16_t&)d, 0, ALU_RES4);
-            break;
-        case 0xA3: // RES 4, E
-            alu((uint16_t&)e, 0, ALU_RES4);
-            break;
-        case 0xA4: // RES 4, H
-            alu((uint16_t&)h, 0, ALU_RES4);
-            break;
-        case 0xA5: // RES 4, L
-            alu((uint16_t&)l, 0, ALU_RES4);
-            break;
-        case 0xA6: // RES 4, (HL)
-            alu((uint16_t&)memory[l | (h << 8)], 0, ALU_RES4);
-            break;
-        case 0xA7: // RES 4, A
-            alu((uint16_t&)a, 0, ALU_RES4);
-            break;
-        case 0xA8: // RES 5, B
-            alu((uint16_t&)b, 0, ALU_RES5);
-            break;
-        case 0xA9: // RES 5, C
-            alu((uint16_t&)c, 0, ALU_RES5);
-            break;
-        case 0xAA: // RES 5, D
-            alu((uint16_t&)d, 0, ALU_RES5);
-            break;
-        case 0xAB: // RES 5, E
-            alu((uint16_t&)e, 0, ALU_RES5);
-            break;
-        case 0xAC: // RES 5, H
-            alu((uint16_t&)h, 0, ALU_RES5);
-            break;
-        case 0xAD: // RES 5, L
-            alu((uint16_t&)l, 0, ALU_RES5);
-            break;
-        case 0xAE: // RES 5, (HL)
-            alu((uint16_t&)memory[l | (h << 8)], 0, ALU_RES5);
-            break;
-        case 0xAF: // RES 5, A
-            alu((uint16_t&)a, 0, ALU_RES5);
-            break;
-        case 0xB0: // RES 6, B
-            alu((uint16_t&)b, 0, ALU_RES6);
-            break;
-        case 0xB1: // RES 6, C
-            alu((uint16_t&)c, 0, ALU_RES6);
-            break;
-        case 0xB2: // RES 6, D
-            alu((uint16_t&)d, 0, ALU_RES6);
-            break;
-        case 0xB3: // RES 6, E
-            alu((uint16_t&)e, 0, ALU_RES6);
-            break;
-        case 0xB4: // RES 6, H
-            alu((uint16_t&)h, 0, ALU_RES6);
-            break;
-        case 0xB5: // RES 6, L
-            alu((uint16_t&)l, 0, ALU_RES6);
-            break;
-        case 0xB6: // RES 6, (HL)
-            alu((uint16_t&)memory[l | (h << 8)], 0, ALU_RES6);
-            break;
-        case 0xB7: // RES 6, A
-            alu((uint16_t&)a, 0, ALU_RES6);
-            break;
-        case 0xB8: // RES 7, B
-            alu((uint16_t&)b, 0, ALU_RES7);
-            break;
-        case 0xB9: // RES 7, C
-            alu((uint16_t&)c, 0, ALU_RES7);
-            break;
-        case 0xBA: // RES 7, D
-            alu((uint16_t&)d, 0, ALU_RES7);
-            break;
-        case 0xBB: // RES 7, E
-            alu((uint16_t&)e, 0, ALU_RES7);
-            break;
-        case 0xBC: // RES 7, H
-            alu((uint16_t&)h, 0, ALU_RES7);
-            break;
-        case 0xBD: // RES 7, L
-            alu((uint16_t&)l, 0, ALU_RES7);
-            break;
-        case 0xBE: // RES 7, (HL)
-            alu((uint16_t&)memory[l | (h << 8)], 0, ALU_RES7);
-            break;
-        case 0xBF: // RES 7, A
-            alu((uint16_t&)a, 0, ALU_RES7);
-            break;
-        case 0xC0: // SET 0, B
-            alu((uint16_t&)b, 0, ALU_SET0);
-            break;
-        case 0xC1: // SET 0, C
-            alu((uint16_t&)c, 0, ALU_SET0);
-            break;
-        case 0xC2: // SET 0, D
-            alu((uint16_t&)d, 0, ALU_SET0);
-            break;
-        case 0xC3: // SET 0, E
-            alu((uint16_t&)e, 0, ALU_SET0);
-            break;
-        case 0xC4: // SET 0, H
-            alu((uint16_t&)h, 0, ALU_SET0);
-            break;
-        case 0xC5: // SET 0, L
-            alu((uint16_t&)l, 0, ALU_SET0);
-            break;
-        case 0xC6: // SET 0, (HL)
-            alu((uint16_t&)memory[l | (h << 8)], 0, ALU_SET0);
-            break;
-        case 0xC7: // SET 0, A
-            alu((uint16_t&)a, 0, ALU_SET0);
-            break;
-        case 0xC8: // SET 1, B
-            alu((uint16_t&)b, 0, ALU_SET1);
-            break;
-        case 0xC9: // SET 1, C
-            alu((uint16_t&)c, 0, ALU_SET1);
-            break;
-        case 0xCA: // SET 1, D
-            alu((uint16_t&)d, 0, ALU_SET1);
-            break;
-        case 0xCB: // SET 1, E
-            alu((uint16_t&)e, 0, ALU_SET1);
-            break;
-        case 0xCC: // SET 1, H
-            alu((uint16_t&)h, 0, ALU_SET1);
-            break;
-        case 0xCD: // SET 1, L
-            alu((uint16_t&)l, 0, ALU_SET1);
-            break;
-        case 0xCE: // SET 1, (HL)
-            alu((uint16_t&)memory[l | (h << 8)], 0, ALU_SET1);
-            break;
-        case 0xCF: // SET 1, A
-            alu((uint16_t&)a, 0, ALU_SET1);
-            break;
-        case 0xD0: // SET 2, B
-            alu((uint16_t&)b, 0, ALU_SET2);
-            break;
-        case 0xD1: // SET 2, C
-            alu((uint16_t&)c, 0, ALU_SET2);
-            break;
-        case 0xD2: // SET 2, D
-            alu((uint16_t&)d, 0, ALU_SET2);
-            break;
-        case 0xD3: // SET 2, E
-            alu((uint16_t&)e, 0, ALU_SET2);
-            break;
-        case 0xD4: // SET 2, H
-            alu((uint16_t&)h, 0, ALU_SET2);
-            break;
-        case 0xD5: // SET 2, L
-            alu((uint16_t&)l, 0, ALU_SET2);
-            break;
-        case 0xD6: // SET 2, (HL)
-            alu((uint16_t&)memory[l | (h << 8)], 0, ALU_SET2);
-            break;
-        case 0xD7: // SET 2, A
-            alu((uint16_t&)a, 0, ALU_SET2);
-            break;
-        case 0xD8: // SET 3, B
-            alu((uint16_t&)b, 0, ALU_SET3);
-            break;
-        case 0xD9: // SET 3, C
-            alu((uint16_t&)c, 0, ALU_SET3);
-            break;
-        case 0xDA: // SET 3, D
-            alu((uint16_t&)d, 0, ALU_SET3);
-            break;
-        case 0xDB: // SET 3, E
-            alu((uint16_t&)e, 0, ALU_SET3);
-            break;
-        case 0xDC: // SET 3, H
-            alu((uint16_t&)h, 0, ALU_SET3);
-            break;
-        case 0xDD: // SET 3, L
-            alu((uint16_t&)l, 0, ALU_SET3);
-            break;
-        case 0xDE: // SET 3, (HL)
-            alu((uint16_t&)memory[l | (h << 8)], 0, ALU_SET3);
-            break;
-        case 0xDF: // SET 3, A
-            alu((uint16_t&)a, 0, ALU_SET3);
-            break;
-        case 0xE0: // SET 4, B
-            alu((uint16_t&)b, 0, ALU_SET4);
-            break;
-        case 0xE1: // SET 4, C
-            alu((uint16_t&)c, 0, ALU_SET4);
-            break;
-        case 0xE2: // SET 4, D
-            alu((uint16_t&)d, 0, ALU_SET4);
-            break;
-        case 0xE3: // SET 4, E
-            alu((uint16_t&)e, 0, ALU_SET4);
-            break;
-        case 0xE4: // SET 4, H
-            alu((uint16_t&)h, 0, ALU_SET4);
-            break;
-        case 0xE5: // SET 4, L
-            alu((uint16_t&)l, 0, ALU_SET4);
-            break;
-        case 0xE6: // SET 4, (HL)
-            alu((uint16_t&)memory[l | (h << 8)], 0, ALU_SET4);
-            break;
-        case 0xE7: // SET 4, A
-            alu((uint16_t&)a, 0, ALU_SET4);
-            break;
-        case 0xE8: // SET 5, B
-            alu((uint16_t&)b, 0, ALU_SET5);
-            break;
-        case 0xE9: // SET 5, C
-            alu((uint16_t&)c, 0, ALU_SET5);
-            break;
-        case 0xEA: // SET 5, D
-            alu((uint16_t&)d, 0, ALU_SET5);
-            break;
-        case 0xEB: // SET 5, E
-            alu((uint16_t&)e, 0, ALU_SET5);
-            break;
-        case 0xEC: // SET 5, H
-            alu((uint16_t&)h, 0, ALU_SET5);
-            break;
-        case 0xED: // SET 5, L
-            alu((uint16_t&)l, 0, ALU_SET5);
-            break;
-        case 0xEE: // SET 5, (HL)
-            alu((uint16_t&)memory[l | (h << 8)], 0, ALU_SET5);
-            break;
-        case 0xEF: // SET 5, A
-            alu((uint16_t&)a, 0, ALU_SET5);
-            break;
-        case 0xF0: // SET 6, B
-            alu((uint16_t&)b, 0, ALU_SET6);
-            break;
-        case 0xF1: // SET 6, C
-            alu((uint16_t&)c, 0, ALU_SET6);
-            break;
-        case 0xF2: // SET 6, D
-            alu((uint16_t&)d, 0, ALU_SET6);
-            break;
-        case 0xF3: // SET 6, E
-            alu((uint16_t&)e, 0, ALU_SET6);
-            break;
-        case 0xF4: // SET 6, H
-            alu((uint16_t&)h, 0, ALU_SET6);
-            break;
-        case 0xF5: // SET 6, L
-            alu((uint16_t&)l, 0, ALU_SET6);
-            break;
-        case 0xF6: // SET 6, (HL)
-            alu((uint16_t&)memory[l | (h << 8)], 0, ALU_SET6);
-            break;
-        case 0xF7: // SET 6, A
-            alu((uint16_t&)a, 0, ALU_SET6);
-            break;
-        case 0xF8: // SET 7, B
-            alu((uint16_t&)b, 0, ALU_SET7);
-            break;
-        case 0xF9: // SET 7, C
-            alu((uint16_t&)c, 0, ALU_SET7);
-            break;
-        case 0xFA: // SET 7, D
-            alu((uint16_t&)d, 0, ALU_SET7);
-            break;
-        case 0xFB: // SET 7, E
-            alu((uint16_t&)e, 0, ALU_SET7);
-            break;
-        case 0xFC: // SET 7, H
-            alu((uint16_t&)h, 0, ALU_SET7);
-            break;
-        case 0xFD: // SET 7, L
-            alu((uint16_t&)l, 0, ALU_SET7);
-            break;
-        case 0xFE: // SET 7, (HL)
-            alu((uint16_t&)memory[l | (h << 8)], 0, ALU_SET7);
-            break;
-        case 0xFF: // SET 7, A
-            alu((uint16_t&)a, 0, ALU_SET7);
-            break;
-        default:
-            cout << "Invalid BIT instruction: " << hex << (int)ins << " at PC: " << (int)pc << endl;
+// Flags of INI/IND/OUTI/OUTD: S, Z, 5, 3 from B, N from bit 7 of the byte, H and C from the carry of sum
+inline void Z80_Core::blockIOFlags(uint8_t value, unsigned sum) {
+    lazyFlags = LAZY_NONE;
+    f = flagTables.sz[b] | ((value & 0x80) ? FLAG_N : 0) | ((sum > 0xFF) ? (FLAG_H | FLAG_C) : 0);
+    f |= flagTables.szp[(sum & 7) ^ b] & FLAG_P;
+}
+
+template<uint8_t OP> void Z80_Core::blockInput() { // INI, IND, INIR, INDR
+    constexpr bool repeat = OP & 0x10;
+    constexpr int step = (OP & 0x08) ? -1 : 1;
+    unsigned count = repeat ? min(b ? (unsigned)b : 0x100u, repeatBudget()) : 1;
+    uint8_t value = 0;
+
+    for (unsigned done = 0; done < count; done++) { // every byte is a device access
+        value = inputHandler(c);
+        writeMemory(hl, value);
+        hl += step;
+        b--;
+    }
+
+    blockIOFlags(value, value + (uint8_t)(c + step));
+    if (repeat) repeatBlock<OP>(count, b != 0);
+}
+
+template<uint8_t OP> void Z80_Core::blockOutput() { // OUTI, OUTD, OTIR, OTDR
+    constexpr bool repeat = OP & 0x10;
+    constexpr int step = (OP & 0x08) ? -1 : 1;
+    unsigned count = repeat ? min(b ? (unsigned)b : 0x100u, repeatBudget()) : 1;
+    uint8_t value = 0;
+
+    for (unsigned done = 0; done < count; done++) {
+        value = memory.read(hl);
+        b--;
+        outputHandler(value, c);
+        hl += step;
     }
+
+    blockIOFlags(value, value + l);
+    if (repeat) repeatBlock<OP>(count, b != 0);
 }
 
-void Z80_Core::dd_instruction(uint8_t ins) { // TODO: Implement undocumented instructions
-    switch (ins) {
-        case 0x09: // ADD IX, BC
-            alu(ix, convToRegPair(c, b), ALU_ADD16);
-            break;
-        case 0x19: // ADD IX, DE
-            alu(ix, convToRegPair(e, d), ALU_ADD16);
-            break;
-        case 0x21: // LD IX, nn
-            w = fetchOperand(); // low byte
-            z = fetchOperand(); // high byte
-            ix = w | (z << 8);
-            break;
-        case 0x22: // LD (nn), IX
-            w = fetchOperand(); // low byte
-            z = fetchOperand(); // high byte
-            memory[w | (z << 8)] = l;
-            memory[(w | (z << 8)) + 1] = h;
-            break;
-        case 0x23: // INC IX
-            alu(ix, 0, ALU_INC16);
-            break;
-        case 0x29: // ADD IX, IX
-            alu(ix, ix, ALU_ADD16);
-            break;
-        case 0x2A: // LD IX, (nn)
-            w = fetchOperand(); // low byte
-            z = fetchOperand(); // high byte
-            ix = (w | (z << 8));
-            break;
-        case 0x2B: // DEC IX
-            alu(ix, 0, ALU_DEC16);
-            break;
-        case 0x34: // INC (IX+d)
-            w = (int8_t)fetchOperand();
-            alu((uint16_t&)memory[ix+w], 0 , ALU_INC8);
-            break;
-        case 0x35: // DEC (IX+d)
-            w = (int8_t)fetchOperand();
-            alu((uint16_t&)memory[ix+w], 0 , ALU_DEC8);
-            break;
-        case 0x36: // LD (IX+d), n
-            w = (int8_t)fetchOperand();
-            memory[ix+w] = fetchOperand();
-            break;
-        case 0x39: // ADD IX, SP
-            alu(ix, sp, ALU_ADD16);
-            break;
-        case 0x46: // LD B, (IX+d)
-            w = (int8_t)fetchOperand();
-            b = memory[ix+w];
-            break;
-        case 0x4E: // LD C, (IX+d)
-            w = (int8_t)fetchOperand();
-            c = memory[ix+w];
-            break;
-        case 0x56: // LD D, (IX+d)
-            w = (int8_t)fetchOperand();
-            d = memory[ix+w];
-            break;
-        case 0x5E: // LD E, (IX+d)
-            w = (int8_t)fetchOperand();
-            e = memory[ix+w];
-            break;
-        case 0x66: // LD H, (IX+d)
-            w = (int8_t)fetchOperand();
-            h = memory[ix+w];
-            break;
-        case 0x70: // LD (IX+d), B
-            w = (int8_t)fetchOperand();
-            memory[ix+w] = b;
-            break;
-        case 0x71: // LD (IX+d), C
-            w = (int8_t)fetchOperand();
-            memory[ix+w] = c;
-            break;
-        case 0x72: // LD (IX+d), D
-            w = (int8_t)fetchOperand();
-            memory[ix+w] = d;
-            break;
-        case 0x73: // LD (IX+d), E
-            w = (int8_t)fetchOperand();
-            memory[ix+w] = e;
-            break;
-        case 0x74: // LD (IX+d), H
-            w = (int8_t)fetchOperand();
-            memory[ix+w] = h;
-            break;
-        case 0x75: // LD (IX+d), L
-            w = (int8_t)fetchOperand();
-            memory[ix+w] = l;
-            break;
-        case 0x77: // LD (IX+d), A
-            w = (int8_t)fetchOperand();
-            memory[ix+w] = a;
-            break;
-        case 0x7e: // LD A, (IX+d)
-            w = (int8_t)fetchOperand();
-            a = memory[ix+w];
-            break;
-        case 0x86: // ADD A, (IX+d)
-            w = (int8_t)fetchOperand();
-            alu((uint16_t&)a, memory[ix+w], ALU_ADD8);
-            break;
-        case 0x8e: // ADC A, (IX+d)
-            w = (int8_t)fetchOperand();
-            alu((uint16_t&)a, memory[ix+w], ALU_ADC8);
-            break;
-        case 0x96: // SUB (IX+d)
-            w = (int8_t)fetchOperand();
-            alu((uint16_t&)a, memory[ix+w], ALU_SUB8);
-            break;
-        case 0x9e: // SBC (IX+d)
-            w = (int8_t)fetchOperand();
-            alu((uint16_t&)a, memory[ix+w], ALU_SBC8);
-            break;
-        case 0xA6: // AND (IX+d)
-            w = (int8_t)fetchOperand();
-            alu((uint16_t&)a, memory[ix+w], ALU_AND8);
-            break;
-        case 0xAE: // XOR (IX+d)
-            w = (int8_t)fetchOperand();
-            alu((uint16_t&)a, memory[ix+w], ALU_XOR8);
-            break;
-        case 0xB6: // OR (IX+d)
-            w = (int8_t)fetchOperand();
-            alu((uint16_t&)a, memory[ix+w], ALU_OR8);
-            break;
-        case 0xBE: // CP (IX+d)
-            w = (int8_t)fetchOperand();
-            alu((uint16_t&)a, memory[ix+w], ALU_CP8);
-            break;
-        case 0xCB: // IX Bit
-            cout << "IX BIT Instructions not implemented";
-            break;
-        case 0xE1: // POP IX
-            ix = pop();
-            break;
-        case 0xE3: // EX (SP), IX
-            w = ix & 0xff;
-            z = ix >> 8;
-            ix = memory[sp] | (memory[sp+1] << 8);
-            memory[sp] = w;
-            memory[sp+1] = z;
-            break;
-        case 0xE5: // PUSH IX
-            push(ix);
-            break;
-        case 0xE9: // JP (IX)
-            pc = ix;
-            break;
-        case 0xF9: // LD SP, IX
-            sp = ix;
-            break;
-        default:
-            cout << "Invalid DD instruction: " << hex << (int)ins << " at PC: " << (int)pc << endl;
+template<> void Z80_Core::ed_op<0xA0>() { // LDI
+    blockTransfer<0xA0>();
+}
+
+template<> void Z80_Core::ed_op<0xA1>() { // CPI
+    blockCompare<0xA1>();
+}
+
+template<> void Z80_Core::ed_op<0xA2>() { // INI
+    blockInput<0xA2>();
+}
+
+template<> void Z80_Core::ed_op<0xA3>() { // OUTI
+    blockOutput<0xA3>();
+}
+
+template<> void Z80_Core::ed_op<0xA8>() { // LDD
+    blockTransfer<0xA8>();
+}
+
+template<> void Z80_Core::ed_op<0xA9>() { // CPD
+    blockCompare<0xA9>();
+}
+
+template<> void Z80_Core::ed_op<0xAA>() { // IND
+    blockInput<0xAA>();
+}
+
+template<> void Z80_Core::ed_op<0xAB>() { // OUTD
+    blockOutput<0xAB>();
+}
+
+template<> void Z80_Core::ed_op<0xB0>() { // LDIR
+    blockTransfer<0xB0>();
+}
+
+template<> void Z80_Core::ed_op<0xB1>() { // CPIR
+    blockCompare<0xB1>();
+}
+
+template<> void Z80_Core::ed_op<0xB2>() { // INIR
+    blockInput<0xB2>();
+}
+
+template<> void Z80_Core::ed_op<0xB3>() { // OTIR
+    blockOutput<0xB3>();
+}
+
+template<> void Z80_Core::ed_op<0xB8>() { // LDDR
+    blockTransfer<0xB8>();
+}
+
+template<> void Z80_Core::ed_op<0xB9>() { // CPDR
+    blockCompare<0xB9>();
+}
+
+template<> void Z80_Core::ed_op<0xBA>() { // INDR
+    blockInput<0xBA>();
+}
+
+template<> void Z80_Core::ed_op<0xBB>() { // OTDR
+    blockOutput<0xBB>();
+}
+
+
+/* CB PREFIX, BIT INSTRUCTIONS */
+
+/*
+    The CB opcode space is regular, so it's decoded instead of listed:
+    bits 7-6 pick rotate/shift, BIT, RES or SET, bits 5-3 the shift or the
+    bit number and bits 2-0 the register, 6 being (HL). Rotates and shifts
+    differ only in their direction and in what is shifted in.
+*/
+
+// Register operand of a CB opcode by bits 2-0, (HL) has no entry
+uint8_t Z80_Core::* const Z80_Core::registers8[8] = {
+    &Z80_Core::b, &Z80_Core::c, &Z80_Core::d, &Z80_Core::e, &Z80_Core::h, &Z80_Core::l, nullptr, &Z80_Core::a
+};
+
+// Bit shifted in by RLC, RRC, RL, RR, SLA, SRA, SLL and SRL: 0, 1, carry, bit 7 or bit 0 of the operand
+#define SHIFT_IN_0 0
+#define SHIFT_IN_1 1
+#define SHIFT_IN_CARRY 2
+#define SHIFT_IN_BIT7 3
+#define SHIFT_IN_BIT0 4
+static constexpr uint8_t cbShiftIn[8] = {
+    SHIFT_IN_BIT7, SHIFT_IN_BIT0, SHIFT_IN_CARRY, SHIFT_IN_CARRY, SHIFT_IN_0, SHIFT_IN_BIT7, SHIFT_IN_1, SHIFT_IN_0
+};
+
+inline uint8_t Z80_Core::cb_operate(uint8_t ins, uint8_t value) { // returns the new value, BIT returns it unchanged
+    uint8_t n = (ins >> 3) & 7;
+    switch (ins >> 6) {
+        case 0: { // RLC, RRC, RL, RR, SLA, SRA, SLL, SRL, odd ones shift right
+            uint8_t in[5] = { 0, 1, flagC(), uint8_t(value >> 7), uint8_t(value & 0x01) };
+            uint8_t shifted = in[cbShiftIn[n]];
+            uint8_t result = (n & 1) ? (value >> 1) | (shifted << 7) : (value << 1) | shifted;
+            lazyFlags = LAZY_NONE;
+            f = flagTables.szp[result] | ((n & 1) ? value & 0x01 : value >> 7);
+            return result;
+        }
+        case 1: { // BIT n
+            materializeFlags();
+            uint8_t bit = value & (1 << n);
+            f = (f & FLAG_C) | FLAG_H | (value & (FLAG_5 | FLAG_3)) | (bit ? (bit & FLAG_S) : (FLAG_Z | FLAG_P));
+            return value;
+        }
+        case 2: // RES n
+            return value & ~(1 << n);
+        default: // SET n
+            return value | (1 << n);
     }
 }
 
-void Z80_Core::fd_instruction(uint8_t ins) { // TODO: Implement undocumented instructions
-    switch (ins) {
-        case 0x09: // ADD iy, BC
-            alu(iy, convToRegPair(c, b), ALU_ADD16);
-            break;
-        case 0x19: // ADD iy, DE
-            alu(iy, convToRegPair(e, d), ALU_ADD16);
-            break;
-        case 0x21: // LD iy, nn
-            w = fetchOperand(); // low byte
-            z = fetchOperand(); // high byte
-            iy = w | (z << 8);
-            break;
-        case 0x22: // LD (nn), iy
-            w = fetchOperand(); // low byte
-            z = fetchOperand(); // high byte
-            memory[w | (z << 8)] = l;
-            memory[(w | (z << 8)) + 1] = h;
-            break;
-        case 0x23: // INC iy
-            alu(iy, 0, ALU_INC16);
-            break;
-        case 0x29: // ADD iy, iy
-            alu(iy, iy, ALU_ADD16);
-            break;
-        case 0x2A: // LD iy, (nn)
-            w = fetchOperand(); // low byte
-            z = fetchOperand(); // high byte
-            iy = (w | (z << 8));
-            break;
-        case 0x2B: // DEC iy
-            alu(iy, 0, ALU_DEC16);
-            break;
-        case 0x34: // INC (iy+d)
-            w = (int8_t)fetchOperand();
-            alu((uint16_t&)memory[iy+w], 0 , ALU_INC8);
-            break;
-        case 0x35: // DEC (iy+d)
-            w = (int8_t)fetchOperand();
-            alu((uint16_t&)memory[iy+w], 0 , ALU_DEC8);
-            break;
-        case 0x36: // LD (iy+d), n
-            w = (int8_t)fetchOperand();
-            memory[iy+w] = fetchOperand();
-            break;
-        case 0x39: // ADD iy, SP
-            alu(iy, sp, ALU_ADD16);
-            break;
-        case 0x46: // LD B, (iy+d)
-            w = (int8_t)fetchOperand();
-            b = memory[iy+w];
-            break;
-        case 0x4E: // LD C, (iy+d)
-            w = (int8_t)fetchOperand();
-            c = memory[iy+w];
-            break;
-        case 0x56: // LD D, (iy+d)
-            w = (int8_t)fetchOperand();
-            d = memory[iy+w];
-            break;
-        case 0x5E: // LD E, (iy+d)
-            w = (int8_t)fetchOperand();
-            e = memory[iy+w];
-            break;
-        case 0x66: // LD H, (iy+d)
-            w = (int8_t)fetchOperand();
-            h = memory[iy+w];
-            break;
-        case 0x70: // LD (iy+d), B
-            w = (int8_t)fetchOperand();
-            memory[iy+w] = b;
-            break;
-        case 0x71: // LD (iy+d), C
-            w = (int8_t)fetchOperand();
-            memory[iy+w] = c;
-            break;
-        case 0x72: // LD (iy+d), D
-            w = (int8_t)fetchOperand();
-            memory[iy+w] = d;
-            break;
-        case 0x73: // LD (iy+d), E
-            w = (int8_t)fetchOperand();
-            memory[iy+w] = e;
-            break;
-        case 0x74: // LD (iy+d), H
-            w = (int8_t)fetchOperand();
-            memory[iy+w] = h;
-            break;
-        case 0x75: // LD (iy+d), L
-            w = (int8_t)fetchOperand();
-            memory[iy+w] = l;
-            break;
-        case 0x77: // LD (iy+d), A
-            w = (int8_t)fetchOperand();
-            memory[iy+w] = a;
-            break;
-        case 0x7e: // LD A, (iy+d)
-            w = (int8_t)fetchOperand();
-            a = memory[iy+w];
-            break;
-        case 0x86: // ADD A, (iy+d)
-            w = (int8_t)fetchOperand();
-            alu((uint16_t&)a, memory[iy+w], ALU_ADD8);
-            break;
-        case 0x8e: // ADC A, (iy+d)
-            w = (int8_t)fetchOperand();
-            alu((uint16_t&)a, memory[iy+w], ALU_ADC8);
-            break;
-        case 0x96: // SUB (iy+d)
-            w = (int8_t)fetchOperand();
-            alu((uint16_t&)a, memory[iy+w], ALU_SUB8);
-            break;
-        case 0x9e: // SBC (iy+d)
-            w = (int8_t)fetchOperand();
-            alu((uint16_t&)a, memory[iy+w], ALU_SBC8);
-            break;
-        case 0xA6: // AND (iy+d)
-            w = (int8_t)fetchOperand();
-            alu((uint16_t&)a, memory[iy+w], ALU_AND8);
-            break;
-        case 0xAE: // XOR (iy+d)
-            w = (int8_t)fetchOperand();
-            alu((uint16_t&)a, memory[iy+w], ALU_XOR8);
-            break;
-        case 0xB6: // OR (iy+d)
-            w = (int8_t)fetchOperand();
-            alu((uint16_t&)a, memory[iy+w], ALU_OR8);
-            break;
-        case 0xBE: // CP (iy+d)
-            w = (int8_t)fetchOperand();
-            alu((uint16_t&)a, memory[iy+w], ALU_CP8);
-            break;
-        case 0xCB: // iy Bit
-            cout << "iy BIT Instructions not implemented";
-            break;
-        case 0xE1: // POP iy
-            iy = pop();
-            break;
-        case 0xE3: // EX (SP), iy
-            // TODO
-            break;
-        case 0xE5: // PUSH iy
-            push(iy);
-            break;
-        case 0xE9: // JP (iy)
-            pc = iy;
-            break;
-        case 0xF9: // LD SP, iy
-            sp = iy;
+
+/* DD/FD PREFIX, IX AND IY INSTRUCTIONS */
+
+/*
+    DD and FD share one implementation that runs the unprefixed handler with
+    HL standing in for the index register. Forms using HL, H or L get IX/IY
+    swapped into HL for the duration of the handler (undocumented IXH/IXL
+    included), (HL) forms get HL pointed at IX+d. Everything else ignores the
+    prefix, like the CPU does. decodeDD tells the forms apart at compile time.
+*/
+template<uint8_t OP, bool IY> void Z80_Core::index_op() {
+    uint16_t& index = IY ? iy : ix;
+
+    if constexpr (OP == 0xCB) {
+        index_cb<IY>();
+    } else if constexpr (OP == 0x66 || OP == 0x6E || OP == 0x74 || OP == 0x75) { // H and L are the real ones here
+        uint16_t address = index + (int8_t)fetchOperand();
+        if constexpr (OP == 0x66) h = memory.read(address); // LD H, (IX+d)
+        if constexpr (OP == 0x6E) l = memory.read(address); // LD L, (IX+d)
+        if constexpr (OP == 0x74) writeMemory(address, h); // LD (IX+d), H
+        if constexpr (OP == 0x75) writeMemory(address, l); // LD (IX+d), L
+    } else if constexpr (decodeDD[OP] & DECODE_INDEXED) {
+        uint16_t saved = hl;
+        hl = index + (int8_t)fetchOperand();
+        base_op<OP>();
+        hl = saved;
+    } else if constexpr (decodeDD[OP] & DECODE_INDEX_HL) {
+        swap(hl, index);
+        base_op<OP>();
+        swap(hl, index);
+    } else {
+        base_op<OP>();
+    }
+}
+
+template<bool IY> void Z80_Core::index_cb() { // DDCB/FDCB d op
+    uint16_t& index = IY ? iy : ix;
+    uint16_t address = index + (int8_t)fetchOperand();
+    uint8_t ins = fetchOperand();
+    cycles += cyclesDDCB[ins];
+
+    uint8_t result = cb_operate(ins, memory.read(address));
+    if ((ins & 0xC0) == 0x40) return; // BIT only reads
+    writeMemory(address, result);
+    if ((ins & 7) != 6) this->*registers8[ins & 7] = result; // undocumented: the result is also copied to the register
+}
+
+
+/* DISPATCH */
+
+// X-macro over all 256 opcodes, used to build the handler tables, the switch and the threaded code
+#define Z80_OPCODES(X) \
+    X(00) X(01) X(02) X(03) X(04) X(05) X(06) X(07) X(08) X(09) X(0A) X(0B) X(0C) X(0D) X(0E) X(0F) \
+    X(10) X(11) X(12) X(13) X(14) X(15) X(16) X(17) X(18) X(19) X(1A) X(1B) X(1C) X(1D) X(1E) X(1F) \
+    X(20) X(21) X(22) X(23) X(24) X(25) X(26) X(27) X(28) X(29) X(2A) X(2B) X(2C) X(2D) X(2E) X(2F) \
+    X(30) X(31) X(32) X(33) X(34) X(35) X(36) X(37) X(38) X(39) X(3A) X(3B) X(3C) X(3D) X(3E) X(3F) \
+    X(40) X(41) X(42) X(43) X(44) X(45) X(46) X(47) X(48) X(49) X(4A) X(4B) X(4C) X(4D) X(4E) X(4F) \
+    X(50) X(51) X(52) X(53) X(54) X(55) X(56) X(57) X(58) X(59) X(5A) X(5B) X(5C) X(5D) X(5E) X(5F) \
+    X(60) X(61) X(62) X(63) X(64) X(65) X(66) X(67) X(68) X(69) X(6A) X(6B) X(6C) X(6D) X(6E) X(6F) \
+    X(70) X(71) X(72) X(73) X(74) X(75) X(76) X(77) X(78) X(79) X(7A) X(7B) X(7C) X(7D) X(7E) X(7F) \
+    X(80) X(81) X(82) X(83) X(84) X(85) X(86) X(87) X(88) X(89) X(8A) X(8B) X(8C) X(8D) X(8E) X(8F) \
+    X(90) X(91) X(92) X(93) X(94) X(95) X(96) X(97) X(98) X(99) X(9A) X(9B) X(9C) X(9D) X(9E) X(9F) \
+    X(A0) X(A1) X(A2) X(A3) X(A4) X(A5) X(A6) X(A7) X(A8) X(A9) X(AA) X(AB) X(AC) X(AD) X(AE) X(AF) \
+    X(B0) X(B1) X(B2) X(B3) X(B4) X(B5) X(B6) X(B7) X(B8) X(B9) X(BA) X(BB) X(BC) X(BD) X(BE) X(BF) \
+    X(C0) X(C1) X(C2) X(C3) X(C4) X(C5) X(C6) X(C7) X(C8) X(C9) X(CA) X(CB) X(CC) X(CD) X(CE) X(CF) \
+    X(D0) X(D1) X(D2) X(D3) X(D4) X(D5) X(D6) X(D7) X(D8) X(D9) X(DA) X(DB) X(DC) X(DD) X(DE) X(DF) \
+    X(E0) X(E1) X(E2) X(E3) X(E4) X(E5) X(E6) X(E7) X(E8) X(E9) X(EA) X(EB) X(EC) X(ED) X(EE) X(EF) \
+    X(F0) X(F1) X(F2) X(F3) X(F4) X(F5) X(F6) X(F7) X(F8) X(F9) X(FA) X(FB) X(FC) X(FD) X(FE) X(FF)
+
+#define BASE_ENTRY(n) &Z80_Core::base_op<0x##n>,
+#define ED_ENTRY(n) &Z80_Core::ed_op<0x##n>,
+#define DD_ENTRY(n) &Z80_Core::index_op<0x##n, false>,
+#define FD_ENTRY(n) &Z80_Core::index_op<0x##n, true>,
+const Z80_Core::Handler Z80_Core::baseTable[256] = { Z80_OPCODES(BASE_ENTRY) };
+const Z80_Core::Handler Z80_Core::edTable[256] = { Z80_OPCODES(ED_ENTRY) };
+const Z80_Core::Handler Z80_Core::ddTable[256] = { Z80_OPCODES(DD_ENTRY) };
+const Z80_Core::Handler Z80_Core::fdTable[256] = { Z80_OPCODES(FD_ENTRY) };
+#undef BASE_ENTRY
+#undef ED_ENTRY
+#undef DD_ENTRY
+#undef FD_ENTRY
+
+void Z80_Core::decode_execute(uint8_t instruction) {
+    startInstruction(instruction, (pc - 1) & 0xFFFF);
+    (this->*baseTable[instruction])();
+}
+
+void Z80_Core::decode_switch(uint8_t instruction) {
+    startInstruction(instruction, (pc - 1) & 0xFFFF);
+    switch (instruction) {
+        #define BASE_CASE(n) case 0x##n: base_op<0x##n>(); break;
+        Z80_OPCODES(BASE_CASE)
+        #undef BASE_CASE
+    }
+}
+
+void Z80_Core::run_threaded() {
+#if defined(__GNUC__)
+    // Every handler ends with its own copy of the dispatch jump, so each one gets its own branch history
+    #define THREADED_LABEL(n) &&op_##n,
+    static void* const labels[256] = { Z80_OPCODES(THREADED_LABEL) };
+    #undef THREADED_LABEL
+    uint8_t opcode;
+
+    #define THREADED_NEXT() \
+        pollDevices(); \
+        if (halt) return; \
+        opcode = fetchOperand(); \
+        startInstruction(opcode, (pc - 1) & 0xFFFF); \
+        goto *labels[opcode];
+
+    if (halt) return;
+    opcode = fetchOperand();
+    startInstruction(opcode, (pc - 1) & 0xFFFF);
+    goto *labels[opcode];
+
+    #define THREADED_OP(n) op_##n: base_op<0x##n>(); THREADED_NEXT()
+    Z80_OPCODES(THREADED_OP)
+    #undef THREADED_OP
+    #undef THREADED_NEXT
+#else
+    while (!halt) {
+        decode_execute(fetchOperand());
+        pollDevices();
+    }
+#endif
+}
+
+void Z80_Core::ed_instruction(uint8_t ins) {
+    cycles += cyclesED[ins];
+    (this->*edTable[ins])();
+}
+
+void Z80_Core::cb_instruction(uint8_t ins) {
+    cycles += cyclesCB[ins];
+    uint8_t reg = ins & 7;
+    if (reg == 6) { // (HL)
+        uint8_t result = cb_operate(ins, memory.read(hl));
+        if ((ins & 0xC0) != 0x40) writeMemory(hl, result);
+    } else {
+        uint8_t& value = this->*registers8[reg];
+        value = cb_operate(ins, value);
+    }
+}
+
+template<bool IY> void Z80_Core::index_instruction(uint8_t ins) {
+    cycles += cyclesDD[ins];
+    (this->*(IY ? fdTable : ddTable)[ins])();
+}
+
+
+/* SUPERINSTRUCTIONS */
+
+/*
+    A fused pair runs both instructions from one dispatch. Everything else stays
+    per instruction: the second one is started, timed and traced on its own and
+    devices are polled in between, so an interrupt can still come in after the
+    first one. Then the pair stops there and the block loop leaves it, like a
+    store into decoded code or HALT would.
+*/
+
+template<uint16_t KEY> inline void Z80_Core::fusedStep() {
+    constexpr uint8_t prefix = KEY >> 8, OP = KEY & 0xFF;
+    if constexpr (prefix == 0xED) ed_op<OP>();
+    else if constexpr (prefix == 0xDD) index_op<OP, false>();
+    else if constexpr (prefix == 0xFD) index_op<OP, true>();
+    else base_op<OP>();
+}
+
+template<uint16_t FIRST, uint16_t SECOND> void Z80_Core::fused_op() {
+    constexpr uint8_t prefix = SECOND >> 8, OP = SECOND & 0xFF;
+    constexpr uint8_t info = (prefix == 0xED) ? decodeED[OP] : prefix ? decodeDD[OP] : decodeMain[OP];
+    constexpr unsigned length = (prefix ? 2 : 1) + (info & DECODE_OPERANDS);
+    unsigned next = pc; // past both
+    unsigned second = (next - length) & 0xFFFF;
+
+    pc = second;
+    fusedStep<FIRST>();
+    pollDevices();
+    if (halt || pc != second || codeModified) return; // the block loop sees pc != next and leaves
+
+    startInstruction(prefix ? prefix : OP, second);
+    if constexpr (prefix == 0xED) cycles += cyclesED[OP];
+    else if constexpr (prefix) cycles += cyclesDD[OP];
+    pc = next;
+    fusedStep<SECOND>();
+    fusedRuns++;
+}
+
+#define FUSED_ENTRY(first, second) {first, second, &Z80_Core::fused_op<first, second>},
+const Z80_Core::Z80_Fusion Z80_Core::fusions[] = { Z80_FUSED_PAIRS(FUSED_ENTRY) };
+#undef FUSED_ENTRY
+
+bool Z80_Core::fusePair(Z80_Decoded& first, const Z80_Decoded& second) {
+    if (first.fusedKey != FUSE_NONE || (first.info & (DECODE_JUMP | DECODE_IO)) || (second.info & DECODE_IO)) return false;
+    unsigned count = first.info & DECODE_OPERANDS;
+    unsigned total = count + (second.info & DECODE_OPERANDS);
+    if (total > sizeof(first.operands)) return false;
+
+    for (const Z80_Fusion& fusion : fusions) {
+        if (fusion.first != first.key || fusion.second != second.key) continue;
+        for (unsigned n = count; n < total; n++) first.operands[n] = second.operands[n - count];
+        first.handler = fusion.handler;
+        first.next = second.next;
+        first.info = (second.info & ~DECODE_OPERANDS) | total; // ends the block when the second one does
+        first.fusedKey = second.key;
+        return true;
+    }
+    return false;
+}
+
+// Counts a dispatch of run_block() and the pairs it ran, previous is the key of the instruction before it
+void Z80_Core::profileOp(const Z80_Decoded& op, bool second, uint32_t& previous) {
+    profileDispatches++;
+    profileInstructions += second ? 2 : 1;
+    if (previous != FUSE_NONE) pairCounts[previous << 16 | op.key]++;
+    previous = op.key;
+    if (second) {
+        pairCounts[(uint32_t)op.key << 16 | op.fusedKey]++;
+        previous = op.fusedKey;
+    }
+}
+
+static string instructionName(uint16_t key) {
+    ostringstream name;
+    if ((key >> 8) == 0) {
+        auto it = Opcodes.find(key);
+        if (it != Opcodes.end()) return it->second;
+    }
+    name << hex << uppercase << setfill('0');
+    if (key >> 8) name << setw(2) << (key >> 8) << " ";
+    name << setw(2) << (key & 0xFF);
+    return name.str();
+}
+
+void Z80_Core::printPairProfile(ostream& out, unsigned top) {
+    vector<pair<uint64_t, uint32_t>> pairs;
+    for (const auto& entry : pairCounts) pairs.push_back(make_pair(entry.second, entry.first));
+    sort(pairs.rbegin(), pairs.rend());
+    if (pairs.size() > top) pairs.resize(top);
+
+    uint64_t saved = profileInstructions - profileDispatches;
+    out << dec << "Pre-decoded: " << profileInstructions << " instructions in " << profileDispatches << " dispatches";
+    if (profileInstructions) out << fixed << setprecision(1) << ", fusion saved " << saved << " (" << 100.0 * saved / profileInstructions << "%)";
+    out << endl;
+
+    for (const auto& entry : pairs) {
+        uint16_t first = entry.second >> 16, second = entry.second & 0xFFFF;
+        bool fused = false;
+        for (const Z80_Fusion& fusion : fusions) fused |= fusion.first == first && fusion.second == second;
+        ostringstream name;
+        name << instructionName(first) << " / " << instructionName(second);
+        out << right << setw(12) << entry.first << fixed << setprecision(1) << setw(7) << 100.0 * entry.first / profileInstructions << "%  ";
+        out << left << setw(32) << name.str() << (fused ? "fused" : "") << endl;
+    }
+    out << right;
+}
+
+// Pairs of the profile that fusePair() can merge, hottest first, as Z80_FUSED_PAIRS for fusion.h
+void Z80_Core::printFusionList(ostream& out, unsigned top) {
+    auto info = [](uint16_t key) -> int { // decode flags, -1 if the instruction can't be in a pair
+        uint8_t prefix = key >> 8, opcode = key & 0xFF;
+        if (prefix == 0) return (decodeMain[opcode] & DECODE_PREFIX) ? -1 : decodeMain[opcode];
+        if (prefix == 0xED) return decodeED[opcode];
+        if ((prefix == 0xDD || prefix == 0xFD) && !(decodeDD[opcode] & DECODE_PREFIX)) return decodeDD[opcode];
+        return -1; // CB forms are decoded when they run
+    };
+    vector<pair<uint64_t, uint32_t>> pairs;
+    for (const auto& entry : pairCounts) pairs.push_back(make_pair(entry.second, entry.first));
+    sort(pairs.rbegin(), pairs.rend());
+
+    out << "#define Z80_FUSED_PAIRS(X) \\" << endl;
+    unsigned listed = 0;
+    for (const auto& entry : pairs) {
+        if (listed == top) break;
+        uint16_t first = entry.second >> 16, second = entry.second & 0xFFFF;
+        int a = info(first), b = info(second);
+        if (a < 0 || b < 0 || (a & (DECODE_JUMP | DECODE_IO)) || (b & DECODE_IO)) continue;
+        bool branch = first == 0x10 || (first & 0xE7) == 0x20 || (first & 0xC3) == 0xC0; // DJNZ, JR cc, RET cc, JP cc, CALL cc
+        if (branch) continue; // the first one always falls through to the second
+        if ((a & DECODE_OPERANDS) + (b & DECODE_OPERANDS) > 3) continue; // Z80_Decoded::operands holds both
+        out << "    X(0x" << hex << uppercase << setfill('0') << setw(4) << first << ", 0x" << setw(4) << second << ") /* ";
+        out << dec << nouppercase << setfill(' ') << instructionName(first) << " / " << instructionName(second) << " */ \\" << endl;
+        listed++;
+    }
+    out << endl;
+}
+
+// Key and length of the instruction in bytes, prefix chains are one byte per prefix like the interpreter runs them
+static unsigned traceDecode(const uint8_t* bytes, uint16_t& key) {
+    uint8_t info = decodeMain[bytes[0]];
+    key = bytes[0];
+    if (!(info & DECODE_PREFIX)) return 1 + (info & DECODE_OPERANDS);
+    if (bytes[0] == 0xCB) {
+        key = 0xCB00 | bytes[1];
+        return 2;
+    }
+    if (bytes[0] == 0xED) {
+        key = 0xED00 | bytes[1];
+        return 2 + (decodeED[bytes[1]] & DECODE_OPERANDS);
+    }
+    info = decodeDD[bytes[1]];
+    if (bytes[1] == 0xCB) { // DD CB d op
+        key = bytes[0] << 8 | 0xCB;
+        return 4;
+    }
+    if (info & DECODE_PREFIX) return 1;
+    key = bytes[0] << 8 | bytes[1];
+    return 2 + (info & DECODE_OPERANDS);
+}
+
+void Z80_Core::dumpTrace(ostream& out) {
+    unsigned size = trace.size();
+    out << dec << "Last " << size << " of " << trace.count << " instructions:" << endl;
+    out << hex << uppercase << setfill('0');
+    for (unsigned i = 0; i < size; i++) {
+        const Z80_TraceEntry& entry = trace.at(i);
+        uint16_t key;
+        unsigned length = traceDecode(entry.bytes, key);
+        ostringstream bytes;
+        bytes << hex << uppercase << setfill('0');
+        for (unsigned n = 0; n < length; n++) bytes << (n ? " " : "") << setw(2) << (unsigned)entry.bytes[n];
+        out << setw(4) << entry.pc << "  " << setfill(' ') << left << setw(12) << bytes.str() << setw(20) << instructionName(key) << right << setfill('0');
+        if (entry.registers) {
+            out << " AF=" << setw(4) << entry.af << " BC=" << setw(4) << entry.bc << " DE=" << setw(4) << entry.de << " HL=" << setw(4) << entry.hl;
+            out << " IX=" << setw(4) << entry.ix << " IY=" << setw(4) << entry.iy << " SP=" << setw(4) << entry.sp;
+        }
+        out << endl;
+    }
+    out << dec << nouppercase << setfill(' ');
+}
+
+
+/* PRE-DECODED BLOCKS */
+
+/*
+    DISPATCH_CACHED decodes straight-line code once into a list of handler
+    pointers with their operands already extracted and runs it from there.
+    A block ends at an instruction that never falls through or at I/O,
+    conditional branches stay inside the block and leave it only when taken. Every byte
+    that was decoded is marked in codeMap, a store to a marked byte drops the
+    blocks covering it and the running block stops after that instruction.
+*/
+
+Z80_Core::Z80_Block* Z80_Core::findBlock(unsigned address) {
+    if (!retiredBlocks.empty()) { // nothing runs from them anymore
+        for (Z80_Block* block : retiredBlocks) delete block;
+        retiredBlocks.resize(0);
+    }
+    if (address >= MEMORY_SIZE) return nullptr;
+
+    Z80_Block* block = blockAt(address);
+    if (block == nullptr) {
+        block = decodeBlock(address);
+    }
+    return block;
+}
+
+Z80_Core::Z80_Block* Z80_Core::decodeBlock(unsigned address) {
+    Z80_Block* block = new Z80_Block;
+    block->start = address;
+    block->hits = 0;
+    block->native = nullptr;
+
+    while (block->ops.size() < BLOCK_MAX_OPS) {
+        if (breakpoints && !block->ops.empty() && breakpointAt(address)) break; // the run loop stops there
+        if (memory.attributes(address) == PAGE_MMIO) break; // fetching from a device has side effects, interpreted
+        Z80_Decoded op;
+        uint8_t opcode = memory.peek(address);
+        uint8_t info = decodeMain[opcode];
+        unsigned length = 1;
+
+        op.opcode = opcode;
+        op.cycles = 0;
+        op.key = opcode;
+        op.fusedKey = FUSE_NONE;
+        if (info & DECODE_PREFIX) {
+            if (address + 1 >= MEMORY_SIZE) break;
+            uint8_t sub = memory.peek(address + 1);
+            length = 2;
+            if (opcode == 0xDD || opcode == 0xFD) {
+                info = decodeDD[sub];
+                if ((info & DECODE_PREFIX) && sub != 0xCB) break; // prefix chains are interpreted
+                op.handler = (opcode == 0xDD) ? ddTable[sub] : fdTable[sub];
+                op.key = opcode << 8 | sub;
+                op.cycles = cyclesDD[sub]; // DDCB adds its own from the opcode after the displacement
+            } else if (opcode == 0xCB) { // decoded when it runs, the opcode byte is its operand
+                op.handler = baseTable[0xCB];
+                op.key = 0xCB00 | sub; // for the profile, CB forms aren't fused
+                length = 1;
+                info = 1;
+            } else {
+                op.handler = edTable[sub];
+                op.key = 0xED00 | sub;
+                op.cycles = cyclesED[sub];
+                info = decodeED[sub];
+            }
+        } else {
+            op.handler = baseTable[opcode];
+        }
+
+        op.info = info;
+        unsigned count = info & DECODE_OPERANDS;
+        if (address + length + count > MEMORY_SIZE) break;
+        if (memory.attributes(address + length + count - 1) == PAGE_MMIO) break;
+        for (unsigned n = 0; n < count; n++) {
+            op.operands[n] = memory.peek(address + length + n);
+        }
+        address += length + count;
+        op.next = address & 0xFFFF;
+        if (!(fuse && dispatch != DISPATCH_JIT && !block->ops.empty() && fusePair(block->ops.back(), op))) {
+            block->ops.push_back(op);
+        }
+        if (info & (DECODE_JUMP | DECODE_IO)) break;
+    }
+
+    if (block->ops.empty()) { // starts with an instruction that isn't decoded
+        delete block;
+        return nullptr;
+    }
+    block->end = address;
+    block->ops.shrink_to_fit();
+
+    unique_ptr<Z80_Block*[]>& table = blockMap[block->start >> BLOCK_PAGE_SHIFT];
+    if (!table) table.reset(new Z80_Block*[1 << BLOCK_PAGE_SHIFT]());
+    table[block->start & ((1 << BLOCK_PAGE_SHIFT) - 1)] = block;
+    for (unsigned page = block->start >> BLOCK_PAGE_SHIFT; page <= (block->end - 1) >> BLOCK_PAGE_SHIFT; page++) {
+        pageBlocks[page].push_back(block);
+    }
+    markCode(block);
+    return block;
+}
+
+void Z80_Core::markCode(Z80_Block* block) {
+    for (unsigned address = block->start; address < block->end; address++) {
+        codeMap[address >> 3] |= 1 << (address & 7);
+    }
+}
+
+void Z80_Core::invalidateCode(uint16_t address) {
+    unsigned first = address >> BLOCK_PAGE_SHIFT;
+    unsigned last = first;
+    vector<Z80_Block*>& list = pageBlocks[first];
+
+    for (size_t n = 0; n < list.size();) {
+        Z80_Block* block = list[n];
+        if (address < block->start || address >= block->end) {
+            n++;
+            continue;
+        }
+        // Unlink it from every page it covers, this one included
+        for (unsigned page = block->start >> BLOCK_PAGE_SHIFT; page <= (block->end - 1) >> BLOCK_PAGE_SHIFT; page++) {
+            vector<Z80_Block*>& other = pageBlocks[page];
+            other.erase(find(other.begin(), other.end(), block));
+            if (page < first) first = page;
+            if (page > last) last = page;
+        }
+        blockMap[block->start >> BLOCK_PAGE_SHIFT][block->start & ((1 << BLOCK_PAGE_SHIFT) - 1)] = nullptr;
+        if (block->native) jitUnlink(block);
+        retiredBlocks.push_back(block);
+        codeModified = true;
+    }
+
+    // Blocks can overlap, rebuild the code bits of the pages from the ones left
+    for (unsigned page = first; page <= last; page++) {
+        memset(&codeMap[(page << BLOCK_PAGE_SHIFT) >> 3], 0, (1 << BLOCK_PAGE_SHIFT) >> 3);
+    }
+    for (unsigned page = first; page <= last; page++) {
+        for (Z80_Block* block : pageBlocks[page]) markCode(block);
+    }
+}
+
+void Z80_Core::flushBlocks() {
+    for (unsigned page = 0; page < BLOCK_PAGES; page++) {
+        pageBlocks[page].resize(0);
+        if (!blockMap[page]) continue;
+        for (unsigned n = 0; n < (1 << BLOCK_PAGE_SHIFT); n++) delete blockMap[page][n];
+        blockMap[page].reset();
+    }
+    for (Z80_Block* block : retiredBlocks) delete block;
+    retiredBlocks.resize(0);
+    memset(codeMap, 0, sizeof(codeMap));
+    codeModified = false;
+    jit.reset();
+}
+
+inline void Z80_Core::run_block(Z80_Block* block) {
+    codeModified = false;
+    uint32_t previous = FUSE_NONE;
+    for (const Z80_Decoded& op : block->ops) {
+        uint64_t fused = fusedRuns;
+        startInstruction(op.opcode, pc);
+        cycles += op.cycles;
+        pc = op.next;
+        operandCursor = op.operands;
+        (this->*op.handler)();
+        operandCursor = nullptr;
+        if (profilePairs) profileOp(op, fusedRuns != fused, previous);
+        pollDevices();
+        // Leave on a taken branch, an interrupt or a store into cached code
+        if (halt || pc != op.next || codeModified) break;
+    }
+}
+
+void Z80_Core::run_cached() {
+    while (!halt) {
+        if (breakpoints && breakpointAt(pc)) {
+            stop(STOP_BREAKPOINT);
             break;
-        default:
-            cout << "Invalid FD instruction: " << hex << (int)ins << " at PC: " << (int)pc << endl;
+        }
+        Z80_Block* block = findBlock(pc);
+        if (block == nullptr) {
+            decode_execute(fetchOperand());
+            pollDevices();
+            continue;
+        }
+        run_block(block);
+    }
+}
+
+void Z80_Core::jitStart(Z80_Core* core, uint8_t opcode) {
+    core->startInstruction(opcode, core->pc);
+}
+
+void Z80_Core::jitPoll(Z80_Core* core) {
+    core->pollDevices();
+}
+
+uint8_t Z80_Core::jitRead(Z80_Core* core, uint16_t address) {
+    return core->memory.read(address);
+}
+
+void Z80_Core::run_jit() {
+    if (DEBUG || !jit.start()) { // tracing every instruction, or no JIT for this host
+        run_cached();
+        return;
     }
-}
\ No newline at end of file
+    while (!halt) {
+        Z80_Block* block = findBlock(pc);
+        if (block == nullptr) {
+            decode_execute(fetchOperand());
+            pollDevices();
+            continue;
+        }
+        if (block->native == nullptr && ++block->hits == JIT_THRESHOLD) {
+            jitCompile(block);
+        }
+        if (block->native == nullptr) {
+            run_block(block);
+            continue;
+        }
+
+        codeModified = false;
+        jit.enter(this, block->native);
+        if (jit.linkSite) { // left through a direct jump, chain it if the target is compiled by now
+            Z80_Block* target = blockAt(pc);
+            if (target && target->native) jitLink(jit.linkSite, target);
+            jit.linkSite = nullptr;
+        }
+    }
+}